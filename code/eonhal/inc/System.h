@@ -183,6 +183,7 @@ extern "C"
 	void system_sleepLPMillis(uint32_t milliseconds);
 	void system_stopSeconds(uint32_t seconds);
 	void system_stopMillis(uint32_t milliseconds);
+	// UART bytes received during Stop are only kept after uart_enableStopMode() (uart.h)
 	void system_stopUntilInterrupt(void); // This function doesn't required System_RTC_initLSI
 	void system_standby(void);
 	void system_standbySeconds(uint32_t seconds);
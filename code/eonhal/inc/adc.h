@@ -14,6 +14,37 @@
 #include "stm32l0xx_ll_adc.h"
 #include "pinmap_hal.h"
 
+/** 
+ ===============================================================================
+              ##### Definitions #####
+ ===============================================================================
+ */
+
+// DMA channel of the scan (1 or 2, request 0). Channel 2 is also the SPI1 RX one.
+#ifndef ADC_DMA_CHANNEL
+#define ADC_DMA_CHANNEL LL_DMA_CHANNEL_1
+#endif
+
+// Oversampling at start up, 16 conversions averaged by the hardware (12 bits). See adc_setOversampling().
+#ifndef ADC_OVS_RATIO
+#define ADC_OVS_RATIO 16
+#endif
+#ifndef ADC_OVS_SHIFT
+#define ADC_OVS_SHIFT 4
+#endif
+
+// Scan modes
+#define ADC_SCAN_SINGLE 0x00		 /*!< One pass over the channels */
+#define ADC_SCAN_CONTINUOUS 0x01 /*!< Passes back to back, the values array is rewritten in circular mode */
+
+/** 
+ ===============================================================================
+              ##### Types #####
+ ===============================================================================
+ */
+
+typedef void (*adcCallback_t)(void *ctx);
+
 /** 
  ===============================================================================
               ##### Public functions #####
@@ -28,10 +59,22 @@
 void adc_setSampleTime(uint8_t ADC_SampleTime);
 
 /**
- * @brief Read the adc value from the pin specified
+ * @brief Set the hardware oversampler: every trigger converts ratio times, the sum is shifted
+ * right by shift and lands in the data register as one result, with no CPU work. The effective
+ * resolution is 12 + log2(ratio) - shift bits, e.g. ratio 16 shift 4 averages to 12 bits,
+ * ratio 256 shift 4 gives 16 bits. Applies to adc_readU() and to the scans.
+ *
+ * @param {ratio} 1 (off), 2, 4, 8, 16, 32, 64, 128 or 256
+ * @param {shift} 0 to 8, at most log2(ratio)
+ * @return {uint8_t} Effective resolution in bits (12 to 16), 0 if the setting is not valid or a scan runs
+ */
+uint8_t adc_setOversampling(uint16_t ratio, uint8_t shift);
+
+/**
+ * @brief Read the adc value from the pin specified, one oversampled conversion
  * 
  * @param {pin} Analog pin
- * @return {uint16_t} Values between 0 - 4095
+ * @return {uint16_t} Values between 0 - 4095, up to 0xFFF0 at 16 bits (see adc_setOversampling())
  */
 uint16_t adc_readU(pin_t pin);
 
@@ -43,4 +86,35 @@ uint16_t adc_readU(pin_t pin);
  */
 float adc_readN(pin_t pin);
 
+/**
+ * @brief Convert several pins in one sequencer pass, the results are moved by DMA and the CPU is
+ * only involved at the end of each pass. The sequencer converts the channels in ascending channel
+ * number (not in the order of pins), values[i] is the i-th selected channel.
+ * adc_readU() must not be used while a scan runs.
+ *
+ * @param {pins} Analog pins
+ * @param {count} Number of pins
+ * @param {values} Results (at the adc_setOversampling() resolution), one per distinct channel, must stay valid until the scan ends
+ * @param {mode} ADC_SCAN_SINGLE or ADC_SCAN_CONTINUOUS
+ * @param {cb} Called from the DMA interrupt after every pass (can be NULL). In continuous mode
+ * the next pass is already rewriting values, copy them there.
+ * @param {ctx} User pointer handed back to the callback
+ * @return {uint8_t} 1 if started, 0 if a scan is running, there is no analog pin or
+ * ADC_DMA_CHANNEL belongs to another peripheral
+ */
+uint8_t adc_scanStart(const pin_t *pins, uint8_t count, uint16_t *values, uint8_t mode, adcCallback_t cb, void *ctx);
+
+/**
+ * @brief Stop a scan, the running pass is dropped
+ *
+ */
+void adc_scanStop(void);
+
+/**
+ * @brief Check if a scan is running (a single pass clears it before its callback)
+ *
+ * @return {uint8_t} 1 while busy
+ */
+uint8_t adc_scanBusy(void);
+
 #endif
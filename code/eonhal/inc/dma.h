@@ -0,0 +1,72 @@
+/**
+  ******************************************************************************
+  * @file    dma.h
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   DMA Channel Dispatcher
+  ******************************************************************************
+*/
+
+#ifndef __DMA_H
+#define __DMA_H
+
+#include <stdint.h>
+#include "stm32l0xx.h"
+#include "stm32l0xx_ll_dma.h"
+
+/**
+ ===============================================================================
+              ##### Definitions #####
+ ===============================================================================
+ */
+
+// Channel event flags passed to the callback (same layout as DMA_ISR per channel)
+#define DMA_EVT_TC ((uint8_t)0x02) /*!< Transfer complete */
+#define DMA_EVT_HT ((uint8_t)0x04) /*!< Half transfer     */
+#define DMA_EVT_TE ((uint8_t)0x08) /*!< Transfer error    */
+
+// Default channels, the UARTs never share one. None is shared on the L031 (no USART1 nor SPI2):
+//   1 ADC | 2 SPI1 RX, USART1 TX | 3 SPI1 TX, USART1 RX | 4 USART2 TX | 5 USART2 RX
+//   6 LPUART1 RX, SPI2 RX | 7 LPUART1 TX, SPI2 TX
+// A channel is owned by one peripheral at a time, dma_attach() refuses it to the others.
+
+// DMA1 channel base address from its LL number (LL_DMA_CHANNEL_1 ... LL_DMA_CHANNEL_7)
+#define DMA_CHANNEL_REG(__CH__) ((DMA_Channel_TypeDef *)((uint32_t)DMA1_Channel1 + ((__CH__)-1U) * 0x14U))
+
+/**
+ ===============================================================================
+              ##### Types #####
+ ===============================================================================
+ */
+
+typedef void (*dmaCallback_t)(void *ctx, uint8_t events);
+
+/**
+ ===============================================================================
+              ##### Functions #####
+ ===============================================================================
+ */
+
+/**
+ * @brief Route a DMA1 channel to a peripheral request and attach its interrupt callback.
+ * Enables the DMA1 clock and the NVIC line shared by the channel group. The channel belongs to
+ * the peripheral of that request until dma_detach(), attaching it again with the same request
+ * only replaces the callback.
+ *
+ * @param {channel} LL_DMA_CHANNEL_1 ... LL_DMA_CHANNEL_7
+ * @param {request} LL_DMA_REQUEST_x for the peripheral (see RM0377 DMA request mapping)
+ * @param {cb} Called from the DMA interrupt with the channel events (can be NULL)
+ * @param {ctx} User pointer handed back to the callback
+ * @return {uint8_t} 1 if attached, 0 if the channel is attached to another request (left untouched)
+ */
+uint8_t dma_attach(uint32_t channel, uint32_t request, dmaCallback_t cb, void *ctx);
+
+/**
+ * @brief Disable a DMA1 channel and remove its callback
+ *
+ * @param {channel} LL_DMA_CHANNEL_1 ... LL_DMA_CHANNEL_7
+ */
+void dma_detach(uint32_t channel);
+
+#endif
@@ -58,4 +58,14 @@ obtain a copy.
 */
 uint16_t crc16_update(uint16_t crc, uint8_t a);
 
+/** @ingroup util_crc16
+    Same CRC as crc16_update() over a whole buffer (Modbus RTU CRC when
+    started with 0xFFFF).
+    @param uint16_t crc (0x0000..0xFFFF)
+    @param const uint8_t *data
+    @param uint16_t len
+    @return calculated CRC (0x0000..0xFFFF)
+*/
+uint16_t crc16_buffer(uint16_t crc, const uint8_t *data, uint16_t len);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,79 @@
+/**
+  ******************************************************************************
+  * @file    eon_format.h
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   Header de Number Formatting Library
+  ******************************************************************************
+*/
+
+#ifndef __EON_FORMAT_H
+#define __EON_FORMAT_H
+
+#include "stdint.h"
+
+/**
+ ===============================================================================
+              ##### Definitions #####
+ ===============================================================================
+ */
+
+// Enough for any 64-bit number in base 2 with its sign, plus the null terminator
+#define FMT_BUFFER_SIZE 67
+
+// Maximum decimals of fmt_fixed() and fmt_float()
+#define FMT_MAX_DECIMALS 9
+
+/**
+ ===============================================================================
+             ##### Functions #####
+ ===============================================================================
+ */
+
+/**
+ * @brief Format an unsigned number. Base 10 divides by reciprocal shifts, bases 2, 8 and 16 only shift.
+ *
+ * @param {dst} Buffer of at least FMT_BUFFER_SIZE bytes, the result is null terminated
+ * @param {n} Number
+ * @param {base} 2 to 16
+ * @param {width} Minimum number of digits, zero padded (0 or 1 for no padding)
+ * @return {uint8_t} Length of the string
+ */
+uint8_t fmt_uint(char *dst, uint64_t n, uint8_t base, uint8_t width);
+
+/**
+ * @brief Format a signed number, '-' and then the digits of its magnitude
+ *
+ * @param {dst} Buffer of at least FMT_BUFFER_SIZE bytes, the result is null terminated
+ * @param {n} Number
+ * @param {base} 2 to 16
+ * @param {width} Minimum number of digits, zero padded
+ * @return {uint8_t} Length of the string
+ */
+uint8_t fmt_int(char *dst, int64_t n, uint8_t base, uint8_t width);
+
+/**
+ * @brief Format a fixed-point number given as an integer scaled by 10^decimals. Ex: (1234, 2) -> "12.34"
+ *
+ * @param {dst} Buffer of at least FMT_BUFFER_SIZE bytes, the result is null terminated
+ * @param {n} Scaled number
+ * @param {decimals} Digits after the point (0 to FMT_MAX_DECIMALS)
+ * @return {uint8_t} Length of the string
+ */
+uint8_t fmt_fixed(char *dst, int64_t n, uint8_t decimals);
+
+/**
+ * @brief Format a float with a fixed number of decimals, rounded. The only floating point
+ * operation is the scaling to fixed point, the digits come from fmt_fixed(). NaN is written
+ * as "nan", infinities as "inf"/"-inf" and values that do not fit in an int64_t once scaled
+ * as "ovf"/"-ovf".
+ *
+ * @param {dst} Buffer of at least FMT_BUFFER_SIZE bytes, the result is null terminated
+ * @param {n} Number
+ * @param {decimals} Digits after the point (0 to FMT_MAX_DECIMALS)
+ * @return {uint8_t} Length of the string
+ */
+uint8_t fmt_float(char *dst, float n, uint8_t decimals);
+
+#endif
@@ -2,7 +2,7 @@
   ******************************************************************************
   * @file    i2c.h 
   * @author  Pablo Fuentes
-	* @version V1.0.0
+	* @version V1.0.1
   * @date    2019
   * @brief   I2C Library
   ******************************************************************************
@@ -39,17 +39,80 @@
 #define I2C_400KHZ_C32MHZ 0x00B0122A
 #define I2C_1MHZ_C32MHZ 0x0030040E
 
-/* I2C Slave Responses */
-#define I2C_NoData 0         // the slave has not been addressed
-#define I2C_ReadAddressed 1  // the master has requested a read from this slave (slave = transmitter)
-#define I2C_WriteGeneral 2   // the master is writing to all slave
-#define I2C_WriteAddressed 3 // the master is writing to this slave (slave = receiver)
+/* Timeout of every wait of the blocking functions (us), independent of the system clock */
+#ifndef I2C_TIMEOUT_US
+#define I2C_TIMEOUT_US 25000UL
+#endif
+
+/* Transfer Results */
+#define I2C_OK 0
+#define I2C_PENDING 1      // queued or running
+#define I2C_ERR_NACK (-1)  // address or data not acknowledged
+#define I2C_ERR_ARLO (-2)  // arbitration lost to another master
+#define I2C_ERR_BERR (-3)  // misplaced start or stop on the bus
+#define I2C_ERR_TIMEOUT (-4) // a flag did not come in I2C_TIMEOUT_US (bus held low)
+#define I2C_ERR_PEC (-5)     // SMBus PEC mismatch or block count too long
+#define I2C_ERR_LENGTH (-6)  // more bytes than the transfer can carry, nothing sent
+
+/* SMBus */
+#define I2C_SMBUS_ARA 0x18 // Alert response address (0x0C << 1)
 
-/* Redefinition of Slave Responses for easy set */
-#define I2C_RequestNoData I2C_NoData
-#define I2C_RequestReadAddressed I2C_ReadAddressed
-#define I2C_RequestWriteGeneral I2C_WriteGeneral
-#define I2C_RequestWriteAddressed I2C_WriteAddressed
+/* Slave register map */
+#define I2C_SLAVE_FILLER 0xFF // byte sent when the master reads past the end of the map
+
+/** 
+ ===============================================================================
+              ##### Types #####
+ ===============================================================================
+ */
+
+typedef void (*i2cCallback_t)(void *ctx, int8_t status);
+
+/**
+ * @brief Queued master transaction: a write, a read, or a write then a read with a repeated start.
+ * The caller owns it, it must stay valid until its status is no longer I2C_PENDING.
+ *
+ */
+typedef struct I2CTransfer_t
+{
+	uint8_t address;							 /*!< Slave address, same form as in i2c_read()/i2c_write() (7 bits << 1) */
+	const uint8_t *tx;						 /*!< Bytes to write first, can be NULL */
+	uint16_t txLen;								 /*!< 0 to 65535 */
+	uint8_t *rx;									 /*!< Bytes read after a repeated start (or a start if txLen is 0), can be NULL */
+	uint16_t rxLen;								 /*!< 0 to 65535 */
+	i2cCallback_t cb;							 /*!< Called from the I2C interrupt when it ends (can be NULL) */
+	void *ctx;										 /*!< User pointer handed back to the callback */
+	volatile int8_t status;				 /*!< I2C_PENDING, then I2C_OK or I2C_ERR_x */
+	struct I2CTransfer_t *next;		 /*!< Queue link, used by the driver */
+} I2CTransfer_t;
+
+/**
+ * @brief One entry of i2c_readRegs()
+ *
+ */
+typedef struct I2CRegRead_t
+{
+	uint8_t address; /*!< Slave address (7 bits << 1) */
+	uint16_t reg;		 /*!< First register */
+	uint8_t regLen;	 /*!< Bytes of the register address, 1 or 2 (MSB first) */
+	uint8_t *data;	 /*!< Destination */
+	uint16_t length; /*!< Bytes to read */
+	int32_t result;	 /*!< Set by i2c_readRegs(): bytes read or I2C_ERR_x */
+} I2CRegRead_t;
+
+/**
+ * @brief Registers served by the slave. The first byte of a write sets the register pointer,
+ * the next ones are stored from it on. A read starts at the pointer. The pointer advances with
+ * every byte and is kept between transactions.
+ *
+ */
+typedef struct I2CSlaveMap_t
+{
+	uint8_t *regs;																		/*!< Register bytes */
+	uint16_t size;																		/*!< Number of registers, up to 256 */
+	uint16_t readOnly;																/*!< Registers from readOnly to size - 1 ignore writes (size if none) */
+	void (*onWrite)(uint8_t reg, uint16_t count);	/*!< Called from interrupt after the master writes registers, can be NULL */
+} I2CSlaveMap_t;
 
 /** 
  ===============================================================================
@@ -62,11 +125,45 @@ void i2c_init(I2C_TypeDef *I2Cx, uint32_t freq, pin_t scl, pin_t sda);
 void i2c_reset(I2C_TypeDef *I2Cx);
 void i2c_setFreq(I2C_TypeDef *I2Cx, uint32_t freq, uint8_t i2c_master_slave);
 
+/**
+ * @brief Free a bus held by a slave (SDA stuck low after a reset in the middle of a byte):
+ * up to 9 SCL pulses driven on the pins, a stop condition, then the I2C is reset and configured
+ * again with the last timing. Called by the blocking functions when the bus stays busy after an error.
+ *
+ * @param {I2Cx} I2C initialized with i2c_init()
+ * @return {uint8_t} 1 if SCL and SDA are high at the end
+ */
+uint8_t i2c_recover(I2C_TypeDef *I2Cx);
+
+/**
+ * @brief Calculate TIMINGR (PRESC, SCLDEL, SDADEL, SCLH, SCLL) for any kernel clock, with the
+ * analog filter on. The fastest SCL not above speed_hz that meets the I2C specification of the mode
+ * (standard up to 100 kHz, fast up to 400 kHz, fast plus up to 1 MHz) is chosen.
+ *
+ * @param {clk_hz} I2C kernel clock
+ * @param {speed_hz} Bus speed, 10000 to 1000000
+ * @param {rise_ns} SCL/SDA rise time of the bus (depends on the pull-ups and the capacitance)
+ * @param {fall_ns} Fall time
+ * @return {uint32_t} TIMINGR value for i2c_setFreq()/i2c_init(), 0 if the clock is too slow or
+ * speed_hz is out of range
+ */
+uint32_t i2c_computeTiming(uint32_t clk_hz, uint32_t speed_hz, uint16_t rise_ns, uint16_t fall_ns);
+
+/**
+ * @brief Set the bus speed for the current kernel clock, call it again after changing the system clock.
+ * Above 400 kHz the Fm+ drive of the I2C pins is enabled in SYSCFG.
+ *
+ * @param {I2Cx} I2C initialized with i2c_init()
+ * @param {speed_hz} Bus speed, 10000 to 1000000
+ * @return {uint8_t} 1 if set, 0 if the kernel clock is too slow for it or speed_hz is out of range
+ */
+uint8_t i2c_setSpeed(I2C_TypeDef *I2Cx, uint32_t speed_hz);
+
 // Start y Stop
 uint8_t i2c_start(I2C_TypeDef *I2Cx);
 #define i2c_stop(__I2C__) __I2C__->CR2 |= I2C_CR2_STOP
 
-// Byte Write and Read
+// Byte Write and Read (the byte or I2C_ERR_x, 1 or 0)
 int16_t i2c_read8(I2C_TypeDef *I2Cx, int last);
 uint8_t i2c_write8(I2C_TypeDef *I2Cx, int data);
 
@@ -76,12 +173,169 @@ args:
 	I2Cx = Establece el I2C a utilizar
 	address = Estable la direcci�n del esclavo
 	data = Puntero que establece los datos a enviar o el puntero que recibe los datos
-	length = La cantidad de datos que se van a leer o a escribir
+	length = La cantidad de datos que se van a leer o a escribir (mas de 255 en una sola transaccion, con RELOAD)
 	stop = Puede tomar dos valores: I2C_STOP o I2C_NO_STOP. Este argumento especifica si al final
 				 de la escritura o lectura se envia el bit de Stop, generalmente se usa I2C_STOP.
+return:
+	La cantidad de datos (hasta 65535) o un error I2C_ERR_x (negativo). Ante un error el bus queda libre: se envia el Stop
+	y, si sigue ocupado, se recupera con i2c_recover().
 */
-int16_t i2c_read(I2C_TypeDef *I2Cx, int address, char *data, int length, int stop);
-int16_t i2c_write(I2C_TypeDef *I2Cx, int address, const char *data, int length, int stop);
+int32_t i2c_read(I2C_TypeDef *I2Cx, int address, char *data, int length, int stop);
+int32_t i2c_write(I2C_TypeDef *I2Cx, int address, const char *data, int length, int stop);
+
+/**
+ * @brief Read registers: the register address is written, then the data is read after a repeated start.
+ * If any phase fails the bus is left idle (stop sent, flags cleared, recovered if still busy).
+ *
+ * @param {I2Cx} I2C initialized with i2c_init()
+ * @param {address} Slave address (7 bits << 1)
+ * @param {reg} First register
+ * @param {data} Destination
+ * @param {length} Bytes to read
+ * @return {int32_t} Bytes read (up to 65535) or I2C_ERR_x
+ */
+int32_t i2c_readReg(I2C_TypeDef *I2Cx, uint8_t address, uint8_t reg, uint8_t *data, uint16_t length);
+int32_t i2c_readReg16(I2C_TypeDef *I2Cx, uint8_t address, uint16_t reg, uint8_t *data, uint16_t length);
+
+/**
+ * @brief Write registers: the register address and the data go in the same transaction
+ *
+ * @param {I2Cx} I2C initialized with i2c_init()
+ * @param {address} Slave address (7 bits << 1)
+ * @param {reg} First register
+ * @param {data} Bytes to write
+ * @param {length} Number of bytes
+ * @return {int32_t} Bytes written (up to 65535) or I2C_ERR_x
+ */
+int32_t i2c_writeReg(I2C_TypeDef *I2Cx, uint8_t address, uint8_t reg, const uint8_t *data, uint16_t length);
+int32_t i2c_writeReg16(I2C_TypeDef *I2Cx, uint8_t address, uint16_t reg, const uint8_t *data, uint16_t length);
+
+/**
+ * @brief Read a list of register blocks, of one or several slaves, back to back.
+ * A failed entry does not stop the others.
+ *
+ * @param {I2Cx} I2C initialized with i2c_init()
+ * @param {list} Entries, the result of each one is set
+ * @param {count} Number of entries
+ * @return {uint8_t} Number of entries read
+ */
+uint8_t i2c_readRegs(I2C_TypeDef *I2Cx, I2CRegRead_t *list, uint8_t count);
+
+/**
+ * @brief Queue a transaction and return at once. The queue runs from the I2C interrupt, the
+ * next transaction starts as soon as the previous stop is sent. Do not use the blocking
+ * functions on the same I2C while the queue is not empty.
+ *
+ * @param {I2Cx} I2C initialized with i2c_init()
+ * @param {t} Transaction, its status is set to I2C_PENDING
+ * @return {uint8_t} 1 if queued, 0 if the lengths are not valid
+ */
+uint8_t i2c_submit(I2C_TypeDef *I2Cx, I2CTransfer_t *t);
+
+/**
+ * @brief Check if the queue still has transactions
+ *
+ * @param {I2Cx} I2C
+ * @return {uint8_t} 1 while busy
+ */
+uint8_t i2c_busy(I2C_TypeDef *I2Cx);
+
+/** 
+ ===============================================================================
+              ##### SMBus #####
+ ===============================================================================
+ */
+
+/**
+ * @brief Initialize the I2C as SMBus host (SMBHEN, kept by i2c_setFreq() and i2c_recover()) with the
+ * hardware PEC: the PEC byte is appended to every write and checked on every read by the peripheral
+ * (I2C_ERR_PEC and a NACK if it does not match)
+ *
+ * @param {I2Cx} I2C
+ * @param {freq} TIMINGR value (I2C_100KHZ_CxMHZ, SMBus runs from 10 to 100 kHz)
+ * @param {scl} SCL pin
+ * @param {sda} SDA pin
+ */
+void i2cSmbus_init(I2C_TypeDef *I2Cx, uint32_t freq, pin_t scl, pin_t sda);
+
+/**
+ * @brief Send byte, write byte or write word (length 0, 1 or 2, words LSB first), with PEC
+ *
+ * @param {I2Cx} I2C initialized with i2cSmbus_init()
+ * @param {address} Slave address (7 bits << 1)
+ * @param {command} Command code
+ * @param {data} Bytes after the command
+ * @param {length} Number of bytes, up to 253
+ * @return {int16_t} Bytes written or I2C_ERR_x
+ */
+int16_t i2cSmbus_write(I2C_TypeDef *I2Cx, uint8_t address, uint8_t command, const uint8_t *data, uint8_t length);
+
+/**
+ * @brief Read byte or read word (length 1 or 2, words LSB first), with PEC
+ *
+ * @param {I2Cx} I2C initialized with i2cSmbus_init()
+ * @param {address} Slave address (7 bits << 1)
+ * @param {command} Command code
+ * @param {data} Destination
+ * @param {length} Number of bytes, up to 254
+ * @return {int16_t} Bytes read or I2C_ERR_x
+ */
+int16_t i2cSmbus_read(I2C_TypeDef *I2Cx, uint8_t address, uint8_t command, uint8_t *data, uint8_t length);
+
+/**
+ * @brief Block write: command, byte count, data and PEC
+ *
+ * @param {I2Cx} I2C initialized with i2cSmbus_init()
+ * @param {address} Slave address (7 bits << 1)
+ * @param {command} Command code
+ * @param {data} Block
+ * @param {count} Bytes of the block, up to 252 (32 in SMBus 2.0)
+ * @return {int16_t} Bytes written or I2C_ERR_x
+ */
+int16_t i2cSmbus_writeBlock(I2C_TypeDef *I2Cx, uint8_t address, uint8_t command, const uint8_t *data, uint8_t count);
+
+/**
+ * @brief Block read: the byte count sent by the slave sets the length of the transfer
+ *
+ * @param {I2Cx} I2C initialized with i2cSmbus_init()
+ * @param {address} Slave address (7 bits << 1)
+ * @param {command} Command code
+ * @param {data} Destination
+ * @param {length} Size of data, a longer block is read (for the PEC) but truncated
+ * @return {int16_t} Byte count of the block or I2C_ERR_x
+ */
+int16_t i2cSmbus_readBlock(I2C_TypeDef *I2Cx, uint8_t address, uint8_t command, uint8_t *data, uint8_t length);
+
+/**
+ * @brief Process call: a word is written and a word read after a repeated start
+ *
+ * @param {I2Cx} I2C initialized with i2cSmbus_init()
+ * @param {address} Slave address (7 bits << 1)
+ * @param {command} Command code
+ * @param {value} Word written
+ * @return {int32_t} Word read (0 to 65535) or I2C_ERR_x
+ */
+int32_t i2cSmbus_processCall(I2C_TypeDef *I2Cx, uint8_t address, uint8_t command, uint16_t value);
+
+/**
+ * @brief Read the alert response address (ARA): the slave that pulled SMBALERT# answers with its
+ * address and releases the line. Call it again while the line stays low, several slaves can alert.
+ *
+ * @param {I2Cx} I2C initialized with i2cSmbus_init()
+ * @return {int16_t} Address of the slave (7 bits << 1) or I2C_ERR_x (I2C_ERR_NACK if none)
+ */
+int16_t i2cSmbus_alertResponse(I2C_TypeDef *I2Cx);
+
+/**
+ * @brief Call a function when a slave pulls SMBALERT# low. It runs in the I2C interrupt, where
+ * the blocking functions must not be used: set a flag there and call i2cSmbus_alertResponse() later.
+ *
+ * @param {I2Cx} I2C initialized with i2cSmbus_init()
+ * @param {smba} SMBA pin of the I2C
+ * @param {af} Alternate function of the SMBA pin (see the datasheet)
+ * @param {cb} Callback, NULL to stop watching the line
+ */
+void i2cSmbus_attachAlert(I2C_TypeDef *I2Cx, pin_t smba, uint8_t af, void (*cb)(void));
 
 /** 
  ===============================================================================
@@ -89,20 +343,53 @@ int16_t i2c_write(I2C_TypeDef *I2Cx, int address, const char *data, int length,
  ===============================================================================
  */
 
-/* Initialization */
-void i2cSlave_init(I2C_TypeDef *I2Cx, uint32_t freq, int SlaveAddr, pin_t scl, pin_t sda);
-void i2cSlave_initWIrq(I2C_TypeDef *I2Cx, uint32_t freq, int SlaveAddr, pin_t scl, pin_t sda);
-void i2cSlave_address(I2C_TypeDef *I2Cx, uint32_t address);
-void i2cSlave_mode(I2C_TypeDef *I2Cx, int enable_slave);
+/**
+ * @brief Serve a register map as a slave, from the I2C interrupt. The clock is only stretched
+ * while the address match is served: the first byte of a read is loaded then, the next ones
+ * while the previous byte is being sent.
+ *
+ * @param {I2Cx} I2C
+ * @param {freq} TIMINGR value of the bus speed (I2C_xxx_CxMHZ or i2c_computeTiming()), sets the data setup and hold times
+ * @param {address} Own address (7 bits << 1)
+ * @param {scl} SCL pin
+ * @param {sda} SDA pin
+ * @param {map} Registers answered at address
+ */
+void i2cSlave_init(I2C_TypeDef *I2Cx, uint32_t freq, uint8_t address, pin_t scl, pin_t sda, I2CSlaveMap_t *map);
+
+/**
+ * @brief Answer a second address with its own register map (or the same one)
+ *
+ * @param {I2Cx} I2C initialized with i2cSlave_init()
+ * @param {address} Second own address (7 bits << 1)
+ * @param {map} Registers answered at address, NULL to disable the second address
+ */
+void i2cSlave_address2(I2C_TypeDef *I2Cx, uint8_t address, I2CSlaveMap_t *map);
+
+/**
+ * @brief Keep answering while the core is in Stop mode (system_stopUntilInterrupt() and friends).
+ * The I2C is moved to the HSI16 kernel clock with WUPEN set: the address match wakes the MCU and
+ * SCL is stretched until the interrupt serves it, so the first transaction is not lost.
+ * Only I2C1 and I2C3 can wake the MCU.
+ *
+ * @param {I2Cx} I2C initialized with i2cSlave_init()
+ * @param {speed_hz} Bus speed, for the data setup and hold times at 16 MHz
+ * @return {uint8_t} 1 if enabled, 0 if the I2C can not wake the MCU
+ */
+uint8_t i2cSlave_enableStopMode(I2C_TypeDef *I2Cx, uint32_t speed_hz);
 
-/* Receive Master Request */
-int i2cSlave_receiveMasterRequest(I2C_TypeDef *I2Cx);
+/**
+ * @brief Go back to the previous kernel clock and timing, the slave stops working in Stop mode
+ *
+ * @param {I2Cx} I2C
+ */
+void i2cSlave_disableStopMode(I2C_TypeDef *I2Cx);
 
-/* Funciones de Escritura y Lectura */
-int i2cSlave_read(I2C_TypeDef *I2Cx, char *data, int length);
-int i2cSlave_write(I2C_TypeDef *I2Cx, const char *data, int length);
-#define i2cSlave_writeByte(__I2C__, __DATA__) i2c_write8(__I2C__, __DATA__)
-#define i2cSlave_readByte(__I2C__) i2c_read8(__I2C__, 0)
-#define i2cSlave_stop(__I2C__) i2c_stop(__I2C__)
+/**
+ * @brief Stop answering, the I2C can be initialized again as master
+ *
+ * @param {I2Cx} I2C
+ */
+void i2cSlave_end(I2C_TypeDef *I2Cx);
 
 #endif
@@ -0,0 +1,108 @@
+/**
+  ******************************************************************************
+  * @file    i2c_timing.h
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   I2C TIMINGR solver, no register access
+  ******************************************************************************
+*/
+
+#ifndef __I2C_TIMING_H_
+#define __I2C_TIMING_H_
+
+#include <stdint.h>
+#include "stm32l0xx.h"
+
+// Analog filter delay (ns, tAF of the datasheets), the digital filter is not used
+#define I2C_AF_MIN 50U
+#define I2C_AF_MAX 110U
+
+/* Bus characteristics of each mode (ns), from the I2C specification */
+typedef struct
+{
+	uint32_t hddatMin; // Data hold time
+	uint32_t vddatMax; // Data valid time
+	uint32_t sudatMin; // Data setup time
+	uint32_t lsclMin;	 // SCL low period
+	uint32_t hsclMin;	 // SCL high period
+} I2CMode_t;
+
+static const I2CMode_t i2c_modes[3] = {
+		{0, 3450, 250, 4700, 4000}, // Standard, up to 100 kHz
+		{0, 900, 100, 1300, 600},		// Fast, up to 400 kHz
+		{0, 450, 50, 500, 260},			// Fast plus, up to 1 MHz
+};
+
+/* Ticks of period (ps) needed to reach at least t (ps), minus one like the TIMINGR fields */
+__STATIC_INLINE int32_t i2c_ticks(int32_t t, uint32_t period)
+{
+	if (t <= 0)
+		return 0;
+	return (int32_t)((t + period - 1) / period) - 1;
+}
+
+// Slowest bus speed accepted, the picosecond period of much slower ones does not fit in target
+#define I2C_TIMING_MIN_HZ 10000
+
+/* TIMINGR of the fastest SCL not above speed_hz, 0 if the clock is too slow (see i2c_computeTiming()) */
+__STATIC_INLINE uint32_t i2c_solveTiming(uint32_t clk_hz, uint32_t speed_hz, uint16_t rise_ns, uint16_t fall_ns)
+{
+	const I2CMode_t *mode;
+	uint32_t presc, tpresc, tclk, target;
+	int32_t tr = rise_ns * 1000, tf = fall_ns * 1000;
+	int32_t sdadelMin, sdadelMax, tsync, scldel, sdadel, scll, sclh, phase, extra, period;
+
+	if (clk_hz == 0 || speed_hz < I2C_TIMING_MIN_HZ || speed_hz > 1000000)
+		return 0;
+	mode = &i2c_modes[(speed_hz <= 100000) ? 0 : (speed_hz <= 400000) ? 1 : 2];
+
+	// Everything in picoseconds, so 32 MHz (31.25 ns) keeps its precision
+	tclk = (uint32_t)(1000000000000ULL / clk_hz);
+	target = (uint32_t)(1000000000000ULL / speed_hz);
+
+	// RM0377 I2C timings: data hold between the fall time and the valid time, then the setup time.
+	// hddatMin is below tAF, so the hold term is signed and the minimum clamped at 0
+	sdadelMin = tf + ((int32_t)mode->hddatMin - (int32_t)I2C_AF_MIN) * 1000 - 3 * (int32_t)tclk;
+	if (sdadelMin < 0)
+		sdadelMin = 0;
+	sdadelMax = ((int32_t)mode->vddatMax - (int32_t)I2C_AF_MAX) * 1000 - tr - 4 * (int32_t)tclk;
+	tsync = I2C_AF_MIN * 1000 + 2 * (int32_t)tclk;
+
+	// The smallest prescaler that fits gives the finest resolution
+	for (presc = 0; presc < 16; presc++)
+	{
+		tpresc = (presc + 1) * tclk;
+
+		scldel = i2c_ticks(tr + (int32_t)mode->sudatMin * 1000, tpresc);
+		sdadel = (int32_t)(((uint32_t)sdadelMin + tpresc - 1) / tpresc);
+		if (scldel > 15 || sdadel > 15 || sdadel * (int32_t)tpresc > sdadelMax)
+			continue;
+
+		// Shortest low and high periods (the kernel clock must be 4 times faster than each one),
+		// then the rest of the period split between them
+		phase = (int32_t)(2 * tclk / tpresc);
+		scll = i2c_ticks((int32_t)mode->lsclMin * 1000 - tsync, tpresc);
+		sclh = i2c_ticks((int32_t)mode->hsclMin * 1000 - tsync, tpresc);
+		if (scll < phase)
+			scll = phase;
+		if (sclh < phase)
+			sclh = phase;
+		period = 2 * tsync + (scll + 1 + sclh + 1) * (int32_t)tpresc + tr + tf;
+		if (period < (int32_t)target)
+		{
+			extra = ((int32_t)target - period + (int32_t)tpresc - 1) / (int32_t)tpresc;
+			scll += (extra + 1) / 2;
+			sclh += extra / 2;
+		}
+		if (scll > 255 || sclh > 255)
+			continue;
+
+		return (presc << I2C_TIMINGR_PRESC_Pos) | ((uint32_t)scldel << I2C_TIMINGR_SCLDEL_Pos) |
+					 ((uint32_t)sdadel << I2C_TIMINGR_SDADEL_Pos) | ((uint32_t)sclh << I2C_TIMINGR_SCLH_Pos) |
+					 ((uint32_t)scll << I2C_TIMINGR_SCLL_Pos);
+	}
+	return 0;
+}
+
+#endif
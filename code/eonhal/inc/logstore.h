@@ -0,0 +1,114 @@
+/**
+  ******************************************************************************
+  * @file    logstore.h
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   Header de Append-only Log Store Library (records on SPI NOR flash)
+  ******************************************************************************
+*/
+
+#ifndef __LOGSTORE_H
+#define __LOGSTORE_H
+
+#include <stdint.h>
+#include "spiflash.h"
+
+/**
+ ===============================================================================
+              ##### Definitions #####
+ ===============================================================================
+ */
+
+#define LOGSTORE_SECTOR_HEADER 20U
+#define LOGSTORE_RECORD_HEADER 8U
+
+// Longest record, a record never spans two sectors
+#define LOGSTORE_MAX_RECORD (SPIFLASH_SECTOR_SIZE - LOGSTORE_SECTOR_HEADER - LOGSTORE_RECORD_HEADER)
+
+// Results, besides the SPIFLASH_* ones
+#define LOGSTORE_END (-3) /*!< No more records to read */
+
+/**
+ ===============================================================================
+              ##### Types #####
+ ===============================================================================
+ */
+
+/**
+ * @brief Log over a range of 4 KB sectors used as a ring. Every sector starts with a header
+ * (sequence number, erase count), every record with its length, sequence number and CRC16.
+ *
+ */
+typedef struct LogStore_t
+{
+	SPIFlash_t *fl;
+	uint32_t start;				/*!< First byte of the region, sector aligned */
+	uint16_t sectors;			/*!< Sectors in the region, 0 while not mounted */
+	uint16_t head;				/*!< Sector being written, 0xFFFF while the log is empty */
+	uint16_t offset;			/*!< Write position in the head sector */
+	uint32_t sectorSeq;		/*!< Sequence number of the head sector */
+	uint32_t recordSeq;		/*!< Sequence number of the next record */
+	uint16_t readSector;	/*!< Read cursor */
+	uint16_t readOffset;
+} LogStore_t;
+
+/**
+ ===============================================================================
+              ##### Functions #####
+ ===============================================================================
+ */
+
+/**
+ * @brief Mount the log and find where it ends. The head sector is found by a binary search
+ * over the sector sequence numbers (log2 of the sectors header reads), then only that sector is
+ * scanned. A record cut by a power loss fails its CRC and is skipped. The read cursor is rewound.
+ *
+ * @param {ls} Log descriptor
+ * @param {fl} Flash, already initialized with spiflash_init()
+ * @param {start} First byte of the region, multiple of SPIFLASH_SECTOR_SIZE
+ * @param {sectors} Sectors in the region, at least 2
+ * @return {int8_t} SPIFLASH_OK, SPIFLASH_BUSY if the flash could not be read or SPIFLASH_ERROR if the
+ * region does not fit the chip. On error the log is not mounted and the other calls fail.
+ */
+int8_t logstore_init(LogStore_t *ls, SPIFlash_t *fl, uint32_t start, uint16_t sectors);
+
+/**
+ * @brief Erase the whole region, the log becomes empty
+ *
+ * @param {ls} Log descriptor
+ * @return {int8_t} SPIFLASH_OK, SPIFLASH_BUSY or SPIFLASH_ERROR
+ */
+int8_t logstore_format(LogStore_t *ls);
+
+/**
+ * @brief Append a record. When the head sector is full the next one is erased (waiting for it),
+ * overwriting the oldest records, so every sector is erased once per lap of the ring.
+ *
+ * @param {ls} Log descriptor
+ * @param {data} Record
+ * @param {len} Bytes (1 to LOGSTORE_MAX_RECORD)
+ * @return {int8_t} SPIFLASH_OK, SPIFLASH_BUSY or SPIFLASH_ERROR
+ */
+int8_t logstore_append(LogStore_t *ls, const void *data, uint16_t len);
+
+/**
+ * @brief Move the read cursor to the oldest record
+ *
+ * @param {ls} Log descriptor
+ * @return {int8_t} SPIFLASH_OK or SPIFLASH_BUSY, the cursor is then left on the head sector
+ */
+int8_t logstore_rewind(LogStore_t *ls);
+
+/**
+ * @brief Read the record at the cursor and advance, records with a wrong CRC are skipped
+ *
+ * @param {ls} Log descriptor
+ * @param {dst} Destination, a longer record is truncated
+ * @param {maxlen} Size of dst
+ * @param {seq} Sequence number of the record (can be NULL)
+ * @return {int32_t} Length of the record, LOGSTORE_END or a SPIFLASH_* error
+ */
+int32_t logstore_read(LogStore_t *ls, void *dst, uint16_t maxlen, uint32_t *seq);
+
+#endif
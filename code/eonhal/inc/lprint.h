@@ -12,6 +12,7 @@
 #define LPRINT_H_
 
 #include <stdarg.h>
+#include <stdint.h>
 
 /**
  * @brief Macro for printing float numbers in lprint
@@ -32,6 +33,21 @@
  */
 void LPUTC(char c);
 
+/**
+ * @brief Macro to define the override LPUTS function
+ * 
+ */
+#define LPRINT_TARGET_STRING void LPUTS(const char *s, uint16_t len)
+
+/**
+ * @brief Print len characters in one go. Overriding it sends every text run and number
+ * of lprint() as one write, the default calls LPUTC() for each character.
+ * 
+ * @param {s} Characters to be printed (not null terminated)
+ * @param {len} Number of characters
+ */
+void LPUTS(const char *s, uint16_t len);
+
 /**
  * @brief Print a formatted string
  * 
@@ -40,4 +56,70 @@ void LPUTC(char c);
  */
 void lprint(const char *format, ...);
 
+/**
+ ===============================================================================
+              ##### Binary Log #####
+ ===============================================================================
+ */
+
+/*
+ * Deferred binary logging: the format strings stay on the host. They are listed once
+ * in a catalog header shared with tools/lprint_decode.py, the ID of a format is its line order:
+ *
+ *   // lformats.h
+ *   LFMT(BOOT, "boot v{d}")
+ *   LFMT(TEMP, "temp {f} C, raw {x}")
+ *
+ *   #define LFMT(__name__, __fmt__) LOG_##__name__,
+ *   enum { 
+ *   #include "lformats.h"
+ *   };
+ *   #undef LFMT
+ *
+ *   LLOG(LOG_TEMP, FL(t), raw);  // Only queues a few bytes
+ *   lprint_flush();              // From the main loop, sends them through LPUTS()
+ *
+ * Each record is the format ID, the milliseconds since the previous record and the
+ * arguments (zigzag), all as varints, COBS encoded and ended by 0x00.
+ */
+
+// Log ring buffer size, must be a power of two
+#ifndef LPRINT_LOG_BUFFER_SIZE
+#define LPRINT_LOG_BUFFER_SIZE 256
+#endif
+
+// Maximum arguments of LLOG()
+#define LPRINT_LOG_MAX_ARGS 8
+
+#define LPRINT_NARGS(...) LPRINT_NARGS_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LPRINT_NARGS_(_id, _1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+
+/**
+ * @brief Queue a binary log record: LLOG(id) or LLOG(id, arg1, ..., arg8), integer arguments
+ * 
+ */
+#define LLOG(...) lprint_log(LPRINT_NARGS(__VA_ARGS__), __VA_ARGS__)
+
+/**
+ * @brief Queue a binary log record, use LLOG() instead. Safe from interrupts.
+ * 
+ * @param {argc} Number of arguments
+ * @param {id} Format ID in the catalog
+ * @param {...} Integer arguments
+ */
+void lprint_log(uint8_t argc, uint16_t id, ...);
+
+/**
+ * @brief Send the queued records through LPUTS()
+ * 
+ */
+void lprint_flush(void);
+
+/**
+ * @brief Records lost because the log buffer was full
+ * 
+ * @return {uint32_t} Dropped records
+ */
+uint32_t lprint_dropped(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,123 @@
+/**
+  ******************************************************************************
+  * @file    modbus.h
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   Header de Modbus RTU Library (slave and master over a UART port)
+  ******************************************************************************
+*/
+
+#ifndef __MODBUS_H
+#define __MODBUS_H
+
+#include <stdint.h>
+#include "uart.h"
+
+/**
+ ===============================================================================
+              ##### Definitions #####
+ ===============================================================================
+ */
+
+// Function codes
+#define MODBUS_READ_HOLDING ((uint8_t)0x03)
+#define MODBUS_READ_INPUT ((uint8_t)0x04)
+#define MODBUS_WRITE_SINGLE ((uint8_t)0x06)
+#define MODBUS_WRITE_MULTIPLE ((uint8_t)0x10)
+
+// Master results (exception codes 1 to 4 are returned as is)
+#define MODBUS_OK 0
+#define MODBUS_TIMEOUT (-1)
+#define MODBUS_BUSY (-2)
+
+// Exception codes
+#define MODBUS_EX_ILLEGAL_FUNCTION ((uint8_t)0x01)
+#define MODBUS_EX_ILLEGAL_ADDRESS ((uint8_t)0x02)
+#define MODBUS_EX_ILLEGAL_VALUE ((uint8_t)0x03)
+#define MODBUS_EX_DEVICE_FAILURE ((uint8_t)0x04)
+
+/**
+ ===============================================================================
+              ##### Types #####
+ ===============================================================================
+ */
+
+/**
+ * @brief Register map served by the slave. Requests read and write these arrays in place.
+ *
+ */
+typedef struct ModbusMap_t
+{
+	uint16_t *holding;															/*!< Holding registers (0x03, 0x06, 0x10), can be NULL */
+	uint16_t holdingCount;													/*!< Number of holding registers */
+	const uint16_t *input;													/*!< Input registers (0x04), can be NULL */
+	uint16_t inputCount;														/*!< Number of input registers */
+	void (*onWrite)(uint16_t address, uint16_t count); /*!< Called from interrupt after holding registers are written, can be NULL */
+} ModbusMap_t;
+
+/**
+ ===============================================================================
+              ##### Functions #####
+ ===============================================================================
+ */
+
+/**
+ * @brief Serve a register map as a Modbus RTU slave on an initialized UART port.
+ * Frames are delimited by the receiver timeout (3.5 characters, 1.75 ms above 19200 baud),
+ * received by DMA and answered from the interrupt through the TX DMA queue.
+ * The port TX buffer must hold the longest response (5 + 2 * registers bytes, 256 for 125 registers).
+ *
+ * @param {port} UART port, already initialized with uart_init() or uartN_init()
+ * @param {address} Slave address (1 to 247)
+ * @param {map} Register map, must stay valid while the slave runs
+ */
+void modbus_initSlave(UARTPort_t *port, uint8_t address, ModbusMap_t *map);
+
+/**
+ * @brief Use an initialized UART port as Modbus RTU master
+ *
+ * @param {port} UART port, already initialized with uart_init() or uartN_init()
+ */
+void modbus_initMaster(UARTPort_t *port);
+
+/**
+ * @brief Stop the engine and release the port framing
+ *
+ */
+void modbus_end(void);
+
+/**
+ * @brief Master: read holding or input registers, waits for the response
+ *
+ * @param {slave} Slave address
+ * @param {function} MODBUS_READ_HOLDING or MODBUS_READ_INPUT
+ * @param {address} First register
+ * @param {count} Number of registers (1 to 125)
+ * @param {dst} Filled with the registers (native byte order)
+ * @param {timeout} Maximum wait in milliseconds
+ * @return {int8_t} MODBUS_OK, MODBUS_TIMEOUT, MODBUS_BUSY or the exception code of the slave
+ */
+int8_t modbus_readRegisters(uint8_t slave, uint8_t function, uint16_t address, uint16_t count, uint16_t *dst, uint32_t timeout);
+
+/**
+ * @brief Master: write holding registers (0x06 for one register, 0x10 for more), waits for the response.
+ * Broadcasts (slave 0) return MODBUS_OK as soon as the request is queued.
+ *
+ * @param {slave} Slave address, 0 for broadcast
+ * @param {address} First register
+ * @param {count} Number of registers (1 to 123)
+ * @param {src} Register values (native byte order)
+ * @param {timeout} Maximum wait in milliseconds
+ * @return {int8_t} MODBUS_OK, MODBUS_TIMEOUT, MODBUS_BUSY or the exception code of the slave
+ */
+int8_t modbus_writeRegisters(uint8_t slave, uint16_t address, uint16_t count, const uint16_t *src, uint32_t timeout);
+
+/**
+ * @brief Frames dropped because of a wrong CRC or a short length
+ *
+ * @return {uint32_t} Error counter
+ */
+uint32_t modbus_errorCount(void);
+
+#endif
@@ -2,7 +2,7 @@
   ******************************************************************************
   * @file    spi.h 
   * @authors Pablo Fuentes, Joseph Peñafiel
-	* @version V1.0.1
+	* @version V1.0.2
   * @date    2019
   * @brief   SPI Library
   ******************************************************************************
@@ -14,12 +14,52 @@
 #include <stdint.h>
 #include "pinmap_hal.h"
 #include "stm32l0xx_ll_spi.h"
+#include "stm32l0xx_ll_dma.h"
 
 #define SPI_DATAMODE0 LL_SPI_POLARITY_LOW | LL_SPI_PHASE_1EDGE
 #define SPI_DATAMODE1 LL_SPI_POLARITY_LOW | LL_SPI_PHASE_2EDGE
 #define SPI_DATAMODE2 LL_SPI_POLARITY_HIGH | LL_SPI_PHASE_1EDGE
 #define SPI_DATAMODE3 LL_SPI_POLARITY_HIGH | LL_SPI_PHASE_2EDGE
 
+// Byte clocked out by spi_transferAsync() when there is no TX buffer
+#ifndef SPI_FILLER_BYTE
+#define SPI_FILLER_BYTE 0xFF
+#endif
+
+// DMA channels of spi_transferAsync() (SPI1: RX 2, TX 3. SPI2: RX 4 or 6, TX 5 or 7, see dma.h)
+#ifndef SPI1_RX_DMA_CHANNEL
+#define SPI1_RX_DMA_CHANNEL LL_DMA_CHANNEL_2
+#endif
+#ifndef SPI1_TX_DMA_CHANNEL
+#define SPI1_TX_DMA_CHANNEL LL_DMA_CHANNEL_3
+#endif
+#ifndef SPI2_RX_DMA_CHANNEL
+#define SPI2_RX_DMA_CHANNEL LL_DMA_CHANNEL_6
+#endif
+#ifndef SPI2_TX_DMA_CHANNEL
+#define SPI2_TX_DMA_CHANNEL LL_DMA_CHANNEL_7
+#endif
+
+// Longest slave transaction, bytes beyond it are lost and answered with the last byte
+#ifndef SPI_SLAVE_BUFFER_SIZE
+#define SPI_SLAVE_BUFFER_SIZE 64
+#endif
+
+typedef void (*spiCallback_t)(void *ctx);
+typedef void (*spiSlaveCallback_t)(const uint8_t *data, uint16_t len);
+
+/**
+ * @brief Device on a shared bus: its whole bus configuration as one CR1 value and its chip select
+ *
+ */
+typedef struct SPIDevice_t
+{
+	SPI_TypeDef *SPIx;		 /*!< Bus */
+	uint32_t cr1;					 /*!< Precomputed CR1: mode, prescaler, width, bit order and SPE */
+	GPIO_TypeDef *cs_port; /*!< Chip select port, NULL when the device has no CS pin */
+	uint16_t cs_mask;			 /*!< Chip select pin mask */
+} SPIDevice_t;
+
 /** 
  ===============================================================================
               ##### Functions #####
@@ -37,6 +77,37 @@ void spi_setPrescaler(SPI_TypeDef *SPIx, uint32_t prescaler);
 uint16_t spi_calculatePrescaler(SPI_TypeDef *SPIx, uint32_t freq_hz);
 void spi_setFreq(SPI_TypeDef *SPIx, uint32_t freq_hz);
 
+// Devices
+
+/**
+ * @brief Describe a device on a bus already initialized with spi_init(). The prescaler is
+ * calculated here once, so switch between devices by spi_begin() without a clock query.
+ * The CS pin is set as output and released (high).
+ *
+ * @param {dev} Descriptor to fill
+ * @param {SPIx} SPI1 or SPI2
+ * @param {freq_hz} Maximum SCK frequency of the device
+ * @param {datamode} SPI_DATAMODE0 ... SPI_DATAMODE3
+ * @param {width} LL_SPI_DATAWIDTH_8BIT or LL_SPI_DATAWIDTH_16BIT
+ * @param {bitorder} LL_SPI_MSB_FIRST or LL_SPI_LSB_FIRST
+ * @param {cs} Chip select pin (active low), NOPIN if handled outside
+ */
+void spi_initDevice(SPIDevice_t *dev, SPI_TypeDef *SPIx, uint32_t freq_hz, uint32_t datamode, uint32_t width, uint32_t bitorder, pin_t cs);
+
+/**
+ * @brief Start a transaction: load the device CR1 (only if the bus has another one) and assert CS
+ *
+ * @param {dev} Device
+ */
+void spi_begin(SPIDevice_t *dev);
+
+/**
+ * @brief End a transaction: wait until the bus is idle and release CS
+ *
+ * @param {dev} Device
+ */
+void spi_end(SPIDevice_t *dev);
+
 // SPI - 8 bits
 uint8_t spi_write8(SPI_TypeDef *SPIx, uint8_t data);
 void spi_writeMultiple8(SPI_TypeDef *SPIx, const uint8_t *pTData, uint8_t *pRData, uint8_t pSize);
@@ -49,11 +120,119 @@ void spi_writeMultiple16(SPI_TypeDef *SPIx, const uint16_t *pTData, uint16_t *pR
 uint16_t spi_read16(SPI_TypeDef *SPIx);
 void spi_readMultiple16(SPI_TypeDef *SPIx, uint16_t *pRData, uint8_t pSize);
 
-// SPI Slave - TODO: implementation
-void spiSlave_init(SPI_TypeDef *SPIx, pin_t sck, pin_t miso, pin_t mosi, pin_t ssel, uint32_t datamode);
-uint8_t spiSlave_available(SPI_TypeDef *SPIx);
+// SPI - Write only
+
+/**
+ * @brief Send 8-bit frames back to back and discard what is received. The next byte is
+ * loaded as soon as TXE is set, without waiting for RXNE, so the bus runs close to the SCK
+ * rate. The overrun this causes is cleared once at the end, after BSY.
+ *
+ * @param {SPIx} SPI to use
+ * @param {pTData} Bytes to send
+ * @param {pSize} Number of bytes
+ */
+void spi_stream8(SPI_TypeDef *SPIx, const uint8_t *pTData, uint32_t pSize);
+
+/**
+ * @brief Send 16-bit frames back to back and discard what is received (see spi_stream8())
+ *
+ * @param {SPIx} SPI to use
+ * @param {pTData} Halfwords to send
+ * @param {pSize} Number of halfwords
+ */
+void spi_stream16(SPI_TypeDef *SPIx, const uint16_t *pTData, uint32_t pSize);
+
+// SPI - DMA
+
+/**
+ * @brief Start a full duplex 8-bit transfer by DMA and return at once. The bytes are clocked
+ * back to back at the SCK rate. The completion is taken from the RX channel, so the callback
+ * runs when the last byte is really on the bus. The channels are taken for the transfer and
+ * released when it ends, a UART owning one of them (see dma.h) makes the transfer fail.
+ *
+ * @param {SPIx} SPI1 or SPI2, initialized with spi_init()
+ * @param {tx} Bytes to send, NULL to read clocking out SPI_FILLER_BYTE
+ * @param {rx} Received bytes, NULL to only send
+ * @param {len} Number of bytes (1 to 65535)
+ * @param {cb} Called from the DMA interrupt when the transfer ends (can be NULL)
+ * @param {ctx} User pointer handed back to the callback
+ * @return {uint8_t} 1 if started, 0 if a transfer is already running on this SPI or one of its
+ * DMA channels belongs to another peripheral
+ */
+uint8_t spi_transferAsync(SPI_TypeDef *SPIx, const uint8_t *tx, uint8_t *rx, uint16_t len, spiCallback_t cb, void *ctx);
+
+/**
+ * @brief Check if an asynchronous transfer is still running
+ *
+ * @param {SPIx} SPI1 or SPI2
+ * @return {uint8_t} 1 while busy
+ */
+uint8_t spi_transferBusy(SPI_TypeDef *SPIx);
+
+// SPI Slave
+
+/**
+ * @brief Run the SPI as a slave with hardware NSS. Each transaction (NSS low to high) is received
+ * by DMA into one of two buffers while the response prepared before it is sent from one of two
+ * others, so the CPU does nothing while the host clocks. The NSS rising edge ends it: call
+ * spiSlave_nssIrq() from the EXTI hook of that line, ex. for PA4:
+ *   IRQ_EXTI4() { spiSlave_nssIrq(); }  (with USE_EXTI4 defined)
+ * Frames are 8 bits, MSB first. Only one SPI can be slave at a time, and its DMA channels are
+ * the ones of spi_transferAsync().
+ *
+ * @param {SPIx} SPI1 or SPI2
+ * @param {sck} SCK pin
+ * @param {miso} MISO pin
+ * @param {mosi} MOSI pin
+ * @param {ssel} NSS pin of the SPI (SPI1: PA4 or PA15, SPI2: PB12)
+ * @param {datamode} SPI_DATAMODE0 ... SPI_DATAMODE3
+ * @return {uint8_t} 1 if running, 0 if the SPI is busy or one of its DMA channels belongs to another peripheral
+ */
+uint8_t spiSlave_init(SPI_TypeDef *SPIx, pin_t sck, pin_t miso, pin_t mosi, pin_t ssel, uint32_t datamode);
+
+/**
+ * @brief Stop the slave and release its DMA channels and EXTI line
+ *
+ * @param {SPIx} SPI1 or SPI2
+ */
+void spiSlave_end(SPI_TypeDef *SPIx);
+
+/**
+ * @brief Call a function when a transaction ends. It runs in the NSS interrupt after the next
+ * transaction is already armed, so it can take its time and prepare the next response.
+ *
+ * @param {cb} Receives the bytes of the transaction, valid until the next one ends
+ */
+void spiSlave_attachComplete(spiSlaveCallback_t cb);
+
+/**
+ * @brief End of transaction handler, to call from the EXTI hook of the NSS pin
+ *
+ */
+void spiSlave_nssIrq(void);
+
+/**
+ * @brief Preload the response of the next transaction, the rest of it is SPI_FILLER_BYTE.
+ * A response is sent again until a new one is set.
+ *
+ * @param {data} Bytes to send
+ * @param {len} Number of bytes (up to SPI_SLAVE_BUFFER_SIZE)
+ */
+void spiSlave_setResponse(const uint8_t *data, uint16_t len);
+
+/**
+ * @brief Bytes of the last transaction not read yet
+ *
+ * @param {SPIx} SPI1 or SPI2
+ * @return {uint16_t} Number of bytes
+ */
+uint16_t spiSlave_available(SPI_TypeDef *SPIx);
+
+// Read the last transaction (SPI_FILLER_BYTE when it is all read), 16 bits are MSB first
 uint8_t spiSlave_read8(SPI_TypeDef *SPIx);
 uint16_t spiSlave_read16(SPI_TypeDef *SPIx);
+
+// Append to the next response, like spiSlave_setResponse() a byte at a time
 void spiSlave_write8(SPI_TypeDef *SPIx, uint8_t val);
 void spiSlave_write16(SPI_TypeDef *SPIx, uint16_t val);
 
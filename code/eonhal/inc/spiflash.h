@@ -0,0 +1,164 @@
+/**
+  ******************************************************************************
+  * @file    spiflash.h
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   Header de SPI NOR Flash Library (W25Q and compatible, 3-byte addresses)
+  ******************************************************************************
+*/
+
+#ifndef __SPIFLASH_H
+#define __SPIFLASH_H
+
+#include <stdint.h>
+#include "spi.h"
+
+/**
+ ===============================================================================
+              ##### Definitions #####
+ ===============================================================================
+ */
+
+#define SPIFLASH_PAGE_SIZE 256U
+#define SPIFLASH_SECTOR_SIZE 4096U
+
+// Pages kept in RAM by spiflash_read() (SPIFLASH_PAGE_SIZE bytes each), at least 1
+#ifndef SPIFLASH_CACHE_PAGES
+#define SPIFLASH_CACHE_PAGES 2
+#endif
+
+// Erase sizes
+#define SPIFLASH_ERASE_4K ((uint8_t)0x20)
+#define SPIFLASH_ERASE_32K ((uint8_t)0x52)
+#define SPIFLASH_ERASE_64K ((uint8_t)0xD8)
+#define SPIFLASH_ERASE_CHIP ((uint8_t)0xC7)
+
+// Results
+#define SPIFLASH_OK 0
+#define SPIFLASH_BUSY (-1)	/*!< Program, erase or DMA read still running, or the SPI DMA channels are taken */
+#define SPIFLASH_ERROR (-2) /*!< No chip, or an address outside of it */
+
+/**
+ ===============================================================================
+              ##### Types #####
+ ===============================================================================
+ */
+
+typedef struct SPIFlash_t
+{
+	SPIDevice_t dev;
+	uint32_t jedec;			/*!< Manufacturer, memory type and capacity bytes of 0x9F */
+	uint32_t size;			/*!< Bytes, 0 if the chip was not recognized */
+	volatile uint8_t writing; /*!< Program or erase started and not seen finished yet */
+	volatile uint8_t reading; /*!< DMA read running */
+	spiCallback_t cb;
+	void *ctx;
+	uint8_t cmd[5];
+	uint8_t cacheNext;
+	uint32_t cacheAddr[SPIFLASH_CACHE_PAGES];
+	uint8_t cache[SPIFLASH_CACHE_PAGES][SPIFLASH_PAGE_SIZE];
+} SPIFlash_t;
+
+/**
+ ===============================================================================
+              ##### Functions #####
+ ===============================================================================
+ */
+
+/**
+ * @brief Wake the chip from power-down and identify it by its JEDEC ID (0x9F).
+ * The bus must be initialized with spi_init(), the flash is used in mode 0.
+ *
+ * @param {fl} Flash descriptor
+ * @param {SPIx} SPI1 or SPI2
+ * @param {freq_hz} SCK frequency
+ * @param {cs} Chip select pin
+ * @return {int8_t} SPIFLASH_OK or SPIFLASH_ERROR if no chip answers
+ */
+int8_t spiflash_init(SPIFlash_t *fl, SPI_TypeDef *SPIx, uint32_t freq_hz, pin_t cs);
+
+/**
+ * @brief Check if a program or erase is still running. Only reads the status register
+ * while one is pending, so it is cheap to call in a loop with __WFI().
+ *
+ * @param {fl} Flash descriptor
+ * @return {uint8_t} 1 while busy
+ */
+uint8_t spiflash_busy(SPIFlash_t *fl);
+
+/**
+ * @brief Sleep (__WFI) until the chip is ready, waking at least every millisecond with SysTick
+ *
+ * @param {fl} Flash descriptor
+ * @param {timeout} Maximum wait in milliseconds (a 4 KB erase takes up to 400 ms, a chip erase minutes)
+ * @return {int8_t} SPIFLASH_OK or SPIFLASH_BUSY on timeout
+ */
+int8_t spiflash_wait(SPIFlash_t *fl, uint32_t timeout);
+
+/**
+ * @brief Read with fast read (0x0B) by DMA, waits for the data. Pieces shorter than a page go through
+ * the page cache, whole pages go straight to dst.
+ *
+ * @param {fl} Flash descriptor
+ * @param {addr} Flash address
+ * @param {dst} Destination
+ * @param {len} Number of bytes
+ * @return {int8_t} SPIFLASH_OK, SPIFLASH_BUSY or SPIFLASH_ERROR
+ */
+int8_t spiflash_read(SPIFlash_t *fl, uint32_t addr, uint8_t *dst, uint32_t len);
+
+/**
+ * @brief Start a fast read (0x0B) by DMA and return at once, bypassing the cache
+ *
+ * @param {fl} Flash descriptor
+ * @param {addr} Flash address
+ * @param {dst} Destination, must stay valid until the callback
+ * @param {len} Number of bytes (1 to 65535)
+ * @param {cb} Called from the DMA interrupt when the data is in dst, CS already released (can be NULL)
+ * @param {ctx} User pointer handed back to the callback
+ * @return {int8_t} SPIFLASH_OK, SPIFLASH_BUSY or SPIFLASH_ERROR
+ */
+int8_t spiflash_readAsync(SPIFlash_t *fl, uint32_t addr, uint8_t *dst, uint16_t len, spiCallback_t cb, void *ctx);
+
+/**
+ * @brief Start a page program (0x02) and return without waiting for it (see spiflash_busy()).
+ * Bits can only go from 1 to 0, the range must be erased first.
+ *
+ * @param {fl} Flash descriptor
+ * @param {addr} Flash address
+ * @param {src} Bytes to write
+ * @param {len} Number of bytes, the range can not cross a page boundary
+ * @return {int8_t} SPIFLASH_OK, SPIFLASH_BUSY or SPIFLASH_ERROR
+ */
+int8_t spiflash_program(SPIFlash_t *fl, uint32_t addr, const uint8_t *src, uint16_t len);
+
+/**
+ * @brief Write any range, page by page, sleeping while each page is programmed
+ *
+ * @param {fl} Flash descriptor
+ * @param {addr} Flash address
+ * @param {src} Bytes to write
+ * @param {len} Number of bytes
+ * @return {int8_t} SPIFLASH_OK, SPIFLASH_BUSY (a page did not finish in 10 ms) or SPIFLASH_ERROR
+ */
+int8_t spiflash_write(SPIFlash_t *fl, uint32_t addr, const uint8_t *src, uint32_t len);
+
+/**
+ * @brief Start an erase and return without waiting for it (see spiflash_busy() and spiflash_wait())
+ *
+ * @param {fl} Flash descriptor
+ * @param {addr} Any address inside the sector or block (ignored for the whole chip)
+ * @param {type} SPIFLASH_ERASE_4K, SPIFLASH_ERASE_32K, SPIFLASH_ERASE_64K or SPIFLASH_ERASE_CHIP
+ * @return {int8_t} SPIFLASH_OK, SPIFLASH_BUSY or SPIFLASH_ERROR
+ */
+int8_t spiflash_erase(SPIFlash_t *fl, uint32_t addr, uint8_t type);
+
+/**
+ * @brief Drop every cached page, needed if another master writes the chip
+ *
+ * @param {fl} Flash descriptor
+ */
+void spiflash_invalidate(SPIFlash_t *fl);
+
+#endif
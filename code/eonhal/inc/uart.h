@@ -0,0 +1,445 @@
+/**
+  ******************************************************************************
+  * @file    uart.h
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   Header de UART Driver (USART1, USART2 and LPUART1)
+  ******************************************************************************
+*/
+
+#ifndef __UART_H
+#define __UART_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "eon_string.h"
+#include "pinmap_hal.h"
+#include "uart_helper.h"
+
+/**
+ ===============================================================================
+              ##### Definitions #####
+ ===============================================================================
+ */
+
+// Wake-up sources for uart_enableStopMode()
+#define UART_WAKEUP_STARTBIT LL_USART_WAKEUP_ON_STARTBIT /*!< Any start bit */
+#define UART_WAKEUP_ADDRESS LL_USART_WAKEUP_ON_ADDRESS	 /*!< A byte matching the 7-bit node address */
+
+// Frames completed and not read yet that uart_readFrame() can keep apart, must be a power of two
+#ifndef UART_FRAME_QUEUE
+#define UART_FRAME_QUEUE 4
+#endif
+
+// uart_enableFraming() terminator argument to frame only by gaps
+#define UART_NO_TERMINATOR (-1)
+
+/**
+ ===============================================================================
+              ##### Types #####
+ ===============================================================================
+ */
+
+/**
+ * @brief End of the received frames, filled from the interrupt on character match or receiver timeout
+ *
+ */
+typedef struct UARTFrame_t
+{
+	uint16_t end[UART_FRAME_QUEUE]; /*!< RX head (free running) after the last byte of each frame */
+	volatile uint8_t head, tail;		/*!< Frame queue indexes (free running) */
+	uint16_t last;									/*!< Head at the last recorded end, to skip empty frames */
+	uint8_t gap;										/*!< Frame on gaps too */
+	void (*rxFrame)(void);					/*!< Called from interrupt when a frame is complete */
+} UARTFrame_t;
+
+/**
+ * @brief UART port handle. One static instance per peripheral (uart1_port, uart2_port, lpuart1_port),
+ * every uart_*() function takes it as first argument.
+ *
+ */
+typedef struct UARTPort_t
+{
+	USART_TypeDef *USARTx;		 /*!< Register base, USARTx or LPUART1 */
+	IRQn_Type irqn;						 /*!< Peripheral interrupt line */
+	volatile uint32_t *clk_reg; /*!< RCC enable register, &RCC->APB1ENR or &RCC->APB2ENR */
+	uint32_t clk_bit;					 /*!< Enable bit in clk_reg */
+	uint8_t lpuart;						 /*!< 1 for LPUART1 (different baud generator and pin AF) */
+	uint32_t dma_req;					 /*!< LL_DMA_REQUEST_x of the peripheral */
+	uint32_t tx_dma_ch;				 /*!< Channel draining the TX queue */
+	uint32_t rx_dma_ch;				 /*!< Channel used by uart_enableRxDMA() */
+	uint32_t clk_sel;					 /*!< Kernel clock field in RCC->CCIPR */
+	UARTRingBuff_t rx;				 /*!< RX ring buffer */
+	UARTTxQueue_t tx;					 /*!< TX queue */
+	uint32_t baudrate;				 /*!< Set by uart_init() */
+	uint32_t brr;							 /*!< PCLK baud divider saved while in Stop mode reception */
+	UARTFrame_t frame;				 /*!< Framed reception state */
+} UARTPort_t;
+
+/**
+ ===============================================================================
+              ##### Ports #####
+ ===============================================================================
+ */
+
+#if (defined(USART1) || defined(UART1))
+extern UARTPort_t uart1_port;
+#endif
+#if (defined(USART2) || defined(UART2))
+extern UARTPort_t uart2_port;
+#endif
+#if defined(LPUART1)
+extern UARTPort_t lpuart1_port;
+#endif
+
+/**
+ ===============================================================================
+              ##### Functions #####
+ ===============================================================================
+ */
+
+/**
+ * @brief Initiatize the UART, 8N1 without flow control
+ *
+ * @param {port} &uart1_port, &uart2_port or &lpuart1_port
+ * @param {baudrate}  Usually 9600
+ * @param {tx}  TX pin
+ * @param {rx}  RX pin
+ * @return {uint8_t} 1 if TX runs on DMA, 0 if its channel belongs to another peripheral
+ * and the TX queue is drained from the TXE interrupt instead
+ */
+uint8_t uart_init(UARTPort_t *port, uint32_t baudrate, pin_t tx, pin_t rx);
+
+/**
+ * @brief Initialize for an RS-485 transceiver. The driver enable pin is driven by the UART itself (DEM),
+ * asserted before the start bit of the first byte and released after the stop bit of the last one.
+ *
+ * @param {port} UART port
+ * @param {baudrate} Baudrate
+ * @param {tx} TX pin
+ * @param {rx} RX pin
+ * @param {de} RTS/DE pin of the port (active high)
+ * @param {assertTime} Delay from DE to the start bit, 0 to 31 sample times (1/8 bit on USART1/USART2)
+ * @param {deassertTime} Delay from the last stop bit to DE release, 0 to 31 sample times
+ * @return {uint8_t} 1 if TX runs on DMA, 0 if it runs from the TXE interrupt (see uart_init())
+ */
+uint8_t uart_initRS485(UARTPort_t *port, uint32_t baudrate, pin_t tx, pin_t rx, pin_t de, uint8_t assertTime, uint8_t deassertTime);
+
+/**
+ * @brief Initialize with RTS/CTS hardware flow control
+ *
+ * @param {port} UART port
+ * @param {baudrate} Baudrate
+ * @param {tx} TX pin
+ * @param {rx} RX pin
+ * @param {rts} RTS pin, NOPIN for CTS only
+ * @param {cts} CTS pin, NOPIN for RTS only
+ * @return {uint8_t} 1 if TX runs on DMA, 0 if it runs from the TXE interrupt (see uart_init())
+ */
+uint8_t uart_initFlowControl(UARTPort_t *port, uint32_t baudrate, pin_t tx, pin_t rx, pin_t rts, pin_t cts);
+
+/**
+ * @brief Initialize in single-wire half-duplex mode (HDSEL) on the TX pin, open drain with pull-up.
+ * The bytes sent are also received, discard them if the protocol needs it.
+ *
+ * @param {port} UART port
+ * @param {baudrate} Baudrate
+ * @param {txrx} TX pin of the port, used in both directions
+ * @return {uint8_t} 1 if TX runs on DMA, 0 if it runs from the TXE interrupt (see uart_init())
+ */
+uint8_t uart_initHalfDuplex(UARTPort_t *port, uint32_t baudrate, pin_t txrx);
+
+/**
+ * @brief Turn off the UART
+ *
+ * @param {port} UART port
+ */
+void uart_off(UARTPort_t *port);
+
+/**
+ * @brief Keep receiving while the core is in Stop mode (system_stopUntilInterrupt() and friends).
+ * The UART is moved to the HSI16 kernel clock with UESM set and wakes the MCU on the selected event.
+ * UCESM keeps HSI16 running during Stop (about 100 uA more), so the byte that woke it up and the
+ * ones after it are received at any baudrate and end up in the RX buffer.
+ * Pending TX data is flushed first, transmission does not progress during Stop.
+ *
+ * @param {port} UART port
+ * @param {wakeup} UART_WAKEUP_STARTBIT or UART_WAKEUP_ADDRESS
+ * @param {address} 7-bit node address for UART_WAKEUP_ADDRESS, ignored otherwise
+ */
+void uart_enableStopMode(UARTPort_t *port, uint32_t wakeup, uint8_t address);
+
+/**
+ * @brief Go back to the PCLK kernel clock, the UART stops working in Stop mode
+ *
+ * @param {port} UART port
+ */
+void uart_disableStopMode(UARTPort_t *port);
+
+/**
+ * @brief Interrupt service of a port, called by its IRQ handler
+ *
+ * @param {port} UART port
+ */
+void uart_irq(UARTPort_t *port);
+
+/**
+ * @brief Write a character. It is queued and sent by DMA, only waits if the TX queue is full
+ *
+ * @param {port} UART port
+ * @param {c} Character to be written
+ */
+void uart_write(UARTPort_t *port, unsigned char c);
+
+/**
+ * @brief Queue a buffer to be sent by DMA without waiting
+ *
+ * @param {port} UART port
+ * @param {buf} Data to be sent
+ * @param {len} Number of bytes
+ * @return {uint16_t} Bytes queued, less than len if the TX queue is full
+ */
+uint16_t uart_writeAsync(UARTPort_t *port, const uint8_t *buf, uint16_t len);
+
+/**
+ * @brief Wait until all queued bytes have been transmitted
+ *
+ * @param {port} UART port
+ */
+void uart_flush(UARTPort_t *port);
+
+/**
+ * @brief Attach a function called (from interrupt) when the TX queue has been fully transmitted
+ *
+ * @param {port} UART port
+ * @param {cb} Callback function, NULL to disable
+ */
+void uart_attachTxComplete(UARTPort_t *port, void (*cb)(void));
+
+/**
+ * @brief Receive through a circular DMA buffer instead of one interrupt per byte
+ *
+ * @param {port} UART port
+ * @return {uint8_t} 1 if enabled, 0 if the RX channel belongs to another peripheral (still one interrupt per byte)
+ */
+uint8_t uart_enableRxDMA(UARTPort_t *port);
+
+/**
+ * @brief Go back to interrupt per byte reception
+ *
+ * @param {port} UART port
+ */
+void uart_disableRxDMA(UARTPort_t *port);
+
+/**
+ * @brief Attach a function called (from interrupt) when the RX line goes idle after a frame (DMA mode)
+ *
+ * @param {port} UART port
+ * @param {cb} Callback function, NULL to disable
+ */
+void uart_attachRxIdle(UARTPort_t *port, void (*cb)(void));
+
+/**
+ * @brief Verify is there any character to be read
+ *
+ * @param {port} UART port
+ * @return {uint16_t} Total bytes ready to be read
+ */
+uint16_t uart_available(UARTPort_t *port);
+
+/**
+ * @brief Read a character
+ *
+ * @param {port} UART port
+ * @return {int} Character read (-1) if fails
+ */
+int uart_read(UARTPort_t *port);
+
+/**
+ * @brief Peek function
+ *
+ * @param {port} UART port
+ * @return {int} Character (-1) if fails
+ */
+int uart_peek(UARTPort_t *port);
+
+/**
+ * @brief Read up to n bytes in one go
+ *
+ * @param {port} UART port
+ * @param {dst} Destination buffer
+ * @param {n} Maximum number of bytes
+ * @return {uint16_t} Bytes copied
+ */
+uint16_t uart_readBytes(UARTPort_t *port, uint8_t *dst, uint16_t n);
+
+/**
+ * @brief Get the received bytes that are contiguous in the RX buffer, without consuming them
+ *
+ * @param {port} UART port
+ * @param {span} Set to the first unread byte
+ * @return {uint16_t} Number of contiguous bytes at span
+ */
+uint16_t uart_peekSpan(UARTPort_t *port, const uint8_t **span);
+
+/**
+ * @brief Discard received bytes
+ *
+ * @param {port} UART port
+ * @param {n} Number of bytes
+ */
+void uart_skip(UARTPort_t *port, uint16_t n);
+
+/**
+ * @brief Bytes lost because the RX buffer was full or the receiver overran
+ *
+ * @param {port} UART port
+ * @return {uint32_t} Overflow counter since init
+ */
+uint32_t uart_overflowCount(UARTPort_t *port);
+
+/**
+ * @brief Read until a terminator: returns at once if nothing was received, else waits for the
+ * terminator without timeout and stores up to 255 characters plus a null.
+ * @deprecated Assumes a 256 byte buffer (a shorter one overflows) and waits forever if the
+ * terminator is lost. Use uart_readUntilTimeout().
+ *
+ * @param {port} UART port
+ * @param {buffer} Buffer to be filled, must hold 256 bytes
+ * @param {terminator} Terminator character
+ */
+void uart_readUntil(UARTPort_t *port, char buffer[], uint8_t terminator);
+
+/**
+ * @brief Read until a terminator, sleeping between bytes. The terminator is consumed but not copied
+ * and the buffer is always null terminated.
+ *
+ * @param {port} UART port
+ * @param {buffer} Buffer to be filled
+ * @param {len} Buffer size, at most len - 1 characters are read
+ * @param {terminator} Terminator character
+ * @param {timeout} Maximum wait in milliseconds
+ * @return {uint16_t} Characters read, without the terminator
+ */
+uint16_t uart_readUntilTimeout(UARTPort_t *port, char buffer[], uint16_t len, uint8_t terminator, uint32_t timeout);
+
+/**
+ * @brief Let the hardware split the RX stream into frames: a frame ends at the terminator character
+ * (character match interrupt) and/or after a silence of gap bit times (receiver timeout interrupt).
+ * Together with uart_enableRxDMA() the CPU only gets one interrupt per frame.
+ * LPUART1 has no receiver timeout, any gap there ends the frame at the IDLE line (one character).
+ * Character match uses the same register as UART_WAKEUP_ADDRESS.
+ *
+ * @param {port} UART port
+ * @param {terminator} Last character of a frame ('\n' for text lines), UART_NO_TERMINATOR to frame on gaps only
+ * @param {gap} Silence that ends a frame in bit times (1 character = 10 bits), 0 to disable
+ */
+void uart_enableFraming(UARTPort_t *port, int16_t terminator, uint32_t gap);
+
+/**
+ * @brief Disable the character match and receiver timeout, pending frames are dropped (not the data)
+ *
+ * @param {port} UART port
+ */
+void uart_disableFraming(UARTPort_t *port);
+
+/**
+ * @brief Attach a function called (from interrupt) each time a frame is complete
+ *
+ * @param {port} UART port
+ * @param {cb} Callback function, NULL to disable
+ */
+void uart_attachRxFrame(UARTPort_t *port, void (*cb)(void));
+
+/**
+ * @brief Number of complete frames waiting to be read
+ *
+ * @param {port} UART port
+ * @return {uint8_t} Frames
+ */
+uint8_t uart_framesAvailable(UARTPort_t *port);
+
+/**
+ * @brief Read the next complete frame, sleeping until there is one.
+ * A frame longer than len is truncated, the rest of it is discarded.
+ *
+ * @param {port} UART port
+ * @param {dst} Destination buffer
+ * @param {len} Destination size
+ * @param {timeout} Maximum wait in milliseconds
+ * @return {uint16_t} Bytes copied, 0 on timeout
+ */
+uint16_t uart_readFrame(UARTPort_t *port, uint8_t *dst, uint16_t len, uint32_t timeout);
+
+/**
+ * @brief Print text
+ *
+ * @param {port} UART port
+ * @param {s} Message to print
+ */
+void uart_print(UARTPort_t *port, const char *s);
+
+/**
+ * @brief Print text and append a new line at the end
+ *
+ * @param {port} UART port
+ * @param {s} Message to print
+ */
+void uart_println(UARTPort_t *port, const char *s);
+
+/**
+ * @brief Print an integer specifiying the desired base
+ *
+ * @param {port} UART port
+ * @param {n} Integer
+ * @param {base} Base
+ */
+void uart_printIntBase(UARTPort_t *port, int64_t n, uint8_t base);
+
+/**
+ * @brief Print an integer specifiying the desired base and append a new line at the end
+ *
+ * @param {port} UART port
+ * @param {n} Integer
+ * @param {base} Base
+ */
+void uart_printlnIntBase(UARTPort_t *port, int64_t n, uint8_t base);
+
+/**
+ * @brief Print a float
+ *
+ * @param {port} UART port
+ * @param {n} Float number
+ * @param {decimals} Number of digits you want for decimal part
+ */
+void uart_printFloat(UARTPort_t *port, float n, uint8_t decimals);
+
+/**
+ * @brief Print a float and append a new line at the end
+ *
+ * @param {port} UART port
+ * @param {n} Float number
+ * @param {decimals} Number of digits you want for decimal part
+ */
+void uart_printlnFloat(UARTPort_t *port, float n, uint8_t decimals);
+
+/**
+ * @brief Print a number integer or float in a light way. Float numbers should be written as integer (x100) and put true in second argument.
+ *
+ * @param {port} UART port
+ * @param {n} Number
+ * @param {isfloat} True for float print and false for integer print
+ */
+void uart_printNum(UARTPort_t *port, int64_t n, uint8_t isfloat);
+
+/**
+ * @brief Same as uart_printNum() and append a new line at the end
+ *
+ * @param {port} UART port
+ * @param {n} Number
+ * @param {isfloat} True for float print and false for integer print
+ */
+void uart_printlnNum(UARTPort_t *port, int64_t n, uint8_t isfloat);
+
+#endif
@@ -15,87 +15,380 @@
 #include <stdbool.h>
 #include "eon_string.h"
 #include "pinmap_hal.h"
+#include "uart.h"
 
 #if (defined(USART1) || defined(UART1))
 
+// Buffer sizes, must be powers of two
+#ifndef UART1_RX_BUFFER_SIZE
+#define UART1_RX_BUFFER_SIZE 64
+#endif
+#ifndef UART1_TX_BUFFER_SIZE
+#define UART1_TX_BUFFER_SIZE 128
+#endif
+
+// DMA channel that drains the TX queue (TX 2 or 4, RX 3 or 5, see dma.h). 2 and 3 leave 4 and 5
+// to USART2, but SPI1 has no other channels: spi_transferAsync() is refused while USART1 holds them
+#ifndef UART1_TX_DMA_CHANNEL
+#define UART1_TX_DMA_CHANNEL LL_DMA_CHANNEL_2
+#endif
+
+// DMA channel that fills the RX buffer when uart1_enableRxDMA() is used
+#ifndef UART1_RX_DMA_CHANNEL
+#define UART1_RX_DMA_CHANNEL LL_DMA_CHANNEL_3
+#endif
+
 /**
  * @brief Initiatize the UART
  * 
  * @param {baudrate}  Usually 9600
  * @param {tx}  TX1_Pin 
  * @param {rx}  RX1_Pin
+ * @return {uint8_t} 1 if TX runs on DMA, 0 if its channel is taken (TX from the TXE interrupt)
+ */
+__STATIC_INLINE uint8_t uart1_init(uint32_t baudrate, pin_t tx, pin_t rx)
+{
+	return uart_init(&uart1_port, baudrate, tx, rx);
+}
+
+/**
+ * @brief Initialize for an RS-485 transceiver with the driver enable handled in hardware
+ * 
+ * @param {baudrate} Baudrate
+ * @param {tx} TX pin
+ * @param {rx} RX pin
+ * @param {de} RTS/DE pin (active high)
+ * @param {assertTime} DE to start bit delay, 0 to 31 sample times
+ * @param {deassertTime} Stop bit to DE release delay, 0 to 31 sample times
+ * @return {uint8_t} 1 if TX runs on DMA, 0 if its channel is taken (TX from the TXE interrupt)
  */
-void uart1_init(uint32_t baudrate, pin_t tx, pin_t rx);
+__STATIC_INLINE uint8_t uart1_initRS485(uint32_t baudrate, pin_t tx, pin_t rx, pin_t de, uint8_t assertTime, uint8_t deassertTime)
+{
+	return uart_initRS485(&uart1_port, baudrate, tx, rx, de, assertTime, deassertTime);
+}
+
+/**
+ * @brief Initialize with RTS/CTS hardware flow control
+ * 
+ * @param {baudrate} Baudrate
+ * @param {tx} TX pin
+ * @param {rx} RX pin
+ * @param {rts} RTS pin, NOPIN for CTS only
+ * @param {cts} CTS pin, NOPIN for RTS only
+ * @return {uint8_t} 1 if TX runs on DMA, 0 if its channel is taken (TX from the TXE interrupt)
+ */
+__STATIC_INLINE uint8_t uart1_initFlowControl(uint32_t baudrate, pin_t tx, pin_t rx, pin_t rts, pin_t cts)
+{
+	return uart_initFlowControl(&uart1_port, baudrate, tx, rx, rts, cts);
+}
+
+/**
+ * @brief Initialize in single-wire half-duplex mode on the TX pin
+ * 
+ * @param {baudrate} Baudrate
+ * @param {txrx} TX pin, used in both directions
+ * @return {uint8_t} 1 if TX runs on DMA, 0 if its channel is taken (TX from the TXE interrupt)
+ */
+__STATIC_INLINE uint8_t uart1_initHalfDuplex(uint32_t baudrate, pin_t txrx)
+{
+	return uart_initHalfDuplex(&uart1_port, baudrate, txrx);
+}
 
 /**
  * @brief Turn off the UART
  * 
  */
-void uart1_off(void);
+__STATIC_INLINE void uart1_off(void)
+{
+	uart_off(&uart1_port);
+}
 
 /**
- * @brief Write a character
+ * @brief Write a character. It is queued and sent by DMA, only waits if the TX queue is full
  * 
  * @param {c} Character to be written
  */
-void uart1_write(unsigned char c);
+__STATIC_INLINE void uart1_write(unsigned char c)
+{
+	uart_write(&uart1_port, c);
+}
+
+/**
+ * @brief Queue a buffer to be sent by DMA without waiting
+ * 
+ * @param {buf} Data to be sent 
+ * @param {len} Number of bytes
+ * @return {uint16_t} Bytes queued, less than len if the TX queue is full
+ */
+__STATIC_INLINE uint16_t uart1_writeAsync(const uint8_t *buf, uint16_t len)
+{
+	return uart_writeAsync(&uart1_port, buf, len);
+}
+
+/**
+ * @brief Wait until all queued bytes have been transmitted
+ * 
+ */
+__STATIC_INLINE void uart1_flush(void)
+{
+	uart_flush(&uart1_port);
+}
+
+/**
+ * @brief Attach a function called (from interrupt) when the TX queue has been fully transmitted
+ * 
+ * @param {cb} Callback function, NULL to disable
+ */
+__STATIC_INLINE void uart1_attachTxComplete(void (*cb)(void))
+{
+	uart_attachTxComplete(&uart1_port, cb);
+}
+
+/**
+ * @brief Receive through a circular DMA buffer instead of one interrupt per byte.
+ * The only interrupt left is the IDLE line one, at the end of each burst.
+ * uart1_available(), uart1_read() and friends work the same in both modes.
+ * 
+ * @return {uint8_t} 1 if enabled, 0 if UART1_RX_DMA_CHANNEL belongs to another peripheral
+ */
+__STATIC_INLINE uint8_t uart1_enableRxDMA(void)
+{
+	return uart_enableRxDMA(&uart1_port);
+}
+
+/**
+ * @brief Go back to interrupt per byte reception
+ * 
+ */
+__STATIC_INLINE void uart1_disableRxDMA(void)
+{
+	uart_disableRxDMA(&uart1_port);
+}
+
+/**
+ * @brief Attach a function called (from interrupt) when the RX line goes idle after a frame (DMA mode)
+ * 
+ * @param {cb} Callback function, NULL to disable
+ */
+__STATIC_INLINE void uart1_attachRxIdle(void (*cb)(void))
+{
+	uart_attachRxIdle(&uart1_port, cb);
+}
+
+/**
+ * @brief Keep receiving in Stop mode and wake the MCU up on the selected event.
+ * Uses HSI16 as kernel clock, the byte that wakes the MCU is kept in the RX buffer.
+ * 
+ * @param {wakeup} UART_WAKEUP_STARTBIT or UART_WAKEUP_ADDRESS
+ * @param {address} 7-bit node address for UART_WAKEUP_ADDRESS
+ */
+__STATIC_INLINE void uart1_enableStopMode(uint32_t wakeup, uint8_t address)
+{
+	uart_enableStopMode(&uart1_port, wakeup, address);
+}
+
+/**
+ * @brief Disable reception in Stop mode
+ * 
+ */
+__STATIC_INLINE void uart1_disableStopMode(void)
+{
+	uart_disableStopMode(&uart1_port);
+}
 
 /**
  * @brief Verify is there any character to be read
  * 
- * @return {uint8_t} Total bytes ready to be read
+ * @return {uint16_t} Total bytes ready to be read
  */
-uint8_t uart1_available(void);
+__STATIC_INLINE uint16_t uart1_available(void)
+{
+	return uart_available(&uart1_port);
+}
 
 /**
  * @brief Read a character
  * 
  * @return {int} Character read (-1) if fails
  */
-int uart1_read(void);
+__STATIC_INLINE int uart1_read(void)
+{
+	return uart_read(&uart1_port);
+}
 
 /**
  * @brief Peek function
  * 
  * @return {int} Character (-1) if fails
  */
-int uart1_peek(void);
+__STATIC_INLINE int uart1_peek(void)
+{
+	return uart_peek(&uart1_port);
+}
+
+/**
+ * @brief Read up to n bytes in one go
+ * 
+ * @param {dst} Destination buffer
+ * @param {n} Maximum number of bytes
+ * @return {uint16_t} Bytes copied
+ */
+__STATIC_INLINE uint16_t uart1_readBytes(uint8_t *dst, uint16_t n)
+{
+	return uart_readBytes(&uart1_port, dst, n);
+}
+
+/**
+ * @brief Get the received bytes that are contiguous in the RX buffer, without consuming them.
+ * Call uart1_skip() once they have been processed.
+ * 
+ * @param {span} Set to the first unread byte
+ * @return {uint16_t} Number of contiguous bytes at span
+ */
+__STATIC_INLINE uint16_t uart1_peekSpan(const uint8_t **span)
+{
+	return uart_peekSpan(&uart1_port, span);
+}
+
+/**
+ * @brief Discard received bytes
+ * 
+ * @param {n} Number of bytes
+ */
+__STATIC_INLINE void uart1_skip(uint16_t n)
+{
+	uart_skip(&uart1_port, n);
+}
+
+/**
+ * @brief Bytes lost because the RX buffer was full
+ * 
+ * @return {uint32_t} Overflow counter since init
+ */
+__STATIC_INLINE uint32_t uart1_overflowCount(void)
+{
+	return uart_overflowCount(&uart1_port);
+}
 
 /**
  * @brief Read until a terminator
+ * @deprecated Assumes a 256 byte buffer and waits forever, use uart1_readUntilTimeout()
+ * 
+ * @param {buffer} Buffer to be filled, must hold 256 bytes
+ * @param {terminator} Terminator character
+ */
+__STATIC_INLINE void uart1_readUntil(char buffer[], uint8_t terminator)
+{
+	uart_readUntil(&uart1_port, buffer, terminator);
+}
+
+/**
+ * @brief Read until a terminator. The terminator is consumed but not copied, the buffer is null terminated.
  * 
  * @param {buffer} Buffer to be filled
+ * @param {len} Buffer size
  * @param {terminator} Terminator character
+ * @param {timeout} Maximum wait in milliseconds
+ * @return {uint16_t} Characters read
+ */
+__STATIC_INLINE uint16_t uart1_readUntilTimeout(char buffer[], uint16_t len, uint8_t terminator, uint32_t timeout)
+{
+	return uart_readUntilTimeout(&uart1_port, buffer, len, terminator, timeout);
+}
+
+/**
+ * @brief End frames in hardware on a terminator character and/or on a gap in the data.
+ * See uart_enableFraming().
+ * 
+ * @param {terminator} Last character of a frame, UART_NO_TERMINATOR to frame on gaps only
+ * @param {gap} Silence that ends a frame in bit times, 0 to disable
+ */
+__STATIC_INLINE void uart1_enableFraming(int16_t terminator, uint32_t gap)
+{
+	uart_enableFraming(&uart1_port, terminator, gap);
+}
+
+/**
+ * @brief Disable framed reception
+ * 
+ */
+__STATIC_INLINE void uart1_disableFraming(void)
+{
+	uart_disableFraming(&uart1_port);
+}
+
+/**
+ * @brief Attach a function called (from interrupt) each time a frame is complete
+ * 
+ * @param {cb} Callback function, NULL to disable
+ */
+__STATIC_INLINE void uart1_attachRxFrame(void (*cb)(void))
+{
+	uart_attachRxFrame(&uart1_port, cb);
+}
+
+/**
+ * @brief Number of complete frames waiting to be read
+ * 
+ * @return {uint8_t} Frames
+ */
+__STATIC_INLINE uint8_t uart1_framesAvailable(void)
+{
+	return uart_framesAvailable(&uart1_port);
+}
+
+/**
+ * @brief Read the next complete frame, a frame longer than len is truncated
+ * 
+ * @param {dst} Destination buffer
+ * @param {len} Destination size
+ * @param {timeout} Maximum wait in milliseconds
+ * @return {uint16_t} Bytes copied, 0 on timeout
  */
-void uart1_readUntil(char buffer[], uint8_t terminator);
+__STATIC_INLINE uint16_t uart1_readFrame(uint8_t *dst, uint16_t len, uint32_t timeout)
+{
+	return uart_readFrame(&uart1_port, dst, len, timeout);
+}
 
 /**
  * @brief Print text
  * 
  * @param {s} Message to print 
  */
-void uart1_print(const char *s);
+__STATIC_INLINE void uart1_print(const char *s)
+{
+	uart_print(&uart1_port, s);
+}
 
 /**
  * @brief Print an array of characters
  * 
  * @param {s} Array of characters 
  */
-void uart1_printArray(char s[]);
+__STATIC_INLINE void uart1_printArray(char s[])
+{
+	uart_print(&uart1_port, s);
+}
 
 /**
  * @brief Print text and append a new line at the end
  * 
  * @param {s} Message to print 
  */
-void uart1_println(const char *s);
+__STATIC_INLINE void uart1_println(const char *s)
+{
+	uart_println(&uart1_port, s);
+}
 
 /**
  * @brief Print an integer
  * 
  * @param {n} Integer 
  */
-void uart1_printInt(uint32_t n);
+__STATIC_INLINE void uart1_printInt(uint32_t n)
+{
+	uart_printIntBase(&uart1_port, n, 10);
+}
 
 /**
  * @brief Print an integer specifiying the desired base
@@ -103,7 +396,10 @@ void uart1_printInt(uint32_t n);
  * @param {n} Integer 
  * @param {base} Base
  */
-void uart1_printIntBase(uint32_t n, uint8_t base);
+__STATIC_INLINE void uart1_printIntBase(uint32_t n, uint8_t base)
+{
+	uart_printIntBase(&uart1_port, n, base);
+}
 
 /**
  * @brief Print a float
@@ -111,14 +407,20 @@ void uart1_printIntBase(uint32_t n, uint8_t base);
  * @param {n} Float number
  * @param {decimals} Number of digits you want for decimal part
  */
-void uart1_printFloat(double n, uint8_t decimals);
+__STATIC_INLINE void uart1_printFloat(float n, uint8_t decimals)
+{
+	uart_printFloat(&uart1_port, n, decimals);
+}
 
 /**
  * @brief Print an integer and append a new line at the end
  * 
  * @param {n} Integer 
  */
-void uart1_printlnInt(uint32_t n);
+__STATIC_INLINE void uart1_printlnInt(uint32_t n)
+{
+	uart_printlnIntBase(&uart1_port, n, 10);
+}
 
 /**
  * @brief Print an integer specifiying the desired base and append a new line at the end
@@ -126,7 +428,10 @@ void uart1_printlnInt(uint32_t n);
  * @param {n} Integer 
  * @param {base} Base
  */
-void uart1_printlnIntBase(uint32_t n, uint8_t base);
+__STATIC_INLINE void uart1_printlnIntBase(uint32_t n, uint8_t base)
+{
+	uart_printlnIntBase(&uart1_port, n, base);
+}
 
 /**
  * @brief Print a float and append a new line at the end
@@ -134,7 +439,10 @@ void uart1_printlnIntBase(uint32_t n, uint8_t base);
  * @param {n} Float number
  * @param {decimals} Number of digits you want for decimal part
  */
-void uart1_printlnFloat(double n, uint8_t decimals);
+__STATIC_INLINE void uart1_printlnFloat(float n, uint8_t decimals)
+{
+	uart_printlnFloat(&uart1_port, n, decimals);
+}
 
 #endif
 
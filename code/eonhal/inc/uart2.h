@@ -15,80 +15,369 @@
 #include <stdbool.h>
 #include "eon_string.h"
 #include "pinmap_hal.h"
+#include "uart.h"
 
 #if (defined(USART2) || defined(UART2))
 
+// Buffer sizes, must be powers of two
+#ifndef UART2_RX_BUFFER_SIZE
+#define UART2_RX_BUFFER_SIZE 64
+#endif
+#ifndef UART2_TX_BUFFER_SIZE
+#define UART2_TX_BUFFER_SIZE 128
+#endif
+
+// DMA channel that drains the TX queue (TX 4 or 7, RX 5 or 6, see dma.h)
+#ifndef UART2_TX_DMA_CHANNEL
+#define UART2_TX_DMA_CHANNEL LL_DMA_CHANNEL_4
+#endif
+
+// DMA channel that fills the RX buffer when uart2_enableRxDMA() is used
+#ifndef UART2_RX_DMA_CHANNEL
+#define UART2_RX_DMA_CHANNEL LL_DMA_CHANNEL_5
+#endif
+
 /**
  * @brief Initiatize the UART
  * 
  * @param {baudrate}  Usually 9600
  * @param {tx}  TX2_Pin 
  * @param {rx}  RX2_Pin
+ * @return {uint8_t} 1 if TX runs on DMA, 0 if its channel is taken (TX from the TXE interrupt)
+ */
+__STATIC_INLINE uint8_t uart2_init(uint32_t baudrate, pin_t tx, pin_t rx)
+{
+	return uart_init(&uart2_port, baudrate, tx, rx);
+}
+
+/**
+ * @brief Initialize for an RS-485 transceiver with the driver enable handled in hardware
+ * 
+ * @param {baudrate} Baudrate
+ * @param {tx} TX pin
+ * @param {rx} RX pin
+ * @param {de} RTS/DE pin (active high)
+ * @param {assertTime} DE to start bit delay, 0 to 31 sample times
+ * @param {deassertTime} Stop bit to DE release delay, 0 to 31 sample times
+ * @return {uint8_t} 1 if TX runs on DMA, 0 if its channel is taken (TX from the TXE interrupt)
  */
-void uart2_init(uint32_t baudrate, pin_t tx, pin_t rx);
+__STATIC_INLINE uint8_t uart2_initRS485(uint32_t baudrate, pin_t tx, pin_t rx, pin_t de, uint8_t assertTime, uint8_t deassertTime)
+{
+	return uart_initRS485(&uart2_port, baudrate, tx, rx, de, assertTime, deassertTime);
+}
+
+/**
+ * @brief Initialize with RTS/CTS hardware flow control
+ * 
+ * @param {baudrate} Baudrate
+ * @param {tx} TX pin
+ * @param {rx} RX pin
+ * @param {rts} RTS pin, NOPIN for CTS only
+ * @param {cts} CTS pin, NOPIN for RTS only
+ * @return {uint8_t} 1 if TX runs on DMA, 0 if its channel is taken (TX from the TXE interrupt)
+ */
+__STATIC_INLINE uint8_t uart2_initFlowControl(uint32_t baudrate, pin_t tx, pin_t rx, pin_t rts, pin_t cts)
+{
+	return uart_initFlowControl(&uart2_port, baudrate, tx, rx, rts, cts);
+}
+
+/**
+ * @brief Initialize in single-wire half-duplex mode on the TX pin
+ * 
+ * @param {baudrate} Baudrate
+ * @param {txrx} TX pin, used in both directions
+ * @return {uint8_t} 1 if TX runs on DMA, 0 if its channel is taken (TX from the TXE interrupt)
+ */
+__STATIC_INLINE uint8_t uart2_initHalfDuplex(uint32_t baudrate, pin_t txrx)
+{
+	return uart_initHalfDuplex(&uart2_port, baudrate, txrx);
+}
 
 /**
  * @brief Turn off the UART
  * 
  */
-void uart2_off(void);
+__STATIC_INLINE void uart2_off(void)
+{
+	uart_off(&uart2_port);
+}
 
 /**
- * @brief Write a character
+ * @brief Write a character. It is queued and sent by DMA, only waits if the TX queue is full
  * 
  * @param {c} Character to be written
  */
-void uart2_write(unsigned char c);
+__STATIC_INLINE void uart2_write(unsigned char c)
+{
+	uart_write(&uart2_port, c);
+}
+
+/**
+ * @brief Queue a buffer to be sent by DMA without waiting
+ * 
+ * @param {buf} Data to be sent 
+ * @param {len} Number of bytes
+ * @return {uint16_t} Bytes queued, less than len if the TX queue is full
+ */
+__STATIC_INLINE uint16_t uart2_writeAsync(const uint8_t *buf, uint16_t len)
+{
+	return uart_writeAsync(&uart2_port, buf, len);
+}
+
+/**
+ * @brief Wait until all queued bytes have been transmitted
+ * 
+ */
+__STATIC_INLINE void uart2_flush(void)
+{
+	uart_flush(&uart2_port);
+}
+
+/**
+ * @brief Attach a function called (from interrupt) when the TX queue has been fully transmitted
+ * 
+ * @param {cb} Callback function, NULL to disable
+ */
+__STATIC_INLINE void uart2_attachTxComplete(void (*cb)(void))
+{
+	uart_attachTxComplete(&uart2_port, cb);
+}
+
+/**
+ * @brief Receive through a circular DMA buffer instead of one interrupt per byte.
+ * The only interrupt left is the IDLE line one, at the end of each burst.
+ * uart2_available(), uart2_read() and friends work the same in both modes.
+ * 
+ * @return {uint8_t} 1 if enabled, 0 if UART2_RX_DMA_CHANNEL belongs to another peripheral
+ */
+__STATIC_INLINE uint8_t uart2_enableRxDMA(void)
+{
+	return uart_enableRxDMA(&uart2_port);
+}
+
+/**
+ * @brief Go back to interrupt per byte reception
+ * 
+ */
+__STATIC_INLINE void uart2_disableRxDMA(void)
+{
+	uart_disableRxDMA(&uart2_port);
+}
+
+/**
+ * @brief Attach a function called (from interrupt) when the RX line goes idle after a frame (DMA mode)
+ * 
+ * @param {cb} Callback function, NULL to disable
+ */
+__STATIC_INLINE void uart2_attachRxIdle(void (*cb)(void))
+{
+	uart_attachRxIdle(&uart2_port, cb);
+}
+
+/**
+ * @brief Keep receiving in Stop mode and wake the MCU up on the selected event.
+ * Uses HSI16 as kernel clock, the byte that wakes the MCU is kept in the RX buffer.
+ * 
+ * @param {wakeup} UART_WAKEUP_STARTBIT or UART_WAKEUP_ADDRESS
+ * @param {address} 7-bit node address for UART_WAKEUP_ADDRESS
+ */
+__STATIC_INLINE void uart2_enableStopMode(uint32_t wakeup, uint8_t address)
+{
+	uart_enableStopMode(&uart2_port, wakeup, address);
+}
+
+/**
+ * @brief Disable reception in Stop mode
+ * 
+ */
+__STATIC_INLINE void uart2_disableStopMode(void)
+{
+	uart_disableStopMode(&uart2_port);
+}
 
 /**
  * @brief Verify is there any character to be read
  * 
- * @return {uint8_t} Total bytes ready to be read
+ * @return {uint16_t} Total bytes ready to be read
  */
-uint8_t uart2_available(void);
+__STATIC_INLINE uint16_t uart2_available(void)
+{
+	return uart_available(&uart2_port);
+}
 
 /**
  * @brief Read a character
  * 
  * @return {int} Character read (-1) if fails
  */
-int uart2_read(void);
+__STATIC_INLINE int uart2_read(void)
+{
+	return uart_read(&uart2_port);
+}
 
 /**
  * @brief Peek function
  * 
  * @return {int} Character (-1) if fails
  */
-int uart2_peek(void);
+__STATIC_INLINE int uart2_peek(void)
+{
+	return uart_peek(&uart2_port);
+}
+
+/**
+ * @brief Read up to n bytes in one go
+ * 
+ * @param {dst} Destination buffer
+ * @param {n} Maximum number of bytes
+ * @return {uint16_t} Bytes copied
+ */
+__STATIC_INLINE uint16_t uart2_readBytes(uint8_t *dst, uint16_t n)
+{
+	return uart_readBytes(&uart2_port, dst, n);
+}
+
+/**
+ * @brief Get the received bytes that are contiguous in the RX buffer, without consuming them.
+ * Call uart2_skip() once they have been processed.
+ * 
+ * @param {span} Set to the first unread byte
+ * @return {uint16_t} Number of contiguous bytes at span
+ */
+__STATIC_INLINE uint16_t uart2_peekSpan(const uint8_t **span)
+{
+	return uart_peekSpan(&uart2_port, span);
+}
+
+/**
+ * @brief Discard received bytes
+ * 
+ * @param {n} Number of bytes
+ */
+__STATIC_INLINE void uart2_skip(uint16_t n)
+{
+	uart_skip(&uart2_port, n);
+}
+
+/**
+ * @brief Bytes lost because the RX buffer was full
+ * 
+ * @return {uint32_t} Overflow counter since init
+ */
+__STATIC_INLINE uint32_t uart2_overflowCount(void)
+{
+	return uart_overflowCount(&uart2_port);
+}
 
 /**
  * @brief Read until a terminator
+ * @deprecated Assumes a 256 byte buffer and waits forever, use uart2_readUntilTimeout()
+ * 
+ * @param {buffer} Buffer to be filled, must hold 256 bytes
+ * @param {terminator} Terminator character
+ */
+__STATIC_INLINE void uart2_readUntil(char buffer[], uint8_t terminator)
+{
+	uart_readUntil(&uart2_port, buffer, terminator);
+}
+
+/**
+ * @brief Read until a terminator. The terminator is consumed but not copied, the buffer is null terminated.
  * 
  * @param {buffer} Buffer to be filled
+ * @param {len} Buffer size
  * @param {terminator} Terminator character
+ * @param {timeout} Maximum wait in milliseconds
+ * @return {uint16_t} Characters read
+ */
+__STATIC_INLINE uint16_t uart2_readUntilTimeout(char buffer[], uint16_t len, uint8_t terminator, uint32_t timeout)
+{
+	return uart_readUntilTimeout(&uart2_port, buffer, len, terminator, timeout);
+}
+
+/**
+ * @brief End frames in hardware on a terminator character and/or on a gap in the data.
+ * See uart_enableFraming().
+ * 
+ * @param {terminator} Last character of a frame, UART_NO_TERMINATOR to frame on gaps only
+ * @param {gap} Silence that ends a frame in bit times, 0 to disable
+ */
+__STATIC_INLINE void uart2_enableFraming(int16_t terminator, uint32_t gap)
+{
+	uart_enableFraming(&uart2_port, terminator, gap);
+}
+
+/**
+ * @brief Disable framed reception
+ * 
+ */
+__STATIC_INLINE void uart2_disableFraming(void)
+{
+	uart_disableFraming(&uart2_port);
+}
+
+/**
+ * @brief Attach a function called (from interrupt) each time a frame is complete
+ * 
+ * @param {cb} Callback function, NULL to disable
+ */
+__STATIC_INLINE void uart2_attachRxFrame(void (*cb)(void))
+{
+	uart_attachRxFrame(&uart2_port, cb);
+}
+
+/**
+ * @brief Number of complete frames waiting to be read
+ * 
+ * @return {uint8_t} Frames
+ */
+__STATIC_INLINE uint8_t uart2_framesAvailable(void)
+{
+	return uart_framesAvailable(&uart2_port);
+}
+
+/**
+ * @brief Read the next complete frame, a frame longer than len is truncated
+ * 
+ * @param {dst} Destination buffer
+ * @param {len} Destination size
+ * @param {timeout} Maximum wait in milliseconds
+ * @return {uint16_t} Bytes copied, 0 on timeout
  */
-void uart2_readUntil(char buffer[], uint8_t terminator);
+__STATIC_INLINE uint16_t uart2_readFrame(uint8_t *dst, uint16_t len, uint32_t timeout)
+{
+	return uart_readFrame(&uart2_port, dst, len, timeout);
+}
 
 /**
  * @brief Print text
  * 
  * @param {s} Message to print 
  */
-void uart2_print(const char *s);
+__STATIC_INLINE void uart2_print(const char *s)
+{
+	uart_print(&uart2_port, s);
+}
 
 /**
  * @brief Print an array of characters
  * 
  * @param {s} Array of characters 
  */
-void uart2_printArray(char s[]);
+__STATIC_INLINE void uart2_printArray(char s[])
+{
+	uart_print(&uart2_port, s);
+}
 
 /**
  * @brief Print text and append a new line at the end
  * 
  * @param {s} Message to print 
  */
-void uart2_println(const char *s);
+__STATIC_INLINE void uart2_println(const char *s)
+{
+	uart_println(&uart2_port, s);
+}
 
 /**
  * @brief Macro for print an integer in base 10
@@ -103,7 +392,10 @@ void uart2_println(const char *s);
  * @param {n} Integer 
  * @param {base} Base
  */
-void uart2_printIntBase(int64_t n, uint8_t base);
+__STATIC_INLINE void uart2_printIntBase(int64_t n, uint8_t base)
+{
+	uart_printIntBase(&uart2_port, n, base);
+}
 
 /**
  * @brief Macro for print a float
@@ -125,7 +417,10 @@ void uart2_printIntBase(int64_t n, uint8_t base);
  * @param {n} Integer 
  * @param {base} Base
  */
-void uart2_printlnIntBase(int64_t n, uint8_t base);
+__STATIC_INLINE void uart2_printlnIntBase(int64_t n, uint8_t base)
+{
+	uart_printlnIntBase(&uart2_port, n, base);
+}
 
 /**
  * @brief Print a float and append a new line at the end
@@ -140,7 +435,10 @@ void uart2_printlnIntBase(int64_t n, uint8_t base);
  * @param {n} Number 
  * @param {isfloat} True for float print and false for integer print
  */
-void uart2_printNum(int64_t n, uint8_t isfloat);
+__STATIC_INLINE void uart2_printNum(int64_t n, uint8_t isfloat)
+{
+	uart_printNum(&uart2_port, n, isfloat);
+}
 
 /**
  * @brief Print a number integer or float in a light way. Float numbers should be written as integer and put true in second argument. And append a new line.
@@ -148,7 +446,10 @@ void uart2_printNum(int64_t n, uint8_t isfloat);
  * @param {n} Number 
  * @param {isfloat} True for float print and false for integer print
  */
-void uart2_printlnNum(int64_t n, uint8_t isfloat);
+__STATIC_INLINE void uart2_printlnNum(int64_t n, uint8_t isfloat)
+{
+	uart_printlnNum(&uart2_port, n, isfloat);
+}
 
 #endif
 
@@ -12,10 +12,12 @@
 #define __UART_HELPER_H_
 
 #include <stdint.h>
+#include <string.h>
 #include "gpio.h"
 #include "stm32l0xx_ll_usart.h"
 #include "stm32l0xx_ll_lpuart.h"
 #include "stm32l0xx_ll_bus.h"
+#include "dma.h"
 
 #define UART_IT_PE ((uint32_t)0x0028)   /*!< UART parity error interruption                 */
 #define UART_IT_TXE ((uint32_t)0x0727)  /*!< UART transmit data register empty interruption */
@@ -30,23 +32,378 @@
 #define UART_GET_IT(__UARTX__, __IT__) ((__UARTX__)->ISR & ((uint32_t)1U << ((__IT__) >> 0x08U)))
 #define UART_GET_FLAG(__UARTX__, __FLAG__) (((__UARTX__)->ISR & (__FLAG__)) == (__FLAG__))
 
-#define UART_BUFFER_SIZE 64
+#define UART_IS_POW2(__N__) (((__N__) != 0) && ((((__N__)-1) & (__N__)) == 0))
 
+/**
+ ===============================================================================
+              ##### RX Ring Buffer #####
+ ===============================================================================
+ */
+
+// Size is a power of two (mask + 1) and head/tail run freely, wrapping with the mask on access
 typedef struct
 {
-  uint8_t buffer[UART_BUFFER_SIZE];
-  volatile uint8_t head;
-  volatile uint8_t tail;
+  uint8_t *buffer;
+  uint16_t mask;
+  volatile uint16_t head;
+  volatile uint16_t tail;
+  volatile uint32_t overflow; // bytes dropped because the buffer was full
+  uint32_t dma_ch;            // 0 when filled byte by byte from RXNE, else the circular DMA channel writing it
+  void (*rxIdle)(void);
 } UARTRingBuff_t;
 
 __STATIC_INLINE void uart_rb_insert(UARTRingBuff_t *rb, uint8_t b)
 {
-  uint8_t i = (uint8_t)(rb->head + 1) % UART_BUFFER_SIZE;
-  if (i != rb->tail)
+  uint16_t head = rb->head;
+  if ((uint16_t)(head - rb->tail) > rb->mask)
+  {
+    rb->overflow++;
+    return;
+  }
+  rb->buffer[head & rb->mask] = b;
+  rb->head = (uint16_t)(head + 1);
+}
+
+/* In DMA mode the write index is wherever the DMA currently is */
+__STATIC_INLINE void uart_rb_sync(UARTRingBuff_t *rb)
+{
+  uint16_t pos, used;
+  uint32_t primask;
+
+  if (rb->dma_ch == 0)
+    return;
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  pos = (uint16_t)((rb->mask + 1U - LL_DMA_GetDataLength(DMA1, rb->dma_ch)) & rb->mask);
+  rb->head = (uint16_t)(rb->head + ((pos - rb->head) & rb->mask));
+  used = (uint16_t)(rb->head - rb->tail);
+  // The DMA lapped the reader: the oldest bytes are gone, keep one slot as guard
+  if (used > rb->mask)
   {
-    rb->buffer[rb->head] = b;
-    rb->head = i;
+    rb->overflow += (uint16_t)(used - rb->mask);
+    rb->tail = (uint16_t)(rb->head - rb->mask);
   }
+  __set_PRIMASK(primask);
+}
+
+__STATIC_INLINE uint16_t uart_rb_available(UARTRingBuff_t *rb)
+{
+  uart_rb_sync(rb);
+  return (uint16_t)(rb->head - rb->tail);
+}
+
+/* Longest contiguous run of unread bytes starting at tail, without consuming them */
+__STATIC_INLINE uint16_t uart_rb_peekSpan(UARTRingBuff_t *rb, const uint8_t **span)
+{
+  uint16_t used = uart_rb_available(rb);
+  uint16_t start = rb->tail & rb->mask;
+  uint16_t room = (uint16_t)(rb->mask + 1U - start);
+
+  *span = &rb->buffer[start];
+  return (used < room) ? used : room;
+}
+
+__STATIC_INLINE void uart_rb_skip(UARTRingBuff_t *rb, uint16_t n)
+{
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  if (n > (uint16_t)(rb->head - rb->tail))
+    n = (uint16_t)(rb->head - rb->tail);
+  rb->tail = (uint16_t)(rb->tail + n);
+  __set_PRIMASK(primask);
+}
+
+__STATIC_INLINE int uart_rb_read(UARTRingBuff_t *rb)
+{
+  uint8_t c;
+  if (uart_rb_available(rb) == 0)
+    return -1;
+  c = rb->buffer[rb->tail & rb->mask];
+  uart_rb_skip(rb, 1);
+  return c;
+}
+
+__STATIC_INLINE int uart_rb_peek(UARTRingBuff_t *rb)
+{
+  if (uart_rb_available(rb) == 0)
+    return -1;
+  return rb->buffer[rb->tail & rb->mask];
+}
+
+/* Copy up to n bytes out in at most two contiguous chunks */
+__STATIC_INLINE uint16_t uart_rb_readBytes(UARTRingBuff_t *rb, uint8_t *dst, uint16_t n)
+{
+  const uint8_t *span;
+  uint16_t len;
+  uint16_t total = 0;
+
+  while (total < n && (len = uart_rb_peekSpan(rb, &span)) != 0)
+  {
+    if (len > (uint16_t)(n - total))
+      len = (uint16_t)(n - total);
+    memcpy(&dst[total], span, len);
+    uart_rb_skip(rb, len);
+    total = (uint16_t)(total + len);
+  }
+  return total;
+}
+
+/**
+ ===============================================================================
+              ##### RX Circular DMA #####
+ ===============================================================================
+ */
+
+/* Half and full transfer keep the free running head in step with the DMA laps */
+__STATIC_INLINE void uart_rx_dmaEvent(void *ctx, uint8_t events)
+{
+  UNUSED(events);
+  uart_rb_sync((UARTRingBuff_t *)ctx);
+}
+
+/* Let a DMA channel fill the ring in circular mode, one IDLE interrupt per burst.
+   Returns 0, still on RXNE, if the channel belongs to another peripheral. */
+__STATIC_INLINE uint8_t uart_rx_dmaStart(UARTRingBuff_t *rb, USART_TypeDef *USARTx, uint32_t dma_ch, uint32_t dma_req)
+{
+  if (!dma_attach(dma_ch, dma_req, uart_rx_dmaEvent, rb))
+    return 0;
+  LL_USART_DisableIT_RXNE(USARTx);
+
+  // Overrun can only happen if the DMA is starved, don't let ORE stall reception
+  LL_USART_Disable(USARTx);
+  LL_USART_DisableOverrunDetect(USARTx);
+  LL_USART_Enable(USARTx);
+
+  LL_DMA_ConfigTransfer(DMA1, dma_ch,
+                        LL_DMA_DIRECTION_PERIPH_TO_MEMORY | LL_DMA_PRIORITY_MEDIUM | LL_DMA_MODE_CIRCULAR |
+                            LL_DMA_PERIPH_NOINCREMENT | LL_DMA_MEMORY_INCREMENT |
+                            LL_DMA_PDATAALIGN_BYTE | LL_DMA_MDATAALIGN_BYTE);
+  LL_DMA_SetPeriphAddress(DMA1, dma_ch, LL_USART_DMA_GetRegAddr(USARTx, LL_USART_DMA_REG_DATA_RECEIVE));
+  LL_DMA_SetMemoryAddress(DMA1, dma_ch, (uint32_t)rb->buffer);
+  LL_DMA_SetDataLength(DMA1, dma_ch, rb->mask + 1U);
+  LL_DMA_EnableIT_HT(DMA1, dma_ch);
+  LL_DMA_EnableIT_TC(DMA1, dma_ch);
+
+  rb->head = 0;
+  rb->tail = 0;
+  rb->dma_ch = dma_ch;
+
+  LL_DMA_EnableChannel(DMA1, dma_ch);
+  LL_USART_EnableDMAReq_RX(USARTx);
+  LL_USART_ClearFlag_IDLE(USARTx);
+  LL_USART_EnableIT_IDLE(USARTx);
+  return 1;
+}
+
+/* Back to one RXNE interrupt per byte */
+__STATIC_INLINE void uart_rx_dmaStop(UARTRingBuff_t *rb, USART_TypeDef *USARTx)
+{
+  if (rb->dma_ch == 0)
+    return;
+
+  LL_USART_DisableIT_IDLE(USARTx);
+  LL_USART_DisableDMAReq_RX(USARTx);
+  uart_rb_sync(rb);
+  dma_detach(rb->dma_ch);
+  rb->dma_ch = 0;
+  LL_USART_EnableIT_RXNE(USARTx);
+}
+
+/* To be called from the USART interrupt: the line went idle, a frame has ended */
+__STATIC_INLINE void uart_rx_idleIrq(UARTRingBuff_t *rb, USART_TypeDef *USARTx)
+{
+  if (LL_USART_IsEnabledIT_IDLE(USARTx) && LL_USART_IsActiveFlag_IDLE(USARTx))
+  {
+    LL_USART_ClearFlag_IDLE(USARTx);
+    uart_rb_sync(rb);
+    if (rb->rxIdle != 0)
+      rb->rxIdle();
+  }
+}
+
+/**
+ ===============================================================================
+              ##### TX Queue (drained by DMA) #####
+ ===============================================================================
+ */
+
+typedef struct
+{
+  uint8_t *buffer;
+  uint16_t mask;
+  volatile uint16_t head;     // next free slot, moved by the writer
+  volatile uint16_t tail;     // first byte not yet sent, moved when DMA finishes
+  volatile uint16_t inflight; // bytes owned by the DMA channel right now
+  USART_TypeDef *USARTx;
+  uint32_t dma_ch;            // 0 when drained byte by byte from TXE
+  void (*txDone)(void);
+} UARTTxQueue_t;
+
+#define UART_TXQ_DMA_TCIF(__CH__) (DMA_ISR_TCIF1 << (((__CH__)-1U) * 4U))
+
+/* Start the DMA on the contiguous block after tail, if idle. Call with IRQs masked. */
+__STATIC_INLINE void uart_txq_start(UARTTxQueue_t *q)
+{
+  uint16_t used = (uint16_t)(q->head - q->tail);
+  uint16_t start = q->tail & q->mask;
+  uint16_t len = (uint16_t)(q->mask + 1U - start);
+
+  if (q->inflight != 0 || used == 0)
+    return;
+  if (q->dma_ch == 0)
+  {
+    LL_USART_EnableIT_TXE(q->USARTx);
+    return;
+  }
+
+  if (used < len)
+    len = used;
+  q->inflight = len;
+
+  LL_DMA_DisableChannel(DMA1, q->dma_ch);
+  LL_DMA_SetMemoryAddress(DMA1, q->dma_ch, (uint32_t)&q->buffer[start]);
+  LL_DMA_SetDataLength(DMA1, q->dma_ch, len);
+  LL_USART_ClearFlag_TC(q->USARTx);
+  LL_DMA_EnableChannel(DMA1, q->dma_ch);
+}
+
+/* DMA block moved to the USART: release it and chain the next one */
+__STATIC_INLINE void uart_txq_dmaEvent(void *ctx, uint8_t events)
+{
+  UARTTxQueue_t *q = (UARTTxQueue_t *)ctx;
+
+  if ((events & (DMA_EVT_TC | DMA_EVT_TE)) == 0)
+    return;
+
+  q->tail = (uint16_t)(q->tail + q->inflight);
+  q->inflight = 0;
+  uart_txq_start(q);
+
+  // Queue drained: report completion once the last stop bit has left the pin
+  if (q->inflight == 0 && q->txDone != 0)
+    LL_USART_EnableIT_TC(q->USARTx);
+}
+
+/* Without a DMA channel: one byte per TXE */
+__STATIC_INLINE void uart_txq_txe(UARTTxQueue_t *q)
+{
+  LL_USART_TransmitData8(q->USARTx, q->buffer[q->tail & q->mask]);
+  q->tail = (uint16_t)(q->tail + 1U);
+  if (q->tail == q->head)
+  {
+    LL_USART_DisableIT_TXE(q->USARTx);
+    if (q->txDone != 0)
+      LL_USART_EnableIT_TC(q->USARTx);
+  }
+}
+
+/* To be called from the USART interrupt */
+__STATIC_INLINE void uart_txq_irq(UARTTxQueue_t *q)
+{
+  if (LL_USART_IsEnabledIT_TXE(q->USARTx) && LL_USART_IsActiveFlag_TXE(q->USARTx))
+    uart_txq_txe(q);
+  if (LL_USART_IsEnabledIT_TC(q->USARTx) && LL_USART_IsActiveFlag_TC(q->USARTx))
+  {
+    LL_USART_DisableIT_TC(q->USARTx);
+    if (q->txDone != 0)
+      q->txDone();
+  }
+}
+
+/* Run a pending DMA completion (or TXE) by hand, so writers spinning with IRQs masked still progress */
+__STATIC_INLINE void uart_txq_service(UARTTxQueue_t *q)
+{
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  if (q->dma_ch == 0)
+  {
+    if (LL_USART_IsEnabledIT_TXE(q->USARTx) && LL_USART_IsActiveFlag_TXE(q->USARTx))
+      uart_txq_txe(q);
+  }
+  else if ((DMA1->ISR & UART_TXQ_DMA_TCIF(q->dma_ch)) != 0)
+  {
+    DMA1->IFCR = UART_TXQ_DMA_TCIF(q->dma_ch);
+    uart_txq_dmaEvent(q, DMA_EVT_TC);
+  }
+  __set_PRIMASK(primask);
+}
+
+/* Returns 0 if the channel belongs to another peripheral, the queue is then drained from TXE */
+__STATIC_INLINE uint8_t uart_txq_init(UARTTxQueue_t *q, USART_TypeDef *USARTx, uint32_t dma_ch, uint32_t dma_req)
+{
+  q->head = 0;
+  q->tail = 0;
+  q->inflight = 0;
+  q->USARTx = USARTx;
+  q->dma_ch = 0;
+
+  if (!dma_attach(dma_ch, dma_req, uart_txq_dmaEvent, q))
+  {
+    LL_USART_DisableDMAReq_TX(USARTx);
+    return 0;
+  }
+  q->dma_ch = dma_ch;
+  LL_DMA_ConfigTransfer(DMA1, dma_ch,
+                        LL_DMA_DIRECTION_MEMORY_TO_PERIPH | LL_DMA_PRIORITY_LOW | LL_DMA_MODE_NORMAL |
+                            LL_DMA_PERIPH_NOINCREMENT | LL_DMA_MEMORY_INCREMENT |
+                            LL_DMA_PDATAALIGN_BYTE | LL_DMA_MDATAALIGN_BYTE);
+  LL_DMA_SetPeriphAddress(DMA1, dma_ch, LL_USART_DMA_GetRegAddr(USARTx, LL_USART_DMA_REG_DATA_TRANSMIT));
+  LL_DMA_EnableIT_TC(DMA1, dma_ch);
+  LL_DMA_EnableIT_TE(DMA1, dma_ch);
+  LL_USART_EnableDMAReq_TX(USARTx);
+  return 1;
+}
+
+/* Copy as much as fits, never blocks. Returns the number of bytes queued. */
+__STATIC_INLINE uint16_t uart_txq_push(UARTTxQueue_t *q, const uint8_t *buf, uint16_t len)
+{
+  uint16_t head = q->head;
+  uint16_t room = (uint16_t)(q->mask + 1U - (uint16_t)(head - q->tail));
+  uint16_t start = head & q->mask;
+  uint16_t first;
+  uint32_t primask;
+
+  if (len > room)
+    len = room;
+  first = (uint16_t)(q->mask + 1U - start);
+  if (first > len)
+    first = len;
+  memcpy(&q->buffer[start], buf, first);
+  memcpy(q->buffer, &buf[first], len - first);
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  q->head = (uint16_t)(head + len);
+  uart_txq_start(q);
+  __set_PRIMASK(primask);
+
+  return len;
+}
+
+/* Queue everything, waiting for room when the ring is full */
+__STATIC_INLINE void uart_txq_pushAll(UARTTxQueue_t *q, const uint8_t *buf, uint16_t len)
+{
+  uint16_t n;
+  while (len > 0)
+  {
+    n = uart_txq_push(q, buf, len);
+    buf += n;
+    len -= n;
+    if (len > 0)
+      uart_txq_service(q);
+  }
+}
+
+/* Wait until the queue is empty and the last frame is on the line */
+__STATIC_INLINE void uart_txq_flush(UARTTxQueue_t *q)
+{
+  if (q->USARTx == 0)
+    return;
+  while (q->head != q->tail || q->inflight != 0)
+    uart_txq_service(q);
+  while (LL_USART_IsActiveFlag_TC(q->USARTx) == 0)
+    ;
 }
 
-#endif
\ No newline at end of file
+#endif
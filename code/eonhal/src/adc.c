@@ -14,10 +14,12 @@
  ===============================================================================
  */
 
+#include <stddef.h>
 #include "adc.h"
 #include "stm32l0xx_ll_bus.h"
 #include "stm32l0xx_ll_dma.h"
 #include "pinmap_impl.h"
+#include "dma.h"
 
 /** 
  ===============================================================================
@@ -25,9 +27,6 @@
  ===============================================================================
  */
 
-// Number of samples taken from an ADC Channel, to get an average value
-// Note: It isn't the number of channels
-#define ADC_BUFFERSIZE 18
 #define ADC_SAMPLING_TIME LL_ADC_SAMPLINGTIME_1CYCLE_5
 
 /** 
@@ -36,11 +35,20 @@
  ===============================================================================
  */
 
-static uint16_t ADC_ConvertedValues[ADC_BUFFERSIZE];
 static uint8_t adcInitFirstTime = true;
 static uint32_t adcChannelConfigured = ADC_CHANNEL_NONE;
 static uint32_t _adc_sample_time = ADC_SAMPLING_TIME;
 
+// Oversampling, CFGR2 value and largest result (0xFFF * ratio >> shift)
+static uint32_t adc_ovsConfig;
+static uint16_t adc_fullScale;
+
+// Scan
+static volatile uint8_t adc_scanning;
+static uint8_t adc_scanMode;
+static adcCallback_t adc_scanCb;
+static void *adc_scanCtx;
+
 /** 
  ===============================================================================
               ##### Functions #####
@@ -84,7 +92,7 @@ static void ADC_Init(void)
 
 	LL_ADC_SetSamplingTimeCommonChannels(ADC1, _adc_sample_time);
 
-	LL_ADC_SetOverSamplingScope(ADC1, LL_ADC_OVS_DISABLE);
+	ADC1->CFGR2 = (ADC1->CFGR2 & ~(ADC_CFGR2_OVSE | ADC_CFGR2_OVSR | ADC_CFGR2_OVSS | ADC_CFGR2_TOVS)) | adc_ovsConfig;
 
 	LL_ADC_SetCommonFrequencyMode(__LL_ADC_COMMON_INSTANCE(ADC1), LL_ADC_CLOCK_FREQ_MODE_HIGH);
 
@@ -97,18 +105,80 @@ static void ADC_Init(void)
 	LL_ADC_Enable(ADC1);
 }
 
-uint16_t adc_readU(pin_t pin)
+static void adc_begin(void)
 {
-	uint8_t i = 0;
-	uint32_t ADC_SummatedValue = 0;
-	uint16_t ADC_AveragedValue = 0;
-	STM32_Pin_Info *PIN_MAP = HAL_Pin_Map();
-
 	if (adcInitFirstTime == true)
 	{
+		if (adc_fullScale == 0)
+			adc_setOversampling(ADC_OVS_RATIO, ADC_OVS_SHIFT);
 		ADC_Init();
 		adcInitFirstTime = false;
 	}
+}
+
+/* Back to the single conversions of adc_readU(), the DMA channel is released */
+static void adc_scanEnd(void)
+{
+	if (LL_ADC_REG_IsConversionOngoing(ADC1))
+	{
+		LL_ADC_REG_StopConversion(ADC1);
+		while (LL_ADC_REG_IsStopConversionOngoing(ADC1))
+			;
+	}
+	dma_detach(ADC_DMA_CHANNEL);
+	LL_ADC_REG_SetDMATransfer(ADC1, LL_ADC_REG_DMA_TRANSFER_NONE);
+	LL_ADC_REG_SetContinuousMode(ADC1, LL_ADC_REG_CONV_SINGLE);
+	LL_ADC_ClearFlag_OVR(ADC1);
+	adc_scanning = 0;
+}
+
+static void adc_dmaEvent(void *ctx, uint8_t events)
+{
+	(void)ctx;
+
+	if (events & DMA_EVT_TE)
+	{
+		adc_scanEnd();
+		return;
+	}
+	if ((events & DMA_EVT_TC) == 0)
+		return;
+	if (adc_scanMode == ADC_SCAN_SINGLE)
+		adc_scanEnd();
+	if (adc_scanCb != NULL)
+		adc_scanCb(adc_scanCtx);
+}
+
+uint8_t adc_setOversampling(uint16_t ratio, uint8_t shift)
+{
+	uint8_t bits = 0;
+
+	if (adc_scanning || ratio == 0 || (ratio & (ratio - 1)) != 0 || ratio > 256)
+		return 0;
+	while ((1U << bits) < ratio)
+		bits++;
+	if (shift > bits || bits - shift > 4)
+		return 0;
+
+	// Ratio code is log2(ratio) - 1, all the conversions of a ratio run from one trigger
+	if (ratio == 1)
+		adc_ovsConfig = LL_ADC_OVS_DISABLE;
+	else
+		adc_ovsConfig = LL_ADC_OVS_GRP_REGULAR_CONTINUED | LL_ADC_OVS_REG_CONT |
+										((uint32_t)(bits - 1) << ADC_CFGR2_OVSR_Pos) | ((uint32_t)shift << ADC_CFGR2_OVSS_Pos);
+	adc_fullScale = (uint16_t)((0xFFFUL * ratio) >> shift);
+
+	// CFGR2 can be written with the ADC enabled while no conversion is ongoing
+	if (adcInitFirstTime == false)
+		ADC1->CFGR2 = (ADC1->CFGR2 & ~(ADC_CFGR2_OVSE | ADC_CFGR2_OVSR | ADC_CFGR2_OVSS | ADC_CFGR2_TOVS)) | adc_ovsConfig;
+	return (uint8_t)(12 + bits - shift);
+}
+
+uint16_t adc_readU(pin_t pin)
+{
+	STM32_Pin_Info *PIN_MAP = HAL_Pin_Map();
+
+	adc_begin();
 
 	if (adcChannelConfigured != PIN_MAP[pin].adcCh)
 	{
@@ -116,35 +186,89 @@ uint16_t adc_readU(pin_t pin)
 		adcChannelConfigured = PIN_MAP[pin].adcCh;
 	}
 
-	for (i = 0; i < ADC_BUFFERSIZE; i++)
+	// One trigger, the oversampler does the averaging and raises EOC once with the result
+	LL_ADC_ClearFlag_EOC(ADC1);
+	LL_ADC_ClearFlag_EOS(ADC1);
+	LL_ADC_ClearFlag_OVR(ADC1);
+	LL_ADC_REG_StartConversion(ADC1);
+	while ((LL_ADC_ReadReg(ADC1, ISR) & LL_ADC_FLAG_EOS) == RESET)
+		;
+	return (uint16_t)ADC1->DR;
+}
+
+float adc_readN(pin_t pin)
+{
+	uint16_t value = adc_readU(pin);
+	return (float)value / (float)adc_fullScale;
+}
+
+uint8_t adc_scanStart(const pin_t *pins, uint8_t count, uint16_t *values, uint8_t mode, adcCallback_t cb, void *ctx)
+{
+	STM32_Pin_Info *PIN_MAP = HAL_Pin_Map();
+	uint32_t channels = 0;
+	uint8_t i, conversions = 0;
+
+	if (adc_scanning)
+		return 0;
+	for (i = 0; i < count; i++)
+	{
+		if (PIN_MAP[pins[i]].adcCh != ADC_CHANNEL_NONE)
+			channels |= PIN_MAP[pins[i]].adcCh & ADC_CHSELR_CHSEL;
+	}
+	for (i = 0; i < 32; i++)
+		conversions += (uint8_t)((channels >> i) & 1U);
+	if (conversions == 0)
+		return 0;
+
+	if (!dma_attach(ADC_DMA_CHANNEL, LL_DMA_REQUEST_0, adc_dmaEvent, NULL))
+		return 0;
+	adc_begin();
+	adc_scanning = 1;
+	adc_scanMode = mode;
+	adc_scanCb = cb;
+	adc_scanCtx = ctx;
+
+	// The whole sequence in one pass, adc_readU() selects its channel again afterwards
+	LL_ADC_REG_SetSequencerChannels(ADC1, channels);
+	adcChannelConfigured = ADC_CHANNEL_NONE;
+	if (mode == ADC_SCAN_CONTINUOUS)
 	{
-		ADC_ConvertedValues[i] = 0;
-		LL_ADC_ClearFlag_EOC(ADC1);
-		LL_ADC_ClearFlag_EOS(ADC1);
-		LL_ADC_ClearFlag_OVR(ADC1);
-		LL_ADC_REG_StartConversion(ADC1);
-		while ((LL_ADC_ReadReg(ADC1, ISR) & LL_ADC_FLAG_EOS) == RESET)
-			;
-		if ((LL_ADC_ReadReg(ADC1, ISR) & LL_ADC_FLAG_EOC) == LL_ADC_FLAG_EOC)
-		{
-			if ((LL_ADC_ReadReg(ADC1, CR) & ADC_CR_ADSTART) == RESET)
-			{
-				LL_ADC_DisableIT_EOC(ADC1);
-				LL_ADC_DisableIT_EOS(ADC1);
-			}
-		}
-		ADC_ConvertedValues[i] = ADC1->DR;
-		ADC_SummatedValue += ADC_ConvertedValues[i];
+		LL_ADC_REG_SetContinuousMode(ADC1, LL_ADC_REG_CONV_CONTINUOUS);
+		LL_ADC_REG_SetDMATransfer(ADC1, LL_ADC_REG_DMA_TRANSFER_UNLIMITED);
+	}
+	else
+	{
+		LL_ADC_REG_SetContinuousMode(ADC1, LL_ADC_REG_CONV_SINGLE);
+		LL_ADC_REG_SetDMATransfer(ADC1, LL_ADC_REG_DMA_TRANSFER_LIMITED);
 	}
 
-	ADC_AveragedValue = (uint16_t)(ADC_SummatedValue / ADC_BUFFERSIZE);
+	LL_DMA_ConfigTransfer(DMA1, ADC_DMA_CHANNEL,
+												LL_DMA_DIRECTION_PERIPH_TO_MEMORY | LL_DMA_PRIORITY_MEDIUM |
+														(mode == ADC_SCAN_CONTINUOUS ? LL_DMA_MODE_CIRCULAR : LL_DMA_MODE_NORMAL) |
+														LL_DMA_PERIPH_NOINCREMENT | LL_DMA_MEMORY_INCREMENT |
+														LL_DMA_PDATAALIGN_HALFWORD | LL_DMA_MDATAALIGN_HALFWORD);
+	LL_DMA_SetPeriphAddress(DMA1, ADC_DMA_CHANNEL, LL_ADC_DMA_GetRegAddr(ADC1, LL_ADC_DMA_REG_REGULAR_DATA));
+	LL_DMA_SetMemoryAddress(DMA1, ADC_DMA_CHANNEL, (uint32_t)values);
+	LL_DMA_SetDataLength(DMA1, ADC_DMA_CHANNEL, conversions);
+	LL_DMA_EnableIT_TC(DMA1, ADC_DMA_CHANNEL);
+	LL_DMA_EnableIT_TE(DMA1, ADC_DMA_CHANNEL);
+	LL_DMA_EnableChannel(DMA1, ADC_DMA_CHANNEL);
 
-	// Return ADC averaged value
-	return ADC_AveragedValue;
+	LL_ADC_ClearFlag_EOC(ADC1);
+	LL_ADC_ClearFlag_EOS(ADC1);
+	LL_ADC_ClearFlag_OVR(ADC1);
+	LL_ADC_REG_StartConversion(ADC1);
+	return 1;
 }
 
-float adc_readN(pin_t pin)
+void adc_scanStop(void)
 {
-	uint16_t value = adc_readU(pin);
-	return (float)value * (1.0f / (float)0xFFF); // 12 bits range
+	if (!adc_scanning)
+		return;
+	adc_scanEnd();
+}
+
+uint8_t adc_scanBusy(void)
+{
+	return adc_scanning;
 }
@@ -0,0 +1,134 @@
+/**
+  ******************************************************************************
+  * @file    dma.c
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   DMA Channel Dispatcher Functions
+  ******************************************************************************
+*/
+
+#include <stddef.h>
+#include "dma.h"
+#include "stm32l0xx_ll_bus.h"
+
+/**
+ ===============================================================================
+              ##### Definitions #####
+ ===============================================================================
+ */
+
+#define DMA_TOTAL_CHANNELS 7
+#define DMA_ISR_SHIFT(__CH__) (((__CH__)-1U) * 4U)
+
+/**
+ ===============================================================================
+              ##### Global Static Variables #####
+ ===============================================================================
+ */
+
+typedef struct
+{
+	dmaCallback_t cb;
+	void *ctx;
+	uint8_t attached;
+	uint8_t request; /*!< Owner of the channel while attached */
+} DMAHandler_t;
+
+static DMAHandler_t dma_handlers[DMA_TOTAL_CHANNELS];
+
+/**
+ ===============================================================================
+              ##### Private Functions #####
+ ===============================================================================
+ */
+
+static IRQn_Type dma_getIRQn(uint32_t channel)
+{
+	if (channel == LL_DMA_CHANNEL_1)
+		return DMA1_Channel1_IRQn;
+	if (channel <= LL_DMA_CHANNEL_3)
+		return DMA1_Channel2_3_IRQn;
+	return DMA1_Channel4_5_6_7_IRQn;
+}
+
+static void dma_dispatch(uint32_t first, uint32_t last)
+{
+	uint32_t ch;
+	uint8_t events;
+	uint32_t isr = DMA1->ISR;
+
+	for (ch = first; ch <= last; ch++)
+	{
+		events = (uint8_t)((isr >> DMA_ISR_SHIFT(ch)) & (DMA_EVT_TC | DMA_EVT_HT | DMA_EVT_TE));
+		if (events == 0)
+			continue;
+		// Clear only what is reported, so an event raised meanwhile is not lost
+		DMA1->IFCR = ((uint32_t)events | DMA_IFCR_CGIF1) << DMA_ISR_SHIFT(ch);
+		if (dma_handlers[ch - 1].cb != NULL)
+			dma_handlers[ch - 1].cb(dma_handlers[ch - 1].ctx, events);
+	}
+}
+
+/**
+ ===============================================================================
+              ##### Interrupt #####
+ ===============================================================================
+ */
+
+void DMA1_Channel1_IRQHandler(void)
+{
+	dma_dispatch(1, 1);
+}
+
+void DMA1_Channel2_3_IRQHandler(void)
+{
+	dma_dispatch(2, 3);
+}
+
+void DMA1_Channel4_5_6_7_IRQHandler(void)
+{
+	dma_dispatch(4, 7);
+}
+
+/**
+ ===============================================================================
+              ##### Public Functions #####
+ ===============================================================================
+ */
+
+uint8_t dma_attach(uint32_t channel, uint32_t request, dmaCallback_t cb, void *ctx)
+{
+	IRQn_Type irq = dma_getIRQn(channel);
+	DMAHandler_t *h = &dma_handlers[channel - 1];
+
+	// A request number is one peripheral on a given channel, so it tells the owner apart
+	if (h->attached && h->request != (uint8_t)request)
+		return 0;
+
+	LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA1);
+
+	LL_DMA_DisableChannel(DMA1, channel);
+	LL_DMA_SetPeriphRequest(DMA1, channel, request);
+	DMA1->IFCR = (DMA_IFCR_CGIF1 | DMA_IFCR_CTCIF1 | DMA_IFCR_CHTIF1 | DMA_IFCR_CTEIF1) << DMA_ISR_SHIFT(channel);
+
+	h->cb = cb;
+	h->ctx = ctx;
+	h->request = (uint8_t)request;
+	h->attached = 1;
+
+	NVIC_SetPriority(irq, 0);
+	NVIC_EnableIRQ(irq);
+	return 1;
+}
+
+void dma_detach(uint32_t channel)
+{
+	LL_DMA_DisableChannel(DMA1, channel);
+	LL_DMA_DisableIT_TC(DMA1, channel);
+	LL_DMA_DisableIT_HT(DMA1, channel);
+	LL_DMA_DisableIT_TE(DMA1, channel);
+	dma_handlers[channel - 1].cb = NULL;
+	dma_handlers[channel - 1].ctx = NULL;
+	dma_handlers[channel - 1].attached = 0;
+}
@@ -0,0 +1,225 @@
+/**
+  ******************************************************************************
+  * @file    eon_format.c
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   Number Formatting Functions
+  ******************************************************************************
+*/
+
+#include <float.h>
+#include "eon_format.h"
+
+/**
+ ===============================================================================
+              ##### Definitions #####
+ ===============================================================================
+ */
+
+#define FMT_DIGIT(__d__) ((char)((__d__) < 10 ? '0' + (__d__) : 'A' + (__d__)-10))
+
+static const uint32_t fmt_pow10[FMT_MAX_DECIMALS + 1] = {
+		1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+/**
+ ===============================================================================
+              ##### Private Functions #####
+ ===============================================================================
+ */
+
+/* n / 10 with shifts and adds (n * 0.8 / 8), Cortex-M0+ has no divide instruction */
+static uint32_t fmt_divu10(uint32_t n, uint8_t *rem)
+{
+	uint32_t q, r;
+
+	q = (n >> 1) + (n >> 2);
+	q += q >> 4;
+	q += q >> 8;
+	q += q >> 16;
+	q >>= 3;
+	r = n - ((q << 3) + (q << 1));
+	while (r > 9)
+	{
+		q++;
+		r -= 10;
+	}
+	*rem = (uint8_t)r;
+	return q;
+}
+
+static uint64_t fmt_divu10_64(uint64_t n, uint8_t *rem)
+{
+	uint64_t q, r;
+
+	q = (n >> 1) + (n >> 2);
+	q += q >> 4;
+	q += q >> 8;
+	q += q >> 16;
+	q += q >> 32;
+	q >>= 3;
+	r = n - ((q << 3) + (q << 1));
+	while (r > 9)
+	{
+		q++;
+		r -= 10;
+	}
+	*rem = (uint8_t)r;
+	return q;
+}
+
+/* Digits of n, least significant first. Returns how many. */
+static uint8_t fmt_digits(char *rev, uint64_t n, uint8_t base)
+{
+	uint8_t i = 0;
+	uint8_t d, shift;
+	uint32_t n32;
+
+	if (base == 2 || base == 8 || base == 16)
+	{
+		shift = (base == 16) ? 4 : (base == 8) ? 3 : 1;
+		do
+		{
+			d = (uint8_t)(n & (base - 1));
+			rev[i++] = FMT_DIGIT(d);
+			n >>= shift;
+		} while (n != 0);
+		return i;
+	}
+
+	if (base == 10)
+	{
+		// 64-bit steps only while the number does not fit in 32 bits
+		while (n > 0xFFFFFFFFULL)
+		{
+			n = fmt_divu10_64(n, &d);
+			rev[i++] = (char)('0' + d);
+		}
+		n32 = (uint32_t)n;
+		do
+		{
+			n32 = fmt_divu10(n32, &d);
+			rev[i++] = (char)('0' + d);
+		} while (n32 != 0);
+		return i;
+	}
+
+	do
+	{
+		d = (uint8_t)(n % base);
+		rev[i++] = FMT_DIGIT(d);
+		n /= base;
+	} while (n != 0);
+	return i;
+}
+
+/* Write the reversed digits after dst[len], zero padded to width. Returns the new length. */
+static uint8_t fmt_emit(char *dst, uint8_t len, const char *rev, uint8_t count, uint8_t width)
+{
+	if (width > 64)
+		width = 64;
+	while (width > count)
+	{
+		dst[len++] = '0';
+		width--;
+	}
+	while (count > 0)
+		dst[len++] = rev[--count];
+	dst[len] = '\0';
+	return len;
+}
+
+/**
+ ===============================================================================
+              ##### Public Functions #####
+ ===============================================================================
+ */
+
+uint8_t fmt_uint(char *dst, uint64_t n, uint8_t base, uint8_t width)
+{
+	char rev[64];
+	uint8_t count;
+
+	if (base < 2 || base > 16)
+		base = 10;
+	count = fmt_digits(rev, n, base);
+	return fmt_emit(dst, 0, rev, count, width);
+}
+
+uint8_t fmt_int(char *dst, int64_t n, uint8_t base, uint8_t width)
+{
+	char rev[64];
+	uint8_t len = 0;
+	uint64_t u = (uint64_t)n;
+
+	if (base < 2 || base > 16)
+		base = 10;
+	if (n < 0)
+	{
+		dst[len++] = '-';
+		u = 0 - u;
+	}
+	return fmt_emit(dst, len, rev, fmt_digits(rev, u, base), width);
+}
+
+uint8_t fmt_fixed(char *dst, int64_t n, uint8_t decimals)
+{
+	char rev[64];
+	uint8_t len = 0;
+	uint8_t count;
+	uint64_t u = (uint64_t)n;
+
+	if (decimals > FMT_MAX_DECIMALS)
+		decimals = FMT_MAX_DECIMALS;
+	if (n < 0)
+	{
+		dst[len++] = '-';
+		u = 0 - u;
+	}
+
+	// At least one digit before the point: 5 with 2 decimals is "0.05"
+	count = fmt_digits(rev, u, 10);
+	while (count <= decimals)
+		rev[count++] = '0';
+
+	while (count > decimals)
+		dst[len++] = rev[--count];
+	if (decimals > 0)
+	{
+		dst[len++] = '.';
+		while (count > 0)
+			dst[len++] = rev[--count];
+	}
+	dst[len] = '\0';
+	return len;
+}
+
+// Copy a word for the values that have no digits
+static uint8_t fmt_word(char *dst, uint8_t neg, const char *word)
+{
+	uint8_t len = 0;
+
+	if (neg)
+		dst[len++] = '-';
+	while (*word != '\0')
+		dst[len++] = *word++;
+	dst[len] = '\0';
+	return len;
+}
+
+uint8_t fmt_float(char *dst, float n, uint8_t decimals)
+{
+	// NaN is the only value that is not equal to itself
+	if (n != n)
+		return fmt_word(dst, 0, "nan");
+	if (n > FLT_MAX || n < -FLT_MAX)
+		return fmt_word(dst, n < 0, "inf");
+
+	if (decimals > FMT_MAX_DECIMALS)
+		decimals = FMT_MAX_DECIMALS;
+	n *= (float)fmt_pow10[decimals];
+	// Converting a value outside of the int64_t range is undefined, 9.2e18 is just below 2^63
+	if (n >= 9.2e18f || n <= -9.2e18f)
+		return fmt_word(dst, n < 0, "ovf");
+	return fmt_fixed(dst, (int64_t)(n < 0 ? n - 0.5f : n + 0.5f), decimals);
+}
@@ -2,15 +2,18 @@
   ******************************************************************************
   * @file    i2c.c 
   * @author  Pablo Fuentes
-	* @version V1.0.1
+	* @version V1.0.3
   * @date    2019
   * @brief   I2C Functions
   ******************************************************************************
 */
 
+#include <stddef.h>
 #include "i2c.h"
+#include "i2c_timing.h"
 #include "gpio.h"
 #include "stm32l0xx_ll_bus.h"
+#include "stm32l0xx_ll_rcc.h"
 
 /** 
  ===============================================================================
@@ -18,9 +21,9 @@
  ===============================================================================
  */
 
-// Timeout
-#define FLAG_TIMEOUT ((uint16_t)0x1000)
-#define LONG_TIMEOUT ((uint16_t)0x8000)
+// Bus recovery: half period of the SCL pulses (us), up to 9 pulses free a slave holding SDA
+#define I2C_RECOVERY_HALF_PERIOD 5U
+#define I2C_RECOVERY_PULSES 9U
 
 // Flags
 #define TIMING_CLEAR_MASK ((uint32_t)0xF0FFFFFF)
@@ -28,6 +31,655 @@
 #define __LIB_I2C_CLEAR_FLAG(__I2CX__, __FLAG__) ((__I2CX__)->ICR = ((__FLAG__)&I2C_FLAG_MASK))
 #define __LIB_I2C_GET_FLAG(__I2CX__, __FLAG__) (((((__I2CX__)->ISR) & ((__FLAG__)&I2C_FLAG_MASK)) == ((__FLAG__)&I2C_FLAG_MASK)))
 
+// Interrupts of the transaction queue
+#define I2C_MASTER_IT (I2C_CR1_TXIE | I2C_CR1_RXIE | I2C_CR1_TCIE | I2C_CR1_STOPIE | I2C_CR1_NACKIE | I2C_CR1_ERRIE)
+#define I2C_MAX_NBYTES 255U
+
+// CR1 settings of SMBus, kept across a bus recovery
+#define I2C_SMBUS_CR1 (I2C_CR1_PECEN | I2C_CR1_ALERTEN)
+
+// Interrupts of the slave
+#define I2C_SLAVE_IT (I2C_CR1_ADDRIE | I2C_CR1_TXIE | I2C_CR1_RXIE | I2C_CR1_STOPIE | I2C_CR1_NACKIE | I2C_CR1_ERRIE)
+
+/** 
+ ===============================================================================
+              ##### Global Static Variables #####
+ ===============================================================================
+ */
+
+typedef struct
+{
+	I2C_TypeDef *I2Cx;
+	IRQn_Type irqn;
+	I2CTransfer_t *head; // Running transaction
+	I2CTransfer_t *tail;
+	uint16_t index; // Next byte of the running phase
+	uint8_t reading;
+	I2CSlaveMap_t *maps[2]; // Slave maps of the own addresses 1 and 2, maps[0] is NULL in master mode
+	uint16_t ptr[2];				// Register pointer of each map
+	uint8_t slot;						// Address of the running slave transaction (0 or 1)
+	uint8_t pointer;				// The next received byte is the register pointer
+	uint8_t preloaded;			// The byte in TXDR advanced the pointer
+	uint8_t first;					// First register written
+	uint16_t written;				// Registers written since the address match
+	uint32_t timing;				// TIMINGR saved while in Stop mode
+	uint32_t clkSel;				// Kernel clock selection saved while in Stop mode
+	uint32_t freq;					// TIMINGR set by i2c_setFreq(), restored after a bus recovery
+	uint32_t mode;					// LL_I2C_MODE_I2C or LL_I2C_MODE_SMBUS_HOST, kept by i2c_setFreq()
+	pin_t scl;							// Pins of i2c_init(), driven by hand during a bus recovery
+	pin_t sda;
+	void (*alert)(void);		// SMBALERT# callback, keeps the error interrupt on
+} I2CBus_t;
+
+/* Timeout counted on SysTick (1 ms period at HCLK), works at any clock and with interrupts disabled */
+typedef struct
+{
+	uint32_t last;
+	uint32_t elapsed;
+	uint32_t limit;
+} I2CTimer_t;
+
+static I2CBus_t i2c_buses[] = {
+		{.I2Cx = I2C1, .irqn = I2C1_IRQn},
+#if defined(I2C2)
+		{.I2Cx = I2C2, .irqn = I2C2_IRQn},
+#endif
+#if defined(I2C3)
+		{.I2Cx = I2C3, .irqn = I2C3_IRQn},
+#endif
+};
+
+/** 
+ ===============================================================================
+              ##### Private functions #####
+ ===============================================================================
+ */
+
+static I2CBus_t *i2c_getBus(I2C_TypeDef *I2Cx)
+{
+	uint8_t i;
+
+	for (i = 0; i < sizeof(i2c_buses) / sizeof(i2c_buses[0]); i++)
+	{
+		if (i2c_buses[i].I2Cx == I2Cx)
+			return &i2c_buses[i];
+	}
+	return NULL;
+}
+
+/* NBYTES of the next chunk, the transfer continues in RELOAD chunks of 255 bytes */
+static uint32_t i2c_nbytes(uint32_t remaining)
+{
+	return (remaining > I2C_MAX_NBYTES) ? I2C_MAX_NBYTES : remaining;
+}
+
+static uint32_t i2c_endMode(uint32_t remaining, uint32_t endmode)
+{
+	return (remaining > I2C_MAX_NBYTES) ? LL_I2C_MODE_RELOAD : endmode;
+}
+
+/* TCR: load the next chunk, writing NBYTES clears the flag and releases SCL */
+static void i2c_reload(I2C_TypeDef *I2Cx, uint32_t remaining, uint32_t endmode)
+{
+	MODIFY_REG(I2Cx->CR2, I2C_CR2_NBYTES | I2C_CR2_RELOAD | I2C_CR2_AUTOEND,
+						 (i2c_nbytes(remaining) << I2C_CR2_NBYTES_Pos) | i2c_endMode(remaining, endmode));
+}
+
+static void i2c_startRead(I2CBus_t *bus)
+{
+	I2CTransfer_t *t = bus->head;
+
+	bus->reading = 1;
+	bus->index = 0;
+	LL_I2C_HandleTransfer(bus->I2Cx, t->address, LL_I2C_ADDRSLAVE_7BIT, i2c_nbytes(t->rxLen),
+												i2c_endMode(t->rxLen, LL_I2C_MODE_AUTOEND), LL_I2C_GENERATE_START_READ);
+}
+
+/* Queue empty: only the SMBus alert keeps an interrupt on (ALERT is an error interrupt). It is
+turned back on here after the interrupt masked it for the error of a blocking transfer. */
+static void i2c_idle(I2CBus_t *bus)
+{
+	MODIFY_REG(bus->I2Cx->CR1, I2C_MASTER_IT, (bus->alert != NULL) ? I2C_CR1_ERRIE : 0);
+}
+
+static void i2c_startNext(I2CBus_t *bus)
+{
+	I2CTransfer_t *t = bus->head;
+
+	if (t == NULL)
+	{
+		i2c_idle(bus);
+		return;
+	}
+
+	SET_BIT(bus->I2Cx->CR1, I2C_MASTER_IT);
+	if (t->txLen == 0)
+	{
+		i2c_startRead(bus);
+		return;
+	}
+	// Software end when a read follows, TC then starts it with a repeated start
+	bus->reading = 0;
+	bus->index = 0;
+	LL_I2C_HandleTransfer(bus->I2Cx, t->address, LL_I2C_ADDRSLAVE_7BIT, i2c_nbytes(t->txLen),
+												i2c_endMode(t->txLen, (t->rxLen > 0) ? LL_I2C_MODE_SOFTEND : LL_I2C_MODE_AUTOEND), LL_I2C_GENERATE_START_WRITE);
+}
+
+static void i2c_finish(I2CBus_t *bus, int8_t status)
+{
+	I2CTransfer_t *t = bus->head;
+
+	// Drop a byte left in TXDR by a NACK
+	bus->I2Cx->ISR = I2C_ISR_TXE;
+	bus->head = t->next;
+	if (bus->head == NULL)
+		bus->tail = NULL;
+	t->status = status;
+	if (t->cb != NULL)
+		t->cb(t->ctx, status);
+	i2c_startNext(bus);
+}
+
+/* I2C kernel clock: PCLK1, SYSCLK or HSI16 for I2C1 and I2C3, PCLK1 for I2C2 */
+static uint32_t i2c_kernelClock(I2C_TypeDef *I2Cx)
+{
+	LL_RCC_ClocksTypeDef clocks;
+
+	if (I2Cx == I2C1)
+		return LL_RCC_GetI2CClockFreq(LL_RCC_I2C1_CLKSOURCE);
+#if defined(I2C3)
+	if (I2Cx == I2C3)
+		return LL_RCC_GetI2CClockFreq(LL_RCC_I2C3_CLKSOURCE);
+#endif
+	LL_RCC_GetSystemClocksFreq(&clocks);
+	return clocks.PCLK1_Frequency;
+}
+
+static void i2c_timerStart(I2CTimer_t *tm, uint32_t us)
+{
+	tm->last = SysTick->VAL;
+	tm->elapsed = 0;
+	// Exact at any clock, rounding the MHz up waited 43 % too long at 2.097 MHz (MSI range 5)
+	tm->limit = (uint32_t)((uint64_t)us * SystemCoreClock / 1000000);
+}
+
+static uint8_t i2c_timerExpired(I2CTimer_t *tm)
+{
+	uint32_t now = SysTick->VAL;
+
+	// The counter goes down and reloads every millisecond
+	tm->elapsed += (tm->last >= now) ? tm->last - now : tm->last + SysTick->LOAD + 1 - now;
+	tm->last = now;
+	return tm->elapsed >= tm->limit;
+}
+
+static void i2c_delayUs(uint32_t us)
+{
+	I2CTimer_t tm;
+
+	i2c_timerStart(&tm, us);
+	while (!i2c_timerExpired(&tm))
+		;
+}
+
+/* Wait for a flag of ISR, a NACK or a bus error ends the wait */
+static int8_t i2c_wait(I2C_TypeDef *I2Cx, uint32_t flag)
+{
+	I2CTimer_t tm;
+	uint32_t isr;
+
+	i2c_timerStart(&tm, I2C_TIMEOUT_US);
+	while (((isr = I2Cx->ISR) & flag) == 0)
+	{
+		if (isr & I2C_ISR_NACKF)
+			return I2C_ERR_NACK;
+		if (isr & I2C_ISR_ARLO)
+			return I2C_ERR_ARLO;
+		if (isr & I2C_ISR_BERR)
+			return I2C_ERR_BERR;
+		if (isr & I2C_ISR_PECERR)
+			return I2C_ERR_PEC;
+		if (i2c_timerExpired(&tm))
+			return I2C_ERR_TIMEOUT;
+	}
+	return I2C_OK;
+}
+
+/* Wait until the bus is free (stop seen) */
+static int8_t i2c_waitIdle(I2C_TypeDef *I2Cx)
+{
+	I2CTimer_t tm;
+
+	i2c_timerStart(&tm, I2C_TIMEOUT_US);
+	while (LL_I2C_IsActiveFlag_BUSY(I2Cx) != RESET)
+	{
+		if (i2c_timerExpired(&tm))
+			return I2C_ERR_TIMEOUT;
+	}
+	return I2C_OK;
+}
+
+static void i2c_forceReset(I2C_TypeDef *I2Cx)
+{
+#if defined(I2C1)
+	if (I2Cx == I2C1)
+	{
+
+		LL_APB1_GRP1_ForceReset(LL_APB1_GRP1_PERIPH_I2C1);
+		LL_APB1_GRP1_ReleaseReset(LL_APB1_GRP1_PERIPH_I2C1);
+	}
+#endif
+#if defined(I2C2)
+	if (I2Cx == I2C2)
+	{
+		LL_APB1_GRP1_ForceReset(LL_APB1_GRP1_PERIPH_I2C2);
+		LL_APB1_GRP1_ReleaseReset(LL_APB1_GRP1_PERIPH_I2C2);
+	}
+#endif
+#if defined(I2C3)
+	if (I2Cx == I2C3)
+	{
+		LL_APB1_GRP1_ForceReset(LL_APB1_GRP1_PERIPH_I2C3);
+		LL_APB1_GRP1_ReleaseReset(LL_APB1_GRP1_PERIPH_I2C3);
+	}
+#endif
+}
+
+/* Leave the bus idle after a failed blocking transfer, recovering it if it stays busy. Returns err. */
+static int16_t i2c_release(I2C_TypeDef *I2Cx, int8_t err)
+{
+	I2CBus_t *bus = i2c_getBus(I2Cx);
+
+	// After a NACK the hardware has already sent the stop, after ARLO the bus belongs to another master
+	if (err != I2C_ERR_ARLO)
+	{
+		if (err != I2C_ERR_NACK && LL_I2C_IsActiveFlag_BUSY(I2Cx))
+			i2c_stop(I2Cx);
+		if (i2c_waitIdle(I2Cx) != I2C_OK)
+			i2c_recover(I2Cx);
+	}
+	I2Cx->ICR = I2C_ICR_STOPCF | I2C_ICR_NACKCF | I2C_ICR_ARLOCF | I2C_ICR_BERRCF | I2C_ICR_PECCF | I2C_ICR_OVRCF | I2C_ICR_TIMOUTCF;
+	I2Cx->ISR = I2C_ISR_TXE;
+	if (bus != NULL && bus->head == NULL)
+		i2c_idle(bus);
+	return err;
+}
+
+/* End of a blocking transfer: wait for TC, then send the stop if asked */
+static int8_t i2c_end(I2C_TypeDef *I2Cx, int stop)
+{
+	int8_t res = i2c_wait(I2Cx, I2C_ISR_TC);
+
+	// If not repeated start, send stop.
+	if (res == I2C_OK && stop)
+	{
+		i2c_stop(I2Cx);
+		res = i2c_wait(I2Cx, I2C_ISR_STOPF);
+		LL_I2C_ClearFlag_STOP(I2Cx);
+	}
+	return res;
+}
+
+/* Blocking write of the register address followed by the data, in one transaction */
+static int32_t i2c_send(I2C_TypeDef *I2Cx, int address, const uint8_t *reg, uint8_t regLen, const uint8_t *data, int length, int stop)
+{
+	int32_t count, total = regLen + length;
+	uint32_t chunk = i2c_nbytes(total);
+	int8_t res;
+
+	// Handle Transfer, one transaction in chunks of 255 bytes
+	LL_I2C_ClearFlag_NACK(I2Cx);
+	LL_I2C_HandleTransfer(I2Cx, address, LL_I2C_ADDRSLAVE_7BIT, chunk, i2c_endMode(total, LL_I2C_MODE_SOFTEND), LL_I2C_GENERATE_START_WRITE);
+
+	for (count = 0; count < total; count++, chunk--)
+	{
+		if (chunk == 0)
+		{
+			res = i2c_wait(I2Cx, I2C_ISR_TCR);
+			if (res != I2C_OK)
+				return i2c_release(I2Cx, res);
+			chunk = i2c_nbytes(total - count);
+			i2c_reload(I2Cx, total - count, LL_I2C_MODE_SOFTEND);
+		}
+		res = i2c_wait(I2Cx, I2C_ISR_TXIS);
+		if (res != I2C_OK)
+			return i2c_release(I2Cx, res);
+		I2Cx->TXDR = (count < regLen) ? reg[count] : data[count - regLen];
+	}
+
+	res = i2c_end(I2Cx, stop);
+	if (res != I2C_OK)
+		return i2c_release(I2Cx, res);
+	return length;
+}
+
+/* Blocking read in one transaction, returns the bytes read (up to 65535) or I2C_ERR_x */
+static int32_t i2c_receive(I2C_TypeDef *I2Cx, int address, uint8_t *data, int length, int stop)
+{
+	int32_t count;
+	int16_t value;
+	uint32_t chunk = i2c_nbytes(length);
+	int8_t res;
+
+	// Handle Transfer, one transaction in chunks of 255 bytes
+	LL_I2C_ClearFlag_NACK(I2Cx);
+	LL_I2C_HandleTransfer(I2Cx, address, LL_I2C_ADDRSLAVE_7BIT, chunk, i2c_endMode(length, LL_I2C_MODE_SOFTEND), LL_I2C_GENERATE_START_READ);
+
+	// Read all bytes
+	for (count = 0; count < length; count++, chunk--)
+	{
+		if (chunk == 0)
+		{
+			res = i2c_wait(I2Cx, I2C_ISR_TCR);
+			if (res != I2C_OK)
+				return i2c_release(I2Cx, res);
+			chunk = i2c_nbytes(length - count);
+			i2c_reload(I2Cx, length - count, LL_I2C_MODE_SOFTEND);
+		}
+		value = i2c_read8(I2Cx, 0);
+		if (value < 0)
+			return i2c_release(I2Cx, (int8_t)value);
+		data[count] = (uint8_t)value;
+	}
+
+	res = i2c_end(I2Cx, stop);
+	if (res != I2C_OK)
+		return i2c_release(I2Cx, res);
+	return length;
+}
+
+/* Stop of an SMBus transfer with PEC. The PEC check and the NACK of the PEC byte can come
+just before STOPF, so they are tested once it is set. */
+static int8_t i2c_smbusEnd(I2C_TypeDef *I2Cx)
+{
+	int8_t res = i2c_wait(I2Cx, I2C_ISR_STOPF);
+	uint32_t isr = I2Cx->ISR;
+
+	LL_I2C_ClearFlag_STOP(I2Cx);
+	if (res != I2C_OK)
+		return res;
+	if (isr & I2C_ISR_PECERR)
+		return I2C_ERR_PEC;
+	if (isr & I2C_ISR_NACKF)
+		return I2C_ERR_NACK;
+	return I2C_OK;
+}
+
+/* SMBus write phase: head (command, count) then data. Before a read it ends in TC for the
+repeated start, otherwise the hardware appends the PEC and sends the stop. */
+static int8_t i2c_smbusWrite(I2C_TypeDef *I2Cx, uint8_t address, const uint8_t *head, uint8_t headLen, const uint8_t *data, uint8_t length, uint8_t readNext)
+{
+	uint16_t count, total = headLen + length;
+	int8_t res;
+
+	LL_I2C_ClearFlag_NACK(I2Cx);
+	if (readNext)
+		LL_I2C_HandleTransfer(I2Cx, address, LL_I2C_ADDRSLAVE_7BIT, total, LL_I2C_MODE_SMBUS_SOFTEND_NO_PEC, LL_I2C_GENERATE_START_WRITE);
+	else
+		LL_I2C_HandleTransfer(I2Cx, address, LL_I2C_ADDRSLAVE_7BIT, total + 1, LL_I2C_MODE_SMBUS_AUTOEND_WITH_PEC, LL_I2C_GENERATE_START_WRITE);
+
+	for (count = 0; count < total; count++)
+	{
+		res = i2c_wait(I2Cx, I2C_ISR_TXIS);
+		if (res != I2C_OK)
+			return res;
+		I2Cx->TXDR = (count < headLen) ? head[count] : data[count - headLen];
+	}
+	if (readNext)
+		return i2c_wait(I2Cx, I2C_ISR_TC);
+	return i2c_smbusEnd(I2Cx);
+}
+
+/* SMBus read phase after a repeated start, the last byte is the PEC checked by the hardware.
+A block starts with its byte count: it is read alone with RELOAD, then NBYTES is set from it.
+Returns the bytes read (a block longer than length is truncated) or I2C_ERR_x. */
+static int16_t i2c_smbusRead(I2C_TypeDef *I2Cx, uint8_t address, uint8_t *data, uint8_t length, uint8_t block)
+{
+	uint16_t count, total = length;
+	uint8_t value;
+	int8_t res;
+
+	if (block)
+	{
+		LL_I2C_HandleTransfer(I2Cx, address, LL_I2C_ADDRSLAVE_7BIT, 1, LL_I2C_MODE_SMBUS_RELOAD, LL_I2C_GENERATE_START_READ);
+		res = i2c_wait(I2Cx, I2C_ISR_RXNE);
+		if (res != I2C_OK)
+			return res;
+		total = (uint8_t)I2Cx->RXDR;
+		if (total >= I2C_MAX_NBYTES)
+			return I2C_ERR_PEC;
+		res = i2c_wait(I2Cx, I2C_ISR_TCR);
+		if (res != I2C_OK)
+			return res;
+		// PECBYTE has no effect while RELOAD is set, the last chunk sets it
+		MODIFY_REG(I2Cx->CR2, I2C_CR2_NBYTES | I2C_CR2_RELOAD | I2C_CR2_AUTOEND | I2C_CR2_PECBYTE,
+							 ((total + 1) << I2C_CR2_NBYTES_Pos) | LL_I2C_MODE_SMBUS_AUTOEND_WITH_PEC);
+	}
+	else
+		LL_I2C_HandleTransfer(I2Cx, address, LL_I2C_ADDRSLAVE_7BIT, total + 1, LL_I2C_MODE_SMBUS_AUTOEND_WITH_PEC, LL_I2C_GENERATE_START_READ);
+
+	// The PEC byte also goes through RXDR
+	for (count = 0; count <= total; count++)
+	{
+		res = i2c_wait(I2Cx, I2C_ISR_RXNE);
+		if (res != I2C_OK)
+			return res;
+		value = (uint8_t)I2Cx->RXDR;
+		if (count < total && count < length)
+			data[count] = value;
+	}
+	res = i2c_smbusEnd(I2Cx);
+	if (res != I2C_OK)
+		return res;
+	return (int16_t)total;
+}
+
+/* SMBus transaction: head and tx written, then rx read after a repeated start if not NULL */
+static int16_t i2c_smbus(I2C_TypeDef *I2Cx, uint8_t address, const uint8_t *head, uint8_t headLen, const uint8_t *tx, uint8_t txLen, uint8_t *rx, uint8_t rxLen, uint8_t block)
+{
+	int16_t res;
+
+	if ((uint32_t)headLen + txLen + 1U > I2C_MAX_NBYTES || rxLen + 1U > I2C_MAX_NBYTES)
+		return I2C_ERR_LENGTH;
+
+	res = i2c_smbusWrite(I2Cx, address, head, headLen, tx, txLen, rx != NULL);
+	if (res == I2C_OK)
+		res = (rx != NULL) ? i2c_smbusRead(I2Cx, address, rx, rxLen, block) : txLen;
+	if (res < 0)
+		return i2c_release(I2Cx, (int8_t)res);
+	return res;
+}
+
+static int32_t i2c_readRegN(I2C_TypeDef *I2Cx, uint8_t address, const uint8_t *reg, uint8_t regLen, uint8_t *data, uint16_t length)
+{
+	int32_t res = i2c_send(I2Cx, address, reg, regLen, NULL, 0, I2C_NO_STOP);
+
+	if (res < 0)
+		return res;
+	return i2c_receive(I2Cx, address, data, length, I2C_STOP);
+}
+
+/* Next register of a slave read, the filler past the end of the map */
+static uint8_t i2c_slaveNext(I2CBus_t *bus)
+{
+	I2CSlaveMap_t *map = bus->maps[bus->slot];
+	uint16_t *ptr = &bus->ptr[bus->slot];
+
+	bus->preloaded = (*ptr < map->size);
+	if (!bus->preloaded)
+		return I2C_SLAVE_FILLER;
+	return map->regs[(*ptr)++];
+}
+
+/* Report the registers written by the master since the address match */
+static void i2c_slaveWritten(I2CBus_t *bus)
+{
+	I2CSlaveMap_t *map = bus->maps[bus->slot];
+
+	if (bus->written > 0 && map->onWrite != NULL)
+		map->onWrite(bus->first, bus->written);
+	bus->written = 0;
+}
+
+/* Event and error interrupt of the slave. Flags are handled in bus order: the data and the stop
+of the previous transaction come before a new address match. */
+static void i2c_slaveIrq(I2CBus_t *bus)
+{
+	I2C_TypeDef *I2Cx = bus->I2Cx;
+	I2CSlaveMap_t *map = bus->maps[bus->slot];
+	uint16_t *ptr = &bus->ptr[bus->slot];
+	uint32_t isr = I2Cx->ISR;
+	uint8_t data;
+
+	if (isr & (I2C_ISR_BERR | I2C_ISR_ARLO | I2C_ISR_OVR))
+		I2Cx->ICR = I2C_ICR_BERRCF | I2C_ICR_ARLOCF | I2C_ICR_OVRCF;
+
+	// Master writes: the first byte is the pointer, the next ones registers
+	if (isr & I2C_ISR_RXNE)
+	{
+		data = (uint8_t)I2Cx->RXDR;
+		if (bus->pointer)
+		{
+			*ptr = data;
+			bus->first = data;
+			bus->pointer = 0;
+		}
+		else if (*ptr < map->size)
+		{
+			if (*ptr < map->readOnly)
+			{
+				map->regs[*ptr] = data;
+				bus->written++;
+			}
+			(*ptr)++;
+		}
+	}
+
+	// Master reads: TXDR is loaded while the previous byte is sent, so SCL is not stretched
+	if ((isr & (I2C_ISR_TXIS | I2C_ISR_ADDR)) == I2C_ISR_TXIS)
+		I2Cx->TXDR = i2c_slaveNext(bus);
+
+	// The master ends a read with a NACK, the byte already in TXDR was not sent
+	if (isr & I2C_ISR_NACKF)
+	{
+		if (!(I2Cx->ISR & I2C_ISR_TXE) && bus->preloaded)
+			(*ptr)--;
+		I2Cx->ISR = I2C_ISR_TXE;
+		I2Cx->ICR = I2C_ICR_NACKCF;
+	}
+
+	if (isr & I2C_ISR_STOPF)
+	{
+		I2Cx->ICR = I2C_ICR_STOPCF;
+		I2Cx->ISR = I2C_ISR_TXE;
+		i2c_slaveWritten(bus);
+	}
+
+	// Address match, SCL is stretched until ADDRCF. A repeated start also ends the previous write.
+	if (isr & I2C_ISR_ADDR)
+	{
+		i2c_slaveWritten(bus);
+		bus->slot = (((isr & I2C_ISR_ADDCODE) >> I2C_ISR_ADDCODE_Pos) == ((I2Cx->OAR1 & 0xFE) >> 1)) ? 0 : 1;
+		if (isr & I2C_ISR_DIR)
+		{
+			// The first byte goes out as soon as SCL is released
+			I2Cx->ISR = I2C_ISR_TXE;
+			I2Cx->TXDR = i2c_slaveNext(bus);
+		}
+		else
+			bus->pointer = 1;
+		I2Cx->ICR = I2C_ICR_ADDRCF;
+	}
+}
+
+/* TIMINGR for a kernel clock, with the rise and fall times of the fixed I2C_xxx_CxMHZ values */
+static uint32_t i2c_timing(uint32_t clk_hz, uint32_t speed_hz)
+{
+	uint16_t rise = (speed_hz <= 100000) ? 400 : (speed_hz <= 400000) ? 250 : 60;
+
+	return i2c_computeTiming(clk_hz, speed_hz, rise, 100);
+}
+
+/* Kernel clock selection field in CCIPR and EXTI line of the I2C that can wake the MCU from Stop, 0 for the others */
+static uint32_t i2c_wakeupLine(I2C_TypeDef *I2Cx, uint32_t *clkSel)
+{
+	if (I2Cx == I2C1)
+	{
+		*clkSel = RCC_CCIPR_I2C1SEL;
+		return EXTI_IMR_IM23;
+	}
+#if defined(I2C3)
+	if (I2Cx == I2C3)
+	{
+		*clkSel = RCC_CCIPR_I2C3SEL;
+		return EXTI_IMR_IM24;
+	}
+#endif
+	return 0;
+}
+
+/* Event and error interrupt of the queue */
+static void i2c_irq(I2CBus_t *bus)
+{
+	I2C_TypeDef *I2Cx = bus->I2Cx;
+	I2CTransfer_t *t = bus->head;
+	uint32_t isr = I2Cx->ISR;
+
+	// SMBALERT# low, the callback should have the alert response sent out of the interrupt
+	if ((isr & I2C_ISR_ALERT) && bus->alert != NULL)
+	{
+		I2Cx->ICR = I2C_ICR_ALERTCF;
+		bus->alert();
+	}
+	if (bus->maps[0] != NULL)
+	{
+		i2c_slaveIrq(bus);
+		return;
+	}
+	if (t == NULL)
+	{
+		// Errors of a blocking transfer belong to its i2c_wait(): left set, with ERRIE off until
+		// i2c_release() so they do not fire again
+		if (isr & (I2C_ISR_ARLO | I2C_ISR_BERR | I2C_ISR_OVR | I2C_ISR_PECERR | I2C_ISR_TIMEOUT))
+			CLEAR_BIT(I2Cx->CR1, I2C_CR1_ERRIE);
+		return;
+	}
+
+	// Bus errors end the transaction at once, the master does not own the bus anymore
+	if (isr & (I2C_ISR_ARLO | I2C_ISR_BERR))
+	{
+		I2Cx->ICR = I2C_ICR_ARLOCF | I2C_ICR_BERRCF | I2C_ICR_STOPCF | I2C_ICR_NACKCF;
+		i2c_finish(bus, (isr & I2C_ISR_ARLO) ? I2C_ERR_ARLO : I2C_ERR_BERR);
+		return;
+	}
+	// The hardware sends the stop after a NACK, the transaction ends on STOPF
+	if (isr & I2C_ISR_NACKF)
+	{
+		I2Cx->ICR = I2C_ICR_NACKCF;
+		t->status = I2C_ERR_NACK;
+	}
+
+	if ((isr & I2C_ISR_TXIS) && !bus->reading)
+		I2Cx->TXDR = t->tx[bus->index++];
+	if ((isr & I2C_ISR_RXNE) && bus->reading)
+		t->rx[bus->index++] = (uint8_t)I2Cx->RXDR;
+	if (isr & I2C_ISR_TCR)
+	{
+		if (bus->reading)
+			i2c_reload(I2Cx, t->rxLen - bus->index, LL_I2C_MODE_AUTOEND);
+		else
+			i2c_reload(I2Cx, t->txLen - bus->index, (t->rxLen > 0) ? LL_I2C_MODE_SOFTEND : LL_I2C_MODE_AUTOEND);
+	}
+	if ((isr & I2C_ISR_TC) && !bus->reading)
+		i2c_startRead(bus);
+
+	if (isr & I2C_ISR_STOPF)
+	{
+		I2Cx->ICR = I2C_ICR_STOPCF;
+		i2c_finish(bus, (t->status == I2C_PENDING) ? I2C_OK : t->status);
+	}
+}
+
 /** 
  ===============================================================================
               ##### Public functions #####
@@ -36,6 +688,8 @@
 
 void i2c_init(I2C_TypeDef *I2Cx, uint32_t freq, pin_t scl, pin_t sda)
 {
+	I2CBus_t *bus;
+
 #ifdef I2C1
 	if (I2Cx == I2C1)
 	{
@@ -48,7 +702,20 @@ void i2c_init(I2C_TypeDef *I2Cx, uint32_t freq, pin_t scl, pin_t sda)
 		SET_BIT(RCC->APB1ENR, RCC_APB1ENR_I2C2EN);
 	}
 #endif
+#if defined(I2C3)
+	if (I2Cx == I2C3)
+	{
+		SET_BIT(RCC->APB1ENR, RCC_APB1ENR_I2C3EN);
+	}
+#endif
 
+	bus = i2c_getBus(I2Cx);
+	if (bus != NULL)
+	{
+		bus->scl = scl;
+		bus->sda = sda;
+		bus->mode = LL_I2C_MODE_I2C;
+	}
 	gpio_modeI2C(scl);
 	gpio_modeI2C(sda);
 	i2c_reset(I2Cx);
@@ -57,35 +724,89 @@ void i2c_init(I2C_TypeDef *I2Cx, uint32_t freq, pin_t scl, pin_t sda)
 
 void i2c_reset(I2C_TypeDef *I2Cx)
 {
-	uint16_t timeout;
+	i2c_waitIdle(I2Cx);
+	i2c_forceReset(I2Cx);
+}
 
-	timeout = LONG_TIMEOUT;
-	while ((LL_I2C_IsActiveFlag_BUSY(I2Cx) != RESET) && (timeout-- != 0))
-		;
-#if defined(I2C1)
-	if (I2Cx == I2C1)
+uint8_t i2c_recover(I2C_TypeDef *I2Cx)
+{
+	I2CBus_t *bus = i2c_getBus(I2Cx);
+	uint8_t i, released;
+	uint32_t smbus;
+
+	if (bus == NULL)
+		return 0;
+	// The reset clears CR1
+	smbus = I2Cx->CR1 & I2C_SMBUS_CR1;
+
+	// A slave holding SDA low is in the middle of a byte: clock it out until SDA is released
+	gpio_write(bus->scl, HIGH);
+	gpio_write(bus->sda, HIGH);
+	gpio_mode(bus->scl, OUTPUT_OD, NOPULL, SPEED_LOW);
+	gpio_mode(bus->sda, OUTPUT_OD, NOPULL, SPEED_LOW);
+	for (i = 0; i < I2C_RECOVERY_PULSES && gpio_read(bus->sda) == LOW; i++)
 	{
-
-		LL_APB1_GRP1_ForceReset(LL_APB1_GRP1_PERIPH_I2C1);
-		LL_APB1_GRP1_ReleaseReset(LL_APB1_GRP1_PERIPH_I2C1);
+		gpio_write(bus->scl, LOW);
+		i2c_delayUs(I2C_RECOVERY_HALF_PERIOD);
+		gpio_write(bus->scl, HIGH);
+		i2c_delayUs(I2C_RECOVERY_HALF_PERIOD);
 	}
-#endif
+
+	// Stop condition: SDA rises while SCL is high
+	gpio_write(bus->sda, LOW);
+	i2c_delayUs(I2C_RECOVERY_HALF_PERIOD);
+	gpio_write(bus->sda, HIGH);
+	i2c_delayUs(I2C_RECOVERY_HALF_PERIOD);
+	released = (gpio_read(bus->sda) == HIGH && gpio_read(bus->scl) == HIGH);
+
+	gpio_modeI2C(bus->scl);
+	gpio_modeI2C(bus->sda);
+	i2c_forceReset(I2Cx);
+	i2c_setFreq(I2Cx, bus->freq, I2C_MASTER);
+	SET_BIT(I2Cx->CR1, smbus);
+	i2c_idle(bus);
+	return released;
+}
+
+uint32_t i2c_computeTiming(uint32_t clk_hz, uint32_t speed_hz, uint16_t rise_ns, uint16_t fall_ns)
+{
+	return i2c_solveTiming(clk_hz, speed_hz, rise_ns, fall_ns);
+}
+
+uint8_t i2c_setSpeed(I2C_TypeDef *I2Cx, uint32_t speed_hz)
+{
+	uint32_t timing = i2c_timing(i2c_kernelClock(I2Cx), speed_hz);
+	uint32_t fmp = SYSCFG_CFGR2_I2C1_FMP;
+
+	if (timing == 0)
+		return 0;
+
 #if defined(I2C2)
 	if (I2Cx == I2C2)
-	{
-		LL_APB1_GRP1_ForceReset(LL_APB1_GRP1_PERIPH_I2C2);
-		LL_APB1_GRP1_ReleaseReset(LL_APB1_GRP1_PERIPH_I2C2);
-	}
+		fmp = SYSCFG_CFGR2_I2C2_FMP;
 #endif
+#if defined(I2C3)
+	if (I2Cx == I2C3)
+		fmp = SYSCFG_CFGR2_I2C3_FMP;
+#endif
+	// Fast mode plus needs the 20 mA drive of the pins
+	SET_BIT(RCC->APB2ENR, RCC_APB2ENR_SYSCFGEN);
+	if (speed_hz > 400000)
+		SET_BIT(SYSCFG->CFGR2, fmp);
+	else
+		CLEAR_BIT(SYSCFG->CFGR2, fmp);
+
+	i2c_setFreq(I2Cx, timing, I2C_MASTER);
+	return 1;
 }
 
 void i2c_setFreq(I2C_TypeDef *I2Cx, uint32_t freq, uint8_t i2c_master_slave)
 {
-	uint16_t timeout;
+	I2CBus_t *bus = i2c_getBus(I2Cx);
 
-	timeout = LONG_TIMEOUT;
-	while ((LL_I2C_IsActiveFlag_BUSY(I2Cx) != RESET) && (timeout-- != 0))
-		;
+	if (bus != NULL)
+		bus->freq = freq;
+	i2c_waitIdle(I2Cx);
 
 	LL_I2C_Disable(I2Cx);
 	// Standard mode with Rise Time = 400ns and Fall Time = 100ns (100KHz)
@@ -94,7 +815,7 @@ void i2c_setFreq(I2C_TypeDef *I2Cx, uint32_t freq, uint8_t i2c_master_slave)
 	LL_I2C_SetTiming(I2Cx, (freq & TIMING_CLEAR_MASK));
 	LL_I2C_DisableOwnAddress1(I2Cx);
 	LL_I2C_DisableOwnAddress2(I2Cx);
-	LL_I2C_SetMode(I2Cx, LL_I2C_MODE_I2C);
+	LL_I2C_SetMode(I2Cx, (bus != NULL) ? bus->mode : LL_I2C_MODE_I2C);
 	LL_I2C_EnableAutoEndMode(I2Cx);
 	LL_I2C_AcknowledgeNextData(I2Cx, LL_I2C_NACK);
 	LL_I2C_DisableClockStretching(I2Cx);
@@ -104,15 +825,15 @@ void i2c_setFreq(I2C_TypeDef *I2Cx, uint32_t freq, uint8_t i2c_master_slave)
 
 uint8_t i2c_start(I2C_TypeDef *I2Cx)
 {
-	uint16_t timeout;
+	I2CTimer_t tm;
 
 	LL_I2C_ClearFlag_NACK(I2Cx);
 
 	// Wait the STOP condition has been previously correctly sent
-	timeout = FLAG_TIMEOUT;
+	i2c_timerStart(&tm, I2C_TIMEOUT_US);
 	while ((I2Cx->CR2 & I2C_CR2_STOP) == I2C_CR2_STOP)
 	{
-		if ((timeout--) == 0)
+		if (i2c_timerExpired(&tm))
 			return 1;
 	}
 
@@ -120,16 +841,7 @@ uint8_t i2c_start(I2C_TypeDef *I2Cx)
 	I2Cx->CR2 |= I2C_CR2_START;
 
 	// Wait the START condition has been correctly sent
-	timeout = FLAG_TIMEOUT;
-	while (__LIB_I2C_CLEAR_FLAG(I2Cx, I2C_ISR_BUSY) == RESET)
-	{
-		if ((timeout--) == 0)
-		{
-			return 1;
-		}
-	}
-
-	return 0;
+	return i2c_wait(I2Cx, I2C_ISR_BUSY) != I2C_OK;
 }
 
 /** 
@@ -140,34 +852,17 @@ uint8_t i2c_start(I2C_TypeDef *I2Cx)
 
 int16_t i2c_read8(I2C_TypeDef *I2Cx, int last)
 {
-	uint16_t timeout;
-
-	// Wait until the byte is received
-	timeout = FLAG_TIMEOUT;
-	while (LL_I2C_IsActiveFlag_RXNE(I2Cx) == RESET)
-	{
-		if ((timeout--) == 0)
-		{
-			return -1; // fail read
-		}
-	}
+	int8_t res = i2c_wait(I2Cx, I2C_ISR_RXNE);
 
-	return (int)I2Cx->RXDR; // success
+	if (res != I2C_OK)
+		return res;
+	return (int16_t)I2Cx->RXDR;
 }
 
 uint8_t i2c_write8(I2C_TypeDef *I2Cx, int data)
 {
-	int timeout;
-
-	// Wait until the byte is transmitted
-	timeout = FLAG_TIMEOUT;
-	while (LL_I2C_IsActiveFlag_TXIS(I2Cx) == RESET)
-	{
-		if ((timeout--) == 0)
-		{
-			return 0; // fail write
-		}
-	}
+	if (i2c_wait(I2Cx, I2C_ISR_TXIS) != I2C_OK)
+		return 0; // fail write
 
 	I2Cx->TXDR = (uint8_t)data;
 
@@ -180,310 +875,318 @@ uint8_t i2c_write8(I2C_TypeDef *I2Cx, int data)
  ===============================================================================
  */
 
-int16_t i2c_read(I2C_TypeDef *I2Cx, int address, char *data, int length, int stop)
+int32_t i2c_read(I2C_TypeDef *I2Cx, int address, char *data, int length, int stop)
 {
-	uint16_t timeout;
-	int16_t count, value;
+	return i2c_receive(I2Cx, address, (uint8_t *)data, length, stop);
+}
 
-	// Handle Transfer
-	LL_I2C_HandleTransfer(I2Cx, address, LL_I2C_ADDRSLAVE_7BIT, length & 0xFF, LL_I2C_MODE_SOFTEND, LL_I2C_GENERATE_START_READ);
+int32_t i2c_write(I2C_TypeDef *I2Cx, int address, const char *data, int length, int stop)
+{
+	return i2c_send(I2Cx, address, NULL, 0, (const uint8_t *)data, length, stop);
+}
 
-	// Read all bytes
-	for (count = 0; count < length; count++)
-	{
-		value = i2c_read8(I2Cx, 0);
-		data[count] = (char)value;
-	}
+/** 
+ ===============================================================================
+              ##### Register functions #####
+ ===============================================================================
+ */
 
-	// Wait transfer complete
-	timeout = FLAG_TIMEOUT;
-	while (LL_I2C_IsActiveFlag_TC(I2Cx) == RESET)
-	{
-		timeout--;
-		if (timeout == 0)
-		{
-			return -1;
-		}
-	}
+int32_t i2c_readReg(I2C_TypeDef *I2Cx, uint8_t address, uint8_t reg, uint8_t *data, uint16_t length)
+{
+	return i2c_readRegN(I2Cx, address, &reg, 1, data, length);
+}
 
-	__LIB_I2C_CLEAR_FLAG(I2Cx, I2C_ISR_TC);
+int32_t i2c_readReg16(I2C_TypeDef *I2Cx, uint8_t address, uint16_t reg, uint8_t *data, uint16_t length)
+{
+	uint8_t r[2] = {(uint8_t)(reg >> 8), (uint8_t)reg};
 
-	// If not repeated start, send stop.
-	if (stop)
-	{
-		i2c_stop(I2Cx);
-		/* Wait until STOPF flag is set */
-		timeout = FLAG_TIMEOUT;
-		while (LL_I2C_IsActiveFlag_STOP(I2Cx) == RESET)
-		{
-			timeout--;
-			if (timeout == 0)
-			{
-				return -1;
-			}
-		}
-		/* Clear STOP Flag */
-		LL_I2C_ClearFlag_STOP(I2Cx);
-	}
+	return i2c_readRegN(I2Cx, address, r, 2, data, length);
+}
 
-	return length;
+int32_t i2c_writeReg(I2C_TypeDef *I2Cx, uint8_t address, uint8_t reg, const uint8_t *data, uint16_t length)
+{
+	return i2c_send(I2Cx, address, &reg, 1, data, length, I2C_STOP);
 }
 
-int16_t i2c_write(I2C_TypeDef *I2Cx, int address, const char *data, int length, int stop)
+int32_t i2c_writeReg16(I2C_TypeDef *I2Cx, uint8_t address, uint16_t reg, const uint8_t *data, uint16_t length)
 {
-	uint16_t timeout;
-	int16_t count;
+	uint8_t r[2] = {(uint8_t)(reg >> 8), (uint8_t)reg};
+
+	return i2c_send(I2Cx, address, r, 2, data, length, I2C_STOP);
+}
 
-	// Handle Transfer
-	LL_I2C_HandleTransfer(I2Cx, address, LL_I2C_ADDRSLAVE_7BIT, length & 0xFF, LL_I2C_MODE_SOFTEND, LL_I2C_GENERATE_START_WRITE);
+uint8_t i2c_readRegs(I2C_TypeDef *I2Cx, I2CRegRead_t *list, uint8_t count)
+{
+	uint8_t i, read = 0;
 
-	for (count = 0; count < length; count++)
+	for (i = 0; i < count; i++)
 	{
-		i2c_write8(I2Cx, data[count]);
+		if (list[i].regLen == 2)
+			list[i].result = i2c_readReg16(I2Cx, list[i].address, list[i].reg, list[i].data, list[i].length);
+		else
+			list[i].result = i2c_readReg(I2Cx, list[i].address, (uint8_t)list[i].reg, list[i].data, list[i].length);
+		if (list[i].result >= 0)
+			read++;
 	}
+	return read;
+}
+
+/** 
+ ===============================================================================
+              ##### SMBus #####
+ ===============================================================================
+ */
+
+void i2cSmbus_init(I2C_TypeDef *I2Cx, uint32_t freq, pin_t scl, pin_t sda)
+{
+	I2CBus_t *bus = i2c_getBus(I2Cx);
+
+	i2c_init(I2Cx, freq, scl, sda);
+
+	// SMBHEN: SMBALERT# is the host input, without it ALERTEN drives the pin as a device
+	if (bus != NULL)
+		bus->mode = LL_I2C_MODE_SMBUS_HOST;
+	LL_I2C_Disable(I2Cx);
+	LL_I2C_SetMode(I2Cx, LL_I2C_MODE_SMBUS_HOST);
+	LL_I2C_EnableSMBusPEC(I2Cx);
+	LL_I2C_Enable(I2Cx);
+}
+
+int16_t i2cSmbus_write(I2C_TypeDef *I2Cx, uint8_t address, uint8_t command, const uint8_t *data, uint8_t length)
+{
+	return i2c_smbus(I2Cx, address, &command, 1, data, length, NULL, 0, 0);
+}
+
+int16_t i2cSmbus_read(I2C_TypeDef *I2Cx, uint8_t address, uint8_t command, uint8_t *data, uint8_t length)
+{
+	return i2c_smbus(I2Cx, address, &command, 1, NULL, 0, data, length, 0);
+}
+
+int16_t i2cSmbus_writeBlock(I2C_TypeDef *I2Cx, uint8_t address, uint8_t command, const uint8_t *data, uint8_t count)
+{
+	uint8_t head[2] = {command, count};
+
+	return i2c_smbus(I2Cx, address, head, 2, data, count, NULL, 0, 0);
+}
+
+int16_t i2cSmbus_readBlock(I2C_TypeDef *I2Cx, uint8_t address, uint8_t command, uint8_t *data, uint8_t length)
+{
+	return i2c_smbus(I2Cx, address, &command, 1, NULL, 0, data, length, 1);
+}
+
+int32_t i2cSmbus_processCall(I2C_TypeDef *I2Cx, uint8_t address, uint8_t command, uint16_t value)
+{
+	uint8_t head[3] = {command, (uint8_t)value, (uint8_t)(value >> 8)};
+	uint8_t answer[2];
+	int16_t res = i2c_smbus(I2Cx, address, head, 3, NULL, 0, answer, 2, 0);
+
+	if (res < 0)
+		return res;
+	return ((uint16_t)answer[1] << 8) | answer[0];
+}
+
+int16_t i2cSmbus_alertResponse(I2C_TypeDef *I2Cx)
+{
+	uint8_t address;
+	int32_t res = i2c_read(I2Cx, I2C_SMBUS_ARA, (char *)&address, 1, I2C_STOP);
+
+	if (res < 0)
+		return (int16_t)res;
+	return address & 0xFE;
+}
+
+void i2cSmbus_attachAlert(I2C_TypeDef *I2Cx, pin_t smba, uint8_t af, void (*cb)(void))
+{
+	I2CBus_t *bus = i2c_getBus(I2Cx);
 
-	// Wait transfer complete
-	timeout = FLAG_TIMEOUT;
-	while (LL_I2C_IsActiveFlag_TC(I2Cx) == RESET)
+	if (bus == NULL)
+		return;
+
+	NVIC_DisableIRQ(bus->irqn);
+	bus->alert = cb;
+	if (cb != NULL)
 	{
-		timeout--;
-		if (timeout == 0)
-		{
-			return -1;
-		}
+		gpio_modeAF(smba, AF_OD, PULLUP, af);
+		I2Cx->ICR = I2C_ICR_ALERTCF;
+		LL_I2C_EnableSMBusAlert(I2Cx);
 	}
+	else
+		LL_I2C_DisableSMBusAlert(I2Cx);
+	if (bus->head == NULL)
+		i2c_idle(bus);
+	NVIC_SetPriority(bus->irqn, 0);
+	NVIC_EnableIRQ(bus->irqn);
+}
 
-	__LIB_I2C_CLEAR_FLAG(I2Cx, I2C_ISR_TC);
+/** 
+ ===============================================================================
+              ##### Transaction queue #####
+ ===============================================================================
+ */
 
-	// If not repeated start, send stop.
-	if (stop)
+uint8_t i2c_submit(I2C_TypeDef *I2Cx, I2CTransfer_t *t)
+{
+	I2CBus_t *bus = i2c_getBus(I2Cx);
+
+	if (bus == NULL || (t->txLen == 0 && t->rxLen == 0))
+		return 0;
+
+	t->status = I2C_PENDING;
+	t->next = NULL;
+
+	NVIC_DisableIRQ(bus->irqn);
+	if (bus->head == NULL)
 	{
-		i2c_stop(I2Cx);
-		/* Wait until STOPF flag is set */
-		timeout = FLAG_TIMEOUT;
-		while (LL_I2C_IsActiveFlag_STOP(I2Cx) == RESET)
-		{
-			timeout--;
-			if (timeout == 0)
-			{
-				return -1;
-			}
-		}
-		/* Clear STOP Flag */
-		LL_I2C_ClearFlag_STOP(I2Cx);
+		bus->head = t;
+		bus->tail = t;
+		i2c_startNext(bus);
+	}
+	else
+	{
+		bus->tail->next = t;
+		bus->tail = t;
 	}
+	NVIC_SetPriority(bus->irqn, 0);
+	NVIC_EnableIRQ(bus->irqn);
+	return 1;
+}
+
+uint8_t i2c_busy(I2C_TypeDef *I2Cx)
+{
+	I2CBus_t *bus = i2c_getBus(I2Cx);
 
-	return count;
+	return (bus != NULL && bus->head != NULL);
 }
 
+/** 
+ ===============================================================================
+              ##### Interrupt #####
+ ===============================================================================
+ */
+
+void I2C1_IRQHandler(void)
+{
+	i2c_irq(&i2c_buses[0]);
+}
+
+#if defined(I2C2)
+void I2C2_IRQHandler(void)
+{
+	i2c_irq(&i2c_buses[1]);
+}
+#endif
+
+#if defined(I2C3)
+void I2C3_IRQHandler(void)
+{
+	i2c_irq(&i2c_buses[2]);
+}
+#endif
+
 /** 
  ===============================================================================
               ##### FUNCIONES SLAVE #####
  ===============================================================================
  */
 
-///* I2C Slave Init */
-//void I2C_Slave_Init(I2C_TypeDef* I2Cx, uint32_t freq, int SlaveAddr, pin_t scl, pin_t sda){
-//	I2C_Master_Init(I2Cx, freq, scl, sda);
-//	I2C_Slave_Mode(I2Cx, 1);
-//	I2C_Slave_Address(I2Cx, SlaveAddr);
-//}
-
-///* I2C Slave with Interrupt Init */
-//void I2C_SlaveWithInterrupt_Init(I2C_TypeDef* I2Cx, uint32_t freq, int SlaveAddr, pin_t scl, pin_t sda){
-//	NVIC_InitTypeDef i2c_slave_nvic;
-//	uint8_t _i2c_er_irq;
-//
-//	I2C_Master_Init(I2Cx, freq, scl, sda);
-//	I2C_Slave_Mode(I2Cx, 1);
-//	I2C_Slave_Address(I2Cx, SlaveAddr);
-//
-//	/* Configure the Priority Group to 1 bit */
-//  NVIC_PriorityGroupConfig(NVIC_PriorityGroup_2);
-//	if(I2Cx == I2C1){
-//		_i2c_er_irq = I2C1_ER_IRQn;
-//		i2c_slave_nvic.NVIC_IRQChannel = I2C1_EV_IRQn;
-//	}else if(I2Cx == I2C2){
-//		_i2c_er_irq = I2C2_ER_IRQn;
-//		i2c_slave_nvic.NVIC_IRQChannel = I2C2_EV_IRQn;
-//	}
-//	i2c_slave_nvic.NVIC_IRQChannelPreemptionPriority = 1;
-//  i2c_slave_nvic.NVIC_IRQChannelSubPriority = 0;
-//  i2c_slave_nvic.NVIC_IRQChannelCmd = ENABLE;
-//  NVIC_Init(&i2c_slave_nvic);
-//
-//	i2c_slave_nvic.NVIC_IRQChannel = _i2c_er_irq;
-//	NVIC_Init(&i2c_slave_nvic);
-//
-//	/* Enable Error Interrupt */
-//  I2C_ITConfig(I2Cx, (I2C_IT_ERR | I2C_IT_EVT | I2C_IT_BUF), ENABLE);
-//}
-
-///* I2C Set Slave Address */
-//void I2C_Slave_Address(I2C_TypeDef* I2Cx, uint32_t address){
-//    uint16_t tmpreg = 0;
-
-//    // Get the old register value
-//    tmpreg = I2Cx->OAR1;
-//    // Reset address bits
-//    tmpreg &= 0xFC00;
-//    // Set new address
-//    tmpreg |= (uint16_t)((uint16_t)address & (uint16_t)0x00FE); // 7-bits
-//    // Store the new register value
-//    I2Cx->OAR1 = tmpreg;
-//}
-
-///* I2C Set Slave Mode Enable o Disable */
-//void I2C_Slave_Mode(I2C_TypeDef* I2Cx, int enable_slave){
-//    if (enable_slave) {
-//        /* Enable Address Acknowledge */
-//        I2Cx->CR1 |= I2C_CR1_ACK;
-//    }
-//}
-
-///* Slave Receive Master Request */
-//int I2C_Slave_ReceiveMasterRequest(I2C_TypeDef* I2Cx){
-//    int retValue = I2C_NoData;
-
-//    if (I2C_GetFlagStatus(I2Cx, I2C_FLAG_BUSY) != RESET) {
-//        if (I2C_GetFlagStatus(I2Cx, I2C_FLAG_ADDR) != RESET) {
-//            if (I2C_GetFlagStatus(I2Cx, I2C_FLAG_TRA) != RESET)
-//                retValue = I2C_ReadAddressed;
-//            else
-//                retValue = I2C_WriteAddressed;
-
-//            I2C_ClearFlag(I2Cx, I2C_FLAG_ADDR);
-//        }
-//    }
-
-//    return (retValue);
-//}
-
-///* Slave Read */
-//int I2C_Slave_Read(I2C_TypeDef* I2Cx, char *data, int length){
-//    uint32_t Timeout;
-//    int size = 0;
-
-//    while (length > 0) {
-//        /* Wait until RXNE flag is set */
-//        // Wait until the byte is received
-//        Timeout = FLAG_TIMEOUT;
-//        while (I2C_GetFlagStatus(I2Cx, I2C_FLAG_RXNE) == RESET) {
-//            Timeout--;
-//            if (Timeout == 0) {
-//                return -1;
-//            }
-//        }
-
-//        /* Read data from DR */
-//        (*data++) = I2Cx->DR;
-//        length--;
-//        size++;
-
-//        if ((I2C_GetFlagStatus(I2Cx, I2C_FLAG_BTF) == SET) && (length != 0)) {
-//            /* Read data from DR */
-//            (*data++) = I2Cx->DR;
-//            length--;
-//            size++;
-//        }
-//    }
-
-//    /* Wait until STOP flag is set */
-//    Timeout = FLAG_TIMEOUT;
-//    while (I2C_GetFlagStatus(I2Cx, I2C_FLAG_STOPF) == RESET) {
-//        Timeout--;
-//        if (Timeout == 0) {
-//            return -1;
-//        }
-//    }
-
-//    /* Clear STOP flag */
-//    __I2C_CLEAR_STOPFLAG(I2Cx);
-
-//    /* Wait until BUSY flag is reset */
-//    Timeout = FLAG_TIMEOUT;
-//    while (I2C_GetFlagStatus(I2Cx, I2C_FLAG_BUSY) == SET) {
-//        Timeout--;
-//        if (Timeout == 0) {
-//            return -1;
-//        }
-//    }
-
-//    return size;
-//}
-
-///* Slave Write */
-//int I2C_Slave_Write(I2C_TypeDef* I2Cx, const char *data, int length){
-//    uint32_t Timeout;
-//    int size = 0;
-
-//    while (length > 0) {
-//        /* Wait until TXE flag is set */
-//        Timeout = FLAG_TIMEOUT;
-//        while (I2C_GetFlagStatus(I2Cx, I2C_FLAG_TXE) == RESET) {
-//            Timeout--;
-//            if (Timeout == 0) {
-//                return -1;
-//            }
-//        }
-
-//        /* Write data to DR */
-//        I2Cx->DR = (*data++);
-//        length--;
-//        size++;
-
-//        if ((I2C_GetFlagStatus(I2Cx, I2C_FLAG_BTF) == SET) && (length != 0)) {
-//            /* Write data to DR */
-//            I2Cx->DR = (*data++);
-//            length--;
-//            size++;
-//        }
-//    }
-
-//    /* Wait until AF flag is set */
-//    Timeout = FLAG_TIMEOUT;
-//    while (I2C_GetFlagStatus(I2Cx, I2C_FLAG_AF) == RESET) {
-//        Timeout--;
-//        if (Timeout == 0) {
-//            return -1;
-//        }
-//    }
-
-//    /* Clear AF flag */
-//    I2C_ClearFlag(I2Cx, I2C_FLAG_AF);
-
-//    /* Wait until BUSY flag is reset */
-//    Timeout = FLAG_TIMEOUT;
-//    while (I2C_GetFlagStatus(I2Cx, I2C_FLAG_BUSY) == SET) {
-//        Timeout--;
-//        if (Timeout == 0) {
-//            return -1;
-//        }
-//    }
-
-//    return size;
-//}
-
-///**
-// ===============================================================================
-//              ##### FUNCIONES SLAVE Interrupt Error #####
-// ===============================================================================
-// */
-
-//void I2C1_ER_IRQHandler(void){
-//  /* Read SR1 register to get I2C error */
-//  if ((I2C_ReadRegister(I2C1, I2C_Register_SR1) & 0xFF00) != 0x00)
-//  {
-//    /* Clears erreur flags */
-//    I2C1->SR1 &= 0x00FF;
-//  }
-//}
-
-//void I2C2_ER_IRQHandler(void){
-//  /* Read SR1 register to get I2C error */
-//  if ((I2C_ReadRegister(I2C2, I2C_Register_SR1) & 0xFF00) != 0x00)
-//  {
-//    /* Clears erreur flags */
-//    I2C2->SR1 &= 0x00FF;
-//  }
-//}
+void i2cSlave_init(I2C_TypeDef *I2Cx, uint32_t freq, uint8_t address, pin_t scl, pin_t sda, I2CSlaveMap_t *map)
+{
+	I2CBus_t *bus = i2c_getBus(I2Cx);
+
+	i2c_init(I2Cx, freq, scl, sda);
+	if (bus == NULL)
+		return;
+
+	bus->maps[0] = map;
+	bus->maps[1] = NULL;
+	bus->ptr[0] = 0;
+	bus->slot = 0;
+	bus->written = 0;
+
+	// A slave must stretch SCL: at the address match and if the interrupt comes too late
+	LL_I2C_Disable(I2Cx);
+	LL_I2C_EnableClockStretching(I2Cx);
+	I2Cx->OAR1 = I2C_OAR1_OA1EN | (address & 0xFE);
+	SET_BIT(I2Cx->CR1, I2C_SLAVE_IT);
+	LL_I2C_Enable(I2Cx);
+
+	NVIC_SetPriority(bus->irqn, 0);
+	NVIC_EnableIRQ(bus->irqn);
+}
+
+void i2cSlave_address2(I2C_TypeDef *I2Cx, uint8_t address, I2CSlaveMap_t *map)
+{
+	I2CBus_t *bus = i2c_getBus(I2Cx);
+
+	if (bus == NULL)
+		return;
+	CLEAR_BIT(I2Cx->OAR2, I2C_OAR2_OA2EN);
+	bus->maps[1] = map;
+	bus->ptr[1] = 0;
+	if (map != NULL)
+		I2Cx->OAR2 = I2C_OAR2_OA2EN | (address & 0xFE);
+}
+
+void i2cSlave_end(I2C_TypeDef *I2Cx)
+{
+	I2CBus_t *bus = i2c_getBus(I2Cx);
+
+	if (bus == NULL)
+		return;
+	i2cSlave_disableStopMode(I2Cx);
+	NVIC_DisableIRQ(bus->irqn);
+	CLEAR_BIT(I2Cx->CR1, I2C_SLAVE_IT);
+	I2Cx->OAR1 = 0;
+	I2Cx->OAR2 = 0;
+	bus->maps[0] = NULL;
+	bus->maps[1] = NULL;
+}
+
+uint8_t i2cSlave_enableStopMode(I2C_TypeDef *I2Cx, uint32_t speed_hz)
+{
+	I2CBus_t *bus = i2c_getBus(I2Cx);
+	uint32_t clkSel = 0;
+	uint32_t line = i2c_wakeupLine(I2Cx, &clkSel);
+	uint32_t timing = i2c_timing(HSI_VALUE, speed_hz);
+
+	if (line == 0 || bus == NULL || bus->maps[0] == NULL || timing == 0)
+		return 0;
+
+	LL_RCC_HSI_Enable();
+	while (LL_RCC_HSI_IsReady() != 1)
+	{
+	}
+
+	// TIMINGR can only be written with PE = 0, let a running transaction end first
+	i2c_waitIdle(I2Cx);
+	LL_I2C_Disable(I2Cx);
+	if (!LL_I2C_IsEnabledWakeUpFromStop(I2Cx))
+	{
+		bus->timing = I2Cx->TIMINGR;
+		bus->clkSel = RCC->CCIPR & clkSel;
+	}
+	// HSI16 runs the address recognition in Stop, 0b10 in the xSEL field selects it
+	MODIFY_REG(RCC->CCIPR, clkSel, clkSel & (clkSel << 1));
+	I2Cx->TIMINGR = timing;
+	// The address is acknowledged in Stop and SCL stretched until the interrupt clears ADDR
+	LL_I2C_EnableClockStretching(I2Cx);
+	LL_I2C_EnableWakeUpFromStop(I2Cx);
+	SET_BIT(EXTI->IMR, line);
+	LL_I2C_Enable(I2Cx);
+	return 1;
+}
+
+void i2cSlave_disableStopMode(I2C_TypeDef *I2Cx)
+{
+	I2CBus_t *bus = i2c_getBus(I2Cx);
+	uint32_t clkSel = 0;
+
+	if (bus == NULL || i2c_wakeupLine(I2Cx, &clkSel) == 0 || !LL_I2C_IsEnabledWakeUpFromStop(I2Cx))
+		return;
+
+	LL_I2C_Disable(I2Cx);
+	LL_I2C_DisableWakeUpFromStop(I2Cx);
+	MODIFY_REG(RCC->CCIPR, clkSel, bus->clkSel);
+	I2Cx->TIMINGR = bus->timing;
+	LL_I2C_Enable(I2Cx);
+}
@@ -0,0 +1,366 @@
+/**
+  ******************************************************************************
+  * @file    logstore.c
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   Append-only Log Store Functions
+  ******************************************************************************
+*/
+
+#include <stddef.h>
+#include "logstore.h"
+#include "eon_crc16.h"
+
+/**
+ ===============================================================================
+              ##### Definitions #####
+ ===============================================================================
+ */
+
+#define LOGSTORE_MAGIC 0x474F4C45UL // "ELOG"
+#define LOGSTORE_NO_SECTOR 0xFFFF
+#define LOGSTORE_ERASE_TIMEOUT 500 // ms, tSE is 400 ms at most
+#define LOGSTORE_ERASED_LEN 0xFFFF
+
+#define LOGSTORE_SECTOR_ADDR(__LS__, __S__) ((__LS__)->start + (uint32_t)(__S__)*SPIFLASH_SECTOR_SIZE)
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t seq;		 /*!< Sector sequence, grows by one each time a sector is started */
+	uint32_t first;	 /*!< Sequence of the first record of the sector */
+	uint32_t erases; /*!< Times this sector has been erased */
+	uint16_t crc;
+	uint16_t reserved;
+} LogSector_t;
+
+typedef struct
+{
+	uint16_t len;
+	uint16_t crc; /*!< Over len, seq and the data */
+	uint32_t seq;
+} LogRecord_t;
+
+/**
+ ===============================================================================
+              ##### Private Functions #####
+ ===============================================================================
+ */
+
+/* Sector sequence number in seq, 0 if the header is erased or torn */
+static int8_t logstore_sectorSeq(LogStore_t *ls, uint16_t sector, LogSector_t *hdr, uint32_t *seq)
+{
+	int8_t res = spiflash_read(ls->fl, LOGSTORE_SECTOR_ADDR(ls, sector), (uint8_t *)hdr, sizeof(LogSector_t));
+
+	*seq = 0;
+	if (res != SPIFLASH_OK)
+		return res;
+	if (hdr->magic == LOGSTORE_MAGIC && hdr->seq != 0 && hdr->crc == crc16_buffer(0xFFFF, (uint8_t *)hdr, 16))
+		*seq = hdr->seq;
+	return SPIFLASH_OK;
+}
+
+static uint16_t logstore_nextSector(LogStore_t *ls, uint16_t sector)
+{
+	return (uint16_t)((sector + 1U) % ls->sectors);
+}
+
+/* Last sector whose sequence is not older than the one of sector 0 */
+static int8_t logstore_findHead(LogStore_t *ls, uint16_t *head)
+{
+	LogSector_t hdr;
+	uint32_t first, seq;
+	uint16_t lo = 0, hi = ls->sectors - 1, mid;
+	int8_t res = logstore_sectorSeq(ls, 0, &hdr, &first);
+
+	if (res != SPIFLASH_OK)
+		return res;
+
+	// Sector 0 erased: empty log, or it was being started when the power failed
+	if (first == 0)
+	{
+		res = logstore_sectorSeq(ls, hi, &hdr, &seq);
+		*head = (seq != 0) ? hi : LOGSTORE_NO_SECTOR;
+		return res;
+	}
+
+	// Newer sectors from 0 up to the head, older or erased ones after it
+	while (lo < hi)
+	{
+		mid = (uint16_t)((lo + hi + 1U) / 2U);
+		res = logstore_sectorSeq(ls, mid, &hdr, &seq);
+		if (res != SPIFLASH_OK)
+			return res;
+		if (seq >= first)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	*head = lo;
+	return SPIFLASH_OK;
+}
+
+/* Erase the sector after the head and start it */
+static int8_t logstore_advance(LogStore_t *ls)
+{
+	uint16_t next = (ls->head == LOGSTORE_NO_SECTOR) ? 0 : logstore_nextSector(ls, ls->head);
+	uint32_t addr = LOGSTORE_SECTOR_ADDR(ls, next);
+	LogSector_t hdr;
+	uint32_t seq, erases = 0;
+	int8_t res;
+
+	res = logstore_sectorSeq(ls, next, &hdr, &seq);
+	if (res != SPIFLASH_OK)
+		return res;
+	if (seq != 0)
+		erases = hdr.erases;
+
+	res = spiflash_erase(ls->fl, addr, SPIFLASH_ERASE_4K);
+	if (res == SPIFLASH_OK)
+		res = spiflash_wait(ls->fl, LOGSTORE_ERASE_TIMEOUT);
+	if (res != SPIFLASH_OK)
+		return res;
+
+	hdr.magic = LOGSTORE_MAGIC;
+	hdr.seq = ls->sectorSeq + 1;
+	hdr.first = ls->recordSeq;
+	hdr.erases = erases + 1;
+	hdr.crc = crc16_buffer(0xFFFF, (uint8_t *)&hdr, 16);
+	hdr.reserved = 0xFFFF;
+	res = spiflash_write(ls->fl, addr, (const uint8_t *)&hdr, sizeof(hdr));
+	if (res != SPIFLASH_OK)
+		return res;
+
+	// The oldest records are gone, a cursor there moves to the new oldest sector. On an empty
+	// log the cursor waits for the first sector.
+	if (ls->readSector == next)
+	{
+		ls->readSector = logstore_nextSector(ls, next);
+		ls->readOffset = LOGSTORE_SECTOR_HEADER;
+	}
+	else if (ls->readSector == LOGSTORE_NO_SECTOR)
+	{
+		ls->readSector = next;
+		ls->readOffset = LOGSTORE_SECTOR_HEADER;
+	}
+	ls->head = next;
+	ls->offset = LOGSTORE_SECTOR_HEADER;
+	ls->sectorSeq = hdr.seq;
+	return SPIFLASH_OK;
+}
+
+/* Follow the records of the head sector up to the erased space */
+static int8_t logstore_scanHead(LogStore_t *ls, uint32_t first)
+{
+	uint32_t base = LOGSTORE_SECTOR_ADDR(ls, ls->head);
+	LogRecord_t rec;
+	int8_t res;
+
+	ls->offset = LOGSTORE_SECTOR_HEADER;
+	ls->recordSeq = first;
+	while (ls->offset + LOGSTORE_RECORD_HEADER <= SPIFLASH_SECTOR_SIZE)
+	{
+		res = spiflash_read(ls->fl, base + ls->offset, (uint8_t *)&rec, sizeof(rec));
+		if (res != SPIFLASH_OK)
+			return res;
+		if (rec.len == LOGSTORE_ERASED_LEN)
+			break;
+		// A torn length only has more bits set, so it never points inside its own record
+		if (ls->offset + LOGSTORE_RECORD_HEADER + (uint32_t)rec.len > SPIFLASH_SECTOR_SIZE)
+		{
+			ls->offset = SPIFLASH_SECTOR_SIZE;
+			break;
+		}
+		ls->offset += LOGSTORE_RECORD_HEADER + rec.len;
+		ls->recordSeq++;
+	}
+	return SPIFLASH_OK;
+}
+
+/**
+ ===============================================================================
+              ##### Public Functions #####
+ ===============================================================================
+ */
+
+int8_t logstore_init(LogStore_t *ls, SPIFlash_t *fl, uint32_t start, uint16_t sectors)
+{
+	LogSector_t hdr;
+	uint16_t head;
+	int8_t res;
+
+	ls->fl = fl;
+	ls->start = start;
+	ls->sectors = 0;
+	ls->head = LOGSTORE_NO_SECTOR;
+	ls->offset = SPIFLASH_SECTOR_SIZE;
+	ls->sectorSeq = 0;
+	ls->recordSeq = 1;
+
+	if (sectors < 2 || sectors == LOGSTORE_NO_SECTOR || (start & (SPIFLASH_SECTOR_SIZE - 1)) != 0 ||
+			fl->size == 0 || start >= fl->size || (uint32_t)sectors * SPIFLASH_SECTOR_SIZE > fl->size - start)
+		return SPIFLASH_ERROR;
+	ls->sectors = sectors;
+
+	// Nothing is written until the whole state is known, a failed read leaves the log unmounted
+	res = logstore_findHead(ls, &head);
+	if (res == SPIFLASH_OK && head != LOGSTORE_NO_SECTOR)
+	{
+		res = logstore_sectorSeq(ls, head, &hdr, &ls->sectorSeq);
+		ls->head = head;
+		if (res == SPIFLASH_OK)
+			res = logstore_scanHead(ls, hdr.first);
+	}
+	if (res == SPIFLASH_OK)
+		res = logstore_rewind(ls);
+	if (res != SPIFLASH_OK)
+	{
+		ls->head = LOGSTORE_NO_SECTOR;
+		ls->readSector = LOGSTORE_NO_SECTOR;
+		ls->sectors = 0;
+	}
+	return res;
+}
+
+int8_t logstore_format(LogStore_t *ls)
+{
+	uint16_t i;
+	int8_t res;
+
+	if (ls->sectors == 0)
+		return SPIFLASH_ERROR;
+	for (i = 0; i < ls->sectors; i++)
+	{
+		res = spiflash_erase(ls->fl, LOGSTORE_SECTOR_ADDR(ls, i), SPIFLASH_ERASE_4K);
+		if (res == SPIFLASH_OK)
+			res = spiflash_wait(ls->fl, LOGSTORE_ERASE_TIMEOUT);
+		if (res != SPIFLASH_OK)
+			return res;
+	}
+	ls->head = LOGSTORE_NO_SECTOR;
+	ls->offset = SPIFLASH_SECTOR_SIZE;
+	ls->sectorSeq = 0;
+	ls->recordSeq = 1;
+	return logstore_rewind(ls);
+}
+
+int8_t logstore_append(LogStore_t *ls, const void *data, uint16_t len)
+{
+	uint32_t addr;
+	LogRecord_t rec;
+	int8_t res;
+
+	if (ls->sectors == 0 || len == 0 || len > LOGSTORE_MAX_RECORD)
+		return SPIFLASH_ERROR;
+
+	if (ls->head == LOGSTORE_NO_SECTOR || ls->offset + LOGSTORE_RECORD_HEADER + len > SPIFLASH_SECTOR_SIZE)
+	{
+		res = logstore_advance(ls);
+		if (res != SPIFLASH_OK)
+			return res;
+	}
+
+	rec.len = len;
+	rec.seq = ls->recordSeq;
+	rec.crc = crc16_buffer(0xFFFF, (uint8_t *)&rec.len, sizeof(rec.len));
+	rec.crc = crc16_buffer(rec.crc, (uint8_t *)&rec.seq, sizeof(rec.seq));
+	rec.crc = crc16_buffer(rec.crc, (const uint8_t *)data, len);
+
+	// Header first: if the power fails in the data, the length still lets the scan skip it
+	addr = LOGSTORE_SECTOR_ADDR(ls, ls->head) + ls->offset;
+	ls->offset += LOGSTORE_RECORD_HEADER + len;
+	ls->recordSeq++;
+	res = spiflash_write(ls->fl, addr, (const uint8_t *)&rec, sizeof(rec));
+	if (res == SPIFLASH_OK)
+		res = spiflash_write(ls->fl, addr + LOGSTORE_RECORD_HEADER, (const uint8_t *)data, len);
+	return res;
+}
+
+int8_t logstore_rewind(LogStore_t *ls)
+{
+	LogSector_t hdr;
+	uint32_t seq;
+	uint16_t tail;
+	int8_t res;
+
+	ls->readOffset = LOGSTORE_SECTOR_HEADER;
+	ls->readSector = ls->head;
+	if (ls->head == LOGSTORE_NO_SECTOR)
+		return SPIFLASH_OK;
+
+	// Oldest sector: the one after the head once the ring wrapped (or the next if that one
+	// was being started at a power loss), sector 0 before that
+	tail = logstore_nextSector(ls, ls->head);
+	res = logstore_sectorSeq(ls, tail, &hdr, &seq);
+	if (res == SPIFLASH_OK && seq == 0)
+	{
+		tail = logstore_nextSector(ls, tail);
+		res = logstore_sectorSeq(ls, tail, &hdr, &seq);
+		if (seq == 0)
+			tail = 0;
+	}
+	if (res == SPIFLASH_OK)
+		ls->readSector = tail;
+	return res;
+}
+
+int32_t logstore_read(LogStore_t *ls, void *dst, uint16_t maxlen, uint32_t *seq)
+{
+	uint8_t chunk[32];
+	uint8_t *out = (uint8_t *)dst;
+	LogRecord_t rec;
+	uint32_t addr, limit;
+	uint16_t done, n, i, crc;
+	int8_t res;
+
+	while (ls->readSector != LOGSTORE_NO_SECTOR)
+	{
+		limit = (ls->readSector == ls->head) ? ls->offset : SPIFLASH_SECTOR_SIZE;
+		addr = LOGSTORE_SECTOR_ADDR(ls, ls->readSector) + ls->readOffset;
+
+		if (ls->readOffset + LOGSTORE_RECORD_HEADER <= limit)
+		{
+			res = spiflash_read(ls->fl, addr, (uint8_t *)&rec, sizeof(rec));
+			if (res != SPIFLASH_OK)
+				return res;
+		}
+		else
+			rec.len = LOGSTORE_ERASED_LEN;
+
+		// End of the sector
+		if (rec.len == LOGSTORE_ERASED_LEN || ls->readOffset + LOGSTORE_RECORD_HEADER + (uint32_t)rec.len > limit)
+		{
+			if (ls->readSector == ls->head)
+				return LOGSTORE_END;
+			ls->readSector = logstore_nextSector(ls, ls->readSector);
+			ls->readOffset = LOGSTORE_SECTOR_HEADER;
+			continue;
+		}
+
+		// Data through a small buffer, so the CRC covers all of it even when dst is shorter
+		crc = crc16_buffer(0xFFFF, (uint8_t *)&rec.len, sizeof(rec.len));
+		crc = crc16_buffer(crc, (uint8_t *)&rec.seq, sizeof(rec.seq));
+		addr += LOGSTORE_RECORD_HEADER;
+		for (done = 0; done < rec.len; done += n)
+		{
+			n = (uint16_t)(rec.len - done);
+			if (n > sizeof(chunk))
+				n = sizeof(chunk);
+			res = spiflash_read(ls->fl, addr + done, chunk, n);
+			if (res != SPIFLASH_OK)
+				return res;
+			crc = crc16_buffer(crc, chunk, n);
+			for (i = 0; i < n && done + i < maxlen; i++)
+				out[done + i] = chunk[i];
+		}
+		ls->readOffset += LOGSTORE_RECORD_HEADER + rec.len;
+
+		if (crc != rec.crc)
+			continue;
+		if (seq != NULL)
+			*seq = rec.seq;
+		return rec.len;
+	}
+	return LOGSTORE_END;
+}
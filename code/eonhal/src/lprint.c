@@ -1,134 +1,193 @@
-
 #include <stdint.h>
 #include "lprint.h"
+#include "eon_format.h"
+#include "System.h"
 
 #if defined(__CC_ARM)
 __weak void LPUTC(char c)
 {
 }
+__weak void LPUTS(const char *s, uint16_t len)
+{
+  while (len--)
+    LPUTC(*s++);
+}
 #elif defined(__GNUC__)
 void LPUTC(char c) __attribute__((weak));
+void __attribute__((weak)) LPUTS(const char *s, uint16_t len)
+{
+  while (len--)
+    LPUTC(*s++);
+}
 #endif
 
-static void _lprintIntBase(int64_t n, uint8_t base)
+void lprint(const char *format, ...)
 {
-  unsigned char buf[10];
-  uint16_t i = 0;
-  if (n == 0)
-  {
-    LPUTC('0');
-  }
+  char buf[FMT_BUFFER_SIZE + 2];
+  const char *run = format; // Start of the literal text not printed yet
+  uint8_t len;
+  va_list va;
+  va_start(va, format);
 
-  if (n < 0)
+  while (*format)
   {
-    LPUTC('-');
-    n = -n;
+    // Only {x}, {d}, {D} and {f} take an argument, anything else is printed as is
+    if (*format != '{' || format[1] == 0 || format[2] != '}')
+    {
+      format++;
+      continue;
+    }
+
+    if (format > run)
+      LPUTS(run, (uint16_t)(format - run));
+
+    const int w = va_arg(va, int);
+    len = 0;
+    switch (format[1])
+    {
+    case 'x':
+      buf[0] = '0';
+      buf[1] = 'x';
+      len = 2 + fmt_int(&buf[2], w, 16, 0);
+      break;
+    case 'd':
+      len = fmt_int(buf, w, 10, 0);
+      break;
+    case 'D':
+      len = fmt_int(buf, w, 10, 2);
+      break;
+    case 'f':
+      len = fmt_fixed(buf, w, 2);
+      break;
+    }
+    if (len > 0)
+      LPUTS(buf, len);
+
+    format += 3;
+    run = format;
   }
 
-  while (n > 0)
+  if (format > run)
+    LPUTS(run, (uint16_t)(format - run));
+
+  va_end(va);
+}
+
+/* Binary Log ----------------------------------------------------------------*/
+
+#if (LPRINT_LOG_BUFFER_SIZE & (LPRINT_LOG_BUFFER_SIZE - 1)) != 0
+#error "LPRINT_LOG_BUFFER_SIZE must be a power of two"
+#endif
+
+// Payload: id (3) + time (5) + arguments (5 each), then COBS adds 2 bytes
+#define LPRINT_LOG_RECORD_MAX (3 + 5 + 5 * LPRINT_LOG_MAX_ARGS + 2)
+
+static uint8_t log_buffer[LPRINT_LOG_BUFFER_SIZE];
+static volatile uint16_t log_head, log_tail;
+static uint32_t log_last;
+static uint32_t log_dropped;
+
+static uint8_t _lprintVarint(uint8_t *dst, uint32_t v)
+{
+  uint8_t n = 0;
+  while (v >= 0x80)
   {
-    buf[i++] = n % base;
-    n /= base;
+    dst[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
   }
+  dst[n++] = (uint8_t)v;
+  return n;
+}
 
-  for (; i > 0; i--)
+/* COBS: no 0x00 inside the record, so 0x00 marks its end and the host can resync */
+static uint8_t _lprintCobs(uint8_t *dst, const uint8_t *src, uint8_t len)
+{
+  uint8_t code_pos = 0;
+  uint8_t code = 1;
+  uint8_t out = 1;
+  uint8_t i;
+
+  for (i = 0; i < len; i++)
   {
-    LPUTC((char)(buf[i - 1] < 10 ? '0' + buf[i - 1] : 'A' + buf[i - 1] - 10));
+    if (src[i] == 0)
+    {
+      dst[code_pos] = code;
+      code_pos = out++;
+      code = 1;
+    }
+    else
+    {
+      dst[out++] = src[i];
+      code++;
+    }
   }
+  dst[code_pos] = code;
+  dst[out++] = 0;
+  return out;
 }
 
-static void _lprintNum(int64_t n, uint8_t isfloat)
+void lprint_log(uint8_t argc, uint16_t id, ...)
 {
-  uint32_t int_part;
-  uint8_t remainder;
+  uint8_t payload[LPRINT_LOG_RECORD_MAX];
+  uint8_t record[LPRINT_LOG_RECORD_MAX];
+  uint8_t len, n, i;
+  uint16_t head;
+  uint32_t now, primask;
+  int32_t a;
+  va_list va;
+
+  if (argc > LPRINT_LOG_MAX_ARGS)
+    argc = LPRINT_LOG_MAX_ARGS;
 
-  // Handle negative numbers
-  if (n < 0)
+  primask = __get_PRIMASK();
+  __disable_irq();
+
+  now = millis();
+  len = _lprintVarint(payload, id);
+  len += _lprintVarint(&payload[len], now - log_last);
+  va_start(va, id);
+  for (i = 0; i < argc; i++)
   {
-    LPUTC('-');
-    n = -n;
+    a = va_arg(va, int32_t);
+    len += _lprintVarint(&payload[len], ((uint32_t)a << 1) ^ (uint32_t)(a >> 31)); // zigzag
   }
+  va_end(va);
+  n = _lprintCobs(record, payload, len);
 
-  if (!isfloat)
+  head = log_head;
+  if ((uint16_t)(LPRINT_LOG_BUFFER_SIZE - (uint16_t)(head - log_tail)) < n)
+  {
+    log_dropped++;
+  }
+  else
   {
-    _lprintIntBase(n, 10);
-    return;
+    for (i = 0; i < n; i++)
+      log_buffer[(uint16_t)(head + i) & (LPRINT_LOG_BUFFER_SIZE - 1)] = record[i];
+    log_head = (uint16_t)(head + n);
+    log_last = now;
   }
 
-  remainder = n % 100;
-  int_part = (uint32_t)((n - remainder) / 100);
-  _lprintIntBase(int_part, 10);
-  LPUTC('.');
-  _lprintIntBase(remainder, 10);
+  __set_PRIMASK(primask);
 }
 
-void lprint(const char *format, ...)
+void lprint_flush(void)
 {
-  unsigned char buf[3] = {0, 0, 0};
-  uint8_t startArg = 0;
-  va_list va;
-  va_start(va, format);
+  uint16_t tail = log_tail;
+  uint16_t used, start, span;
 
-  while (*format)
+  while ((used = (uint16_t)(log_head - tail)) != 0)
   {
-
-    if ((*format != '{') && (startArg == 0))
-    {
-      LPUTC(*format);
-      format++;
-      continue;
-    }
-    else if (startArg == 0)
-    {
-      startArg = 1;
-    }
-
-    if (startArg > 0)
-    {
-      buf[startArg - 1] = *format;
-      startArg++;
-      if (startArg == 4)
-      {
-        if (buf[2] == '}')
-        {
-          const int w = va_arg(va, int);
-          switch (buf[1])
-          {
-          case 'x':
-            LPUTC('0');
-            LPUTC('x');
-            _lprintIntBase(w, 16);
-            break;
-          case 'd':
-            _lprintIntBase(w, 10);
-            break;
-          case 'D':
-            if (w < 10)
-            {
-              LPUTC('0');
-            }
-            _lprintIntBase(w, 10);
-            break;
-          case 'f':
-            _lprintNum(w, 1);
-            break;
-          }
-        }
-        else
-        {
-          LPUTC(buf[0]);
-          LPUTC(buf[1]);
-          LPUTC(buf[2]);
-        }
-        buf[0] = 0;
-        buf[1] = 0;
-        buf[2] = 0;
-        startArg = 0;
-      }
-    }
-
-    format++;
+    start = tail & (LPRINT_LOG_BUFFER_SIZE - 1);
+    span = LPRINT_LOG_BUFFER_SIZE - start;
+    if (span > used)
+      span = used;
+    LPUTS((const char *)&log_buffer[start], span);
+    tail = (uint16_t)(tail + span);
+    log_tail = tail;
   }
+}
 
-  va_end(va);
-}
\ No newline at end of file
+uint32_t lprint_dropped(void)
+{
+  return log_dropped;
+}
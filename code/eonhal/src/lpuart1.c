@@ -0,0 +1,51 @@
+/**
+  ******************************************************************************
+  * @file    lpuart1.c 
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   LPUART1 Port (buffers and interrupt, the driver is uart.c)
+  ******************************************************************************
+*/
+
+#include "lpuart1.h"
+
+#if defined(LPUART1)
+/** 
+ ===============================================================================
+              ##### Global Variables #####
+ ===============================================================================
+ */
+
+#if !UART_IS_POW2(LPUART1_RX_BUFFER_SIZE) || !UART_IS_POW2(LPUART1_TX_BUFFER_SIZE)
+#error "LPUART1_RX_BUFFER_SIZE and LPUART1_TX_BUFFER_SIZE must be powers of two"
+#endif
+
+static uint8_t urb_buffer[LPUART1_RX_BUFFER_SIZE];
+static uint8_t utx_buffer[LPUART1_TX_BUFFER_SIZE];
+
+UARTPort_t lpuart1_port = {
+		.USARTx = LPUART1,
+		.irqn = LPUART1_IRQn,
+		.clk_reg = &RCC->APB1ENR,
+		.clk_bit = RCC_APB1ENR_LPUART1EN,
+		.lpuart = 1,
+		.dma_req = LL_DMA_REQUEST_5,
+		.tx_dma_ch = LPUART1_TX_DMA_CHANNEL,
+		.rx_dma_ch = LPUART1_RX_DMA_CHANNEL,
+		.clk_sel = RCC_CCIPR_LPUART1SEL,
+		.rx = {.buffer = urb_buffer, .mask = LPUART1_RX_BUFFER_SIZE - 1},
+		.tx = {.buffer = utx_buffer, .mask = LPUART1_TX_BUFFER_SIZE - 1}};
+
+/** 
+ ===============================================================================
+              ##### Interrupt #####
+ ===============================================================================
+ */
+
+void LPUART1_IRQHandler(void)
+{
+	uart_irq(&lpuart1_port);
+}
+
+#endif
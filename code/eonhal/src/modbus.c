@@ -0,0 +1,342 @@
+/**
+  ******************************************************************************
+  * @file    modbus.c
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   Modbus RTU Functions
+  ******************************************************************************
+*/
+
+#include "modbus.h"
+#include "eon_crc16.h"
+#include "System.h"
+
+/**
+ ===============================================================================
+              ##### Definitions #####
+ ===============================================================================
+ */
+
+#define MODBUS_ADU_SIZE 256
+#define MODBUS_GET16(__P__) ((uint16_t)(((uint16_t)(__P__)[0] << 8) | (__P__)[1]))
+#define MODBUS_PUT16(__P__, __V__) \
+	do                               \
+	{                                \
+		(__P__)[0] = (uint8_t)((__V__) >> 8); \
+		(__P__)[1] = (uint8_t)(__V__);        \
+	} while (0)
+
+/**
+ ===============================================================================
+              ##### Global Static Variables #####
+ ===============================================================================
+ */
+
+static UARTPort_t *mb_port;
+static ModbusMap_t *mb_map;
+static uint8_t mb_address; // 0 when master
+static uint32_t mb_errors;
+
+static uint8_t mb_rx[MODBUS_ADU_SIZE];
+static uint8_t mb_tx[MODBUS_ADU_SIZE];
+
+// Master request waiting for its response
+static volatile int8_t mb_status = MODBUS_OK;
+static uint8_t mb_slave;
+static uint8_t mb_function;
+static uint16_t mb_count;
+static uint16_t *mb_dst;
+
+/**
+ ===============================================================================
+              ##### Private Functions #####
+ ===============================================================================
+ */
+
+/* Append the CRC and queue the ADU for the TX DMA, never blocks (called from interrupt) */
+static uint8_t modbus_send(uint16_t len)
+{
+	UARTTxQueue_t *q = &mb_port->tx;
+	uint16_t crc = crc16_buffer(0xFFFF, mb_tx, len);
+	uint16_t room = (uint16_t)(q->mask + 1U - (uint16_t)(q->head - q->tail));
+
+	mb_tx[len++] = (uint8_t)crc;
+	mb_tx[len++] = (uint8_t)(crc >> 8);
+	if (len > room)
+		return 0;
+	return uart_writeAsync(mb_port, mb_tx, len) == len;
+}
+
+static void modbus_exception(uint8_t function, uint8_t code)
+{
+	mb_tx[0] = mb_address;
+	mb_tx[1] = function | 0x80;
+	mb_tx[2] = code;
+	modbus_send(3);
+}
+
+/* len is the ADU without its CRC */
+static void modbus_slaveFrame(uint16_t len)
+{
+	uint8_t function = mb_rx[1];
+	uint16_t address = MODBUS_GET16(&mb_rx[2]);
+	uint16_t count = MODBUS_GET16(&mb_rx[4]);
+	uint8_t broadcast = (mb_rx[0] == 0);
+	const uint16_t *regs;
+	uint16_t total, i;
+
+	if (mb_rx[0] != mb_address && !broadcast)
+		return;
+
+	switch (function)
+	{
+	case MODBUS_READ_HOLDING:
+	case MODBUS_READ_INPUT:
+		if (broadcast)
+			return;
+		if (len != 6 || count == 0 || count > 125)
+		{
+			modbus_exception(function, MODBUS_EX_ILLEGAL_VALUE);
+			return;
+		}
+		regs = (function == MODBUS_READ_HOLDING) ? mb_map->holding : mb_map->input;
+		total = (function == MODBUS_READ_HOLDING) ? mb_map->holdingCount : mb_map->inputCount;
+		if (regs == 0 || (uint32_t)address + count > total)
+		{
+			modbus_exception(function, MODBUS_EX_ILLEGAL_ADDRESS);
+			return;
+		}
+		mb_tx[0] = mb_address;
+		mb_tx[1] = function;
+		mb_tx[2] = (uint8_t)(count * 2);
+		for (i = 0; i < count; i++)
+			MODBUS_PUT16(&mb_tx[3 + 2 * i], regs[address + i]);
+		if (!modbus_send(3 + 2 * count))
+			modbus_exception(function, MODBUS_EX_DEVICE_FAILURE);
+		return;
+
+	case MODBUS_WRITE_SINGLE:
+		if (len != 6)
+			return;
+		if (mb_map->holding == 0 || address >= mb_map->holdingCount)
+		{
+			if (!broadcast)
+				modbus_exception(function, MODBUS_EX_ILLEGAL_ADDRESS);
+			return;
+		}
+		mb_map->holding[address] = count; // Value field
+		if (mb_map->onWrite != 0)
+			mb_map->onWrite(address, 1);
+		if (broadcast)
+			return;
+		// The response echoes the request
+		for (i = 0; i < 6; i++)
+			mb_tx[i] = mb_rx[i];
+		modbus_send(6);
+		return;
+
+	case MODBUS_WRITE_MULTIPLE:
+		if (count == 0 || count > 123 || mb_rx[6] != count * 2 || len != 7 + count * 2)
+		{
+			if (!broadcast)
+				modbus_exception(function, MODBUS_EX_ILLEGAL_VALUE);
+			return;
+		}
+		if (mb_map->holding == 0 || (uint32_t)address + count > mb_map->holdingCount)
+		{
+			if (!broadcast)
+				modbus_exception(function, MODBUS_EX_ILLEGAL_ADDRESS);
+			return;
+		}
+		for (i = 0; i < count; i++)
+			mb_map->holding[address + i] = MODBUS_GET16(&mb_rx[7 + 2 * i]);
+		if (mb_map->onWrite != 0)
+			mb_map->onWrite(address, count);
+		if (broadcast)
+			return;
+		for (i = 0; i < 6; i++)
+			mb_tx[i] = mb_rx[i];
+		modbus_send(6);
+		return;
+
+	default:
+		if (!broadcast)
+			modbus_exception(function, MODBUS_EX_ILLEGAL_FUNCTION);
+		return;
+	}
+}
+
+static void modbus_masterFrame(uint16_t len)
+{
+	uint16_t i;
+
+	if (mb_status != MODBUS_BUSY || mb_rx[0] != mb_slave)
+		return;
+
+	if (mb_rx[1] == (mb_function | 0x80))
+	{
+		mb_status = (int8_t)mb_rx[2];
+		return;
+	}
+	if (mb_rx[1] != mb_function)
+		return;
+
+	if (mb_function == MODBUS_READ_HOLDING || mb_function == MODBUS_READ_INPUT)
+	{
+		if (mb_rx[2] != mb_count * 2 || len != 3 + mb_count * 2)
+			return;
+		for (i = 0; i < mb_count; i++)
+			mb_dst[i] = MODBUS_GET16(&mb_rx[3 + 2 * i]);
+	}
+	mb_status = MODBUS_OK;
+}
+
+/* Receiver timeout: a whole ADU is in the RX buffer (called from interrupt) */
+static void modbus_onFrame(void)
+{
+	uint16_t len;
+
+	while (uart_framesAvailable(mb_port))
+	{
+		len = uart_readFrame(mb_port, mb_rx, sizeof(mb_rx), 0);
+		// CRC over the whole ADU, CRC included, is 0 when it is right
+		if (len < 4 || crc16_buffer(0xFFFF, mb_rx, len) != 0)
+		{
+			mb_errors++;
+			continue;
+		}
+		len -= 2;
+		if (mb_address != 0)
+			modbus_slaveFrame(len);
+		else
+			modbus_masterFrame(len);
+	}
+}
+
+static void modbus_begin(UARTPort_t *port)
+{
+	// t3.5 in bit times, fixed to 1750 us above 19200 baud
+	uint32_t gap = (port->baudrate <= 19200) ? 35 : (port->baudrate * 7 + 3999) / 4000;
+
+	mb_port = port;
+	mb_errors = 0;
+	mb_status = MODBUS_OK;
+	uart_enableRxDMA(port);
+	uart_enableFraming(port, UART_NO_TERMINATOR, gap);
+	uart_attachRxFrame(port, modbus_onFrame);
+}
+
+/* Send a master request and wait until the ISR stores the result */
+static int8_t modbus_transaction(uint16_t len, uint32_t timeout)
+{
+	uint32_t start;
+
+	if (mb_status == MODBUS_BUSY)
+		return MODBUS_BUSY;
+
+	mb_status = MODBUS_BUSY;
+	if (!modbus_send(len))
+	{
+		mb_status = MODBUS_OK;
+		return MODBUS_BUSY;
+	}
+	if (mb_slave == 0)
+	{
+		mb_status = MODBUS_OK;
+		return MODBUS_OK; // Broadcasts have no response
+	}
+
+	start = millis();
+	while (mb_status == MODBUS_BUSY)
+	{
+		if (millis() - start >= timeout)
+		{
+			mb_status = MODBUS_OK;
+			return MODBUS_TIMEOUT;
+		}
+		__WFI();
+	}
+	return mb_status;
+}
+
+/**
+ ===============================================================================
+              ##### Public Functions #####
+ ===============================================================================
+ */
+
+void modbus_initSlave(UARTPort_t *port, uint8_t address, ModbusMap_t *map)
+{
+	mb_address = address;
+	mb_map = map;
+	modbus_begin(port);
+}
+
+void modbus_initMaster(UARTPort_t *port)
+{
+	mb_address = 0;
+	mb_map = 0;
+	modbus_begin(port);
+}
+
+void modbus_end(void)
+{
+	if (mb_port == 0)
+		return;
+	uart_attachRxFrame(mb_port, 0);
+	uart_disableFraming(mb_port);
+	mb_port = 0;
+}
+
+int8_t modbus_readRegisters(uint8_t slave, uint8_t function, uint16_t address, uint16_t count, uint16_t *dst, uint32_t timeout)
+{
+	if (count == 0 || count > 125)
+		return MODBUS_EX_ILLEGAL_VALUE;
+
+	mb_slave = slave;
+	mb_function = function;
+	mb_count = count;
+	mb_dst = dst;
+
+	mb_tx[0] = slave;
+	mb_tx[1] = function;
+	MODBUS_PUT16(&mb_tx[2], address);
+	MODBUS_PUT16(&mb_tx[4], count);
+	return modbus_transaction(6, timeout);
+}
+
+int8_t modbus_writeRegisters(uint8_t slave, uint16_t address, uint16_t count, const uint16_t *src, uint32_t timeout)
+{
+	uint16_t i;
+
+	if (count == 0 || count > 123)
+		return MODBUS_EX_ILLEGAL_VALUE;
+
+	mb_slave = slave;
+	mb_count = count;
+	mb_dst = 0;
+
+	mb_tx[0] = slave;
+	MODBUS_PUT16(&mb_tx[2], address);
+	if (count == 1)
+	{
+		mb_function = MODBUS_WRITE_SINGLE;
+		mb_tx[1] = MODBUS_WRITE_SINGLE;
+		MODBUS_PUT16(&mb_tx[4], src[0]);
+		return modbus_transaction(6, timeout);
+	}
+
+	mb_function = MODBUS_WRITE_MULTIPLE;
+	mb_tx[1] = MODBUS_WRITE_MULTIPLE;
+	MODBUS_PUT16(&mb_tx[4], count);
+	mb_tx[6] = (uint8_t)(count * 2);
+	for (i = 0; i < count; i++)
+		MODBUS_PUT16(&mb_tx[7 + 2 * i], src[i]);
+	return modbus_transaction(7 + 2 * count, timeout);
+}
+
+uint32_t modbus_errorCount(void)
+{
+	return mb_errors;
+}
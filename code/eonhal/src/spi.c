@@ -2,14 +2,18 @@
   ******************************************************************************
   * @file    spi.c 
   * @authors Pablo Fuentes, Joseph Peñafiel
-	* @version V1.0.0
+	* @version V1.0.1
   * @date    2019
   * @brief   SPI Functions
   ******************************************************************************
 */
 
+#include <stddef.h>
 #include "spi.h"
 #include "gpio.h"
+#include "dma.h"
+#include "pinmap_impl.h"
+#include "exti.h"
 #include "stm32l0xx_ll_rcc.h"
 #include "stm32l0xx_ll_bus.h"
 #include "stm32l0xx_ll_spi.h"
@@ -17,6 +21,91 @@
 #define SPI_PHASE_MSK SPI_CR1_CPHA_Msk
 #define SPI_POL_MSK SPI_CR1_CPOL_Msk
 
+/** 
+ ===============================================================================
+              ##### Global Static Variables #####
+ ===============================================================================
+ */
+
+typedef struct
+{
+	SPI_TypeDef *SPIx;
+	uint32_t rx_ch;
+	uint32_t tx_ch;
+	uint32_t dma_req;
+	spiCallback_t cb;
+	void *ctx;
+	volatile uint8_t busy;
+} SPIAsync_t;
+
+static SPIAsync_t spi_async[] = {
+		{SPI1, SPI1_RX_DMA_CHANNEL, SPI1_TX_DMA_CHANNEL, LL_DMA_REQUEST_1, NULL, NULL, 0},
+#if defined(SPI2)
+		{SPI2, SPI2_RX_DMA_CHANNEL, SPI2_TX_DMA_CHANNEL, LL_DMA_REQUEST_2, NULL, NULL, 0},
+#endif
+};
+
+static const uint8_t spi_filler = SPI_FILLER_BYTE;
+static uint8_t spi_discard;
+
+/** 
+ ===============================================================================
+              ##### Private Functions #####
+ ===============================================================================
+ */
+
+/* Frame width, CR1 is only written (with the SPI off, as DFF requires) when it changes */
+static void spi_setWidth(SPI_TypeDef *SPIx, uint32_t width)
+{
+	uint32_t cr1 = SPIx->CR1;
+
+	if ((cr1 & SPI_CR1_DFF) == width)
+		return;
+	cr1 = (cr1 & ~SPI_CR1_DFF) | width;
+	SPIx->CR1 = cr1 & ~SPI_CR1_SPE;
+	SPIx->CR1 = cr1;
+}
+
+static SPIAsync_t *spi_getAsync(SPI_TypeDef *SPIx)
+{
+	uint8_t i;
+
+	for (i = 0; i < sizeof(spi_async) / sizeof(spi_async[0]); i++)
+	{
+		if (spi_async[i].SPIx == SPIx)
+			return &spi_async[i];
+	}
+	return NULL;
+}
+
+/* Take both channels, the RX one reports the end of the transfer */
+static uint8_t spi_attachDMA(SPIAsync_t *as, dmaCallback_t cb)
+{
+	if (!dma_attach(as->rx_ch, as->dma_req, cb, as))
+		return 0;
+	if (!dma_attach(as->tx_ch, as->dma_req, NULL, NULL))
+	{
+		dma_detach(as->rx_ch);
+		return 0;
+	}
+	return 1;
+}
+
+/* RX channel event: the last byte has been received, so the bus is idle */
+static void spi_dmaEvent(void *ctx, uint8_t events)
+{
+	SPIAsync_t *as = (SPIAsync_t *)ctx;
+
+	if ((events & (DMA_EVT_TC | DMA_EVT_TE)) == 0)
+		return;
+	CLEAR_BIT(as->SPIx->CR2, SPI_CR2_TXDMAEN | SPI_CR2_RXDMAEN);
+	dma_detach(as->tx_ch);
+	dma_detach(as->rx_ch);
+	as->busy = 0;
+	if (as->cb != NULL)
+		as->cb(as->ctx);
+}
+
 /** 
  ===============================================================================
               ##### FUNCIONES #####
@@ -147,6 +236,53 @@ void spi_setDataMode(SPI_TypeDef *SPIx, uint32_t SPI_DataMode)
 	LL_SPI_SetClockPhase(SPIx, (SPI_DataMode & SPI_PHASE_MSK));
 }
 
+/** 
+ ===============================================================================
+              ##### Devices #####
+ ===============================================================================
+ */
+
+void spi_initDevice(SPIDevice_t *dev, SPI_TypeDef *SPIx, uint32_t freq_hz, uint32_t datamode, uint32_t width, uint32_t bitorder, pin_t cs)
+{
+	dev->SPIx = SPIx;
+	dev->cr1 = LL_SPI_MODE_MASTER | LL_SPI_NSS_SOFT | LL_SPI_FULL_DUPLEX | SPI_CR1_SPE |
+						 spi_calculatePrescaler(SPIx, freq_hz) | (datamode & (SPI_POL_MSK | SPI_PHASE_MSK)) |
+						 (width & SPI_CR1_DFF) | (bitorder & SPI_CR1_LSBFIRST);
+	dev->cs_port = NULL;
+	dev->cs_mask = 0;
+
+	if (cs != NOPIN)
+	{
+		STM32_Pin_Info *pin_map = HAL_Pin_Map();
+		gpio_write(cs, HIGH);
+		gpio_mode(cs, OUTPUT_PP, NOPULL, SPEED_HIGH);
+		dev->cs_port = pin_map[cs].GPIOx;
+		dev->cs_mask = pin_map[cs].pin;
+	}
+}
+
+void spi_begin(SPIDevice_t *dev)
+{
+	SPI_TypeDef *SPIx = dev->SPIx;
+
+	// Mode, prescaler and width may only change with the SPI off
+	if (SPIx->CR1 != dev->cr1)
+	{
+		SPIx->CR1 = dev->cr1 & ~SPI_CR1_SPE;
+		SPIx->CR1 = dev->cr1;
+	}
+	if (dev->cs_port != NULL)
+		dev->cs_port->BRR = dev->cs_mask;
+}
+
+void spi_end(SPIDevice_t *dev)
+{
+	while (LL_SPI_IsActiveFlag_BSY(dev->SPIx))
+		;
+	if (dev->cs_port != NULL)
+		dev->cs_port->BSRR = dev->cs_mask;
+}
+
 /** 
  ===============================================================================
               ##### 8 Bits #####
@@ -163,7 +299,7 @@ uint8_t spi_write8(SPI_TypeDef *SPIx, uint8_t data)
 {
 
 	/* SPI - 8 bits data */
-	LL_SPI_SetDataWidth(SPIx, LL_SPI_DATAWIDTH_8BIT);
+	spi_setWidth(SPIx, LL_SPI_DATAWIDTH_8BIT);
 
 	while (LL_SPI_IsActiveFlag_TXE(SPIx) == RESET)
 		;
@@ -187,8 +323,14 @@ uint8_t spi_write8(SPI_TypeDef *SPIx, uint8_t data)
 void spi_writeMultiple8(SPI_TypeDef *SPIx, const uint8_t *pTData, uint8_t *pRData, uint8_t pSize)
 {
 	uint8_t dummy = 0;
+
+	if (pRData == NULL)
+	{
+		spi_stream8(SPIx, pTData, pSize);
+		return;
+	}
 	/* SPI - 8 bits data */
-	LL_SPI_SetDataWidth(SPIx, LL_SPI_DATAWIDTH_8BIT);
+	spi_setWidth(SPIx, LL_SPI_DATAWIDTH_8BIT);
 
 	while (pSize--)
 	{
@@ -231,7 +373,7 @@ uint8_t spi_read8(SPI_TypeDef *SPIx)
 void spi_readMultiple8(SPI_TypeDef *SPIx, uint8_t *pRData, uint8_t pSize)
 {
 	/* SPI - 8 bits data */
-	LL_SPI_SetDataWidth(SPIx, LL_SPI_DATAWIDTH_8BIT);
+	spi_setWidth(SPIx, LL_SPI_DATAWIDTH_8BIT);
 
 	while (pSize--)
 	{
@@ -263,7 +405,7 @@ uint16_t spi_write16(SPI_TypeDef *SPIx, uint16_t data)
 {
 
 	/* SPI - 16 bits data */
-	LL_SPI_SetDataWidth(SPIx, LL_SPI_DATAWIDTH_16BIT);
+	spi_setWidth(SPIx, LL_SPI_DATAWIDTH_16BIT);
 
 	while (LL_SPI_IsActiveFlag_TXE(SPIx) == RESET)
 		;
@@ -287,8 +429,14 @@ uint16_t spi_write16(SPI_TypeDef *SPIx, uint16_t data)
 void spi_writeMultiple16(SPI_TypeDef *SPIx, const uint16_t *pTData, uint16_t *pRData, uint8_t pSize)
 {
 	uint16_t dummy = 0;
+
+	if (pRData == NULL)
+	{
+		spi_stream16(SPIx, pTData, pSize);
+		return;
+	}
 	/* SPI - 16 bits data */
-	LL_SPI_SetDataWidth(SPIx, LL_SPI_DATAWIDTH_16BIT);
+	spi_setWidth(SPIx, LL_SPI_DATAWIDTH_16BIT);
 
 	while (pSize--)
 	{
@@ -330,7 +478,7 @@ uint16_t spi_read16(SPI_TypeDef *SPIx)
 void spi_readMultiple16(SPI_TypeDef *SPIx, uint16_t *pRData, uint8_t pSize)
 {
 	/* SPI - 16 bits data */
-	LL_SPI_SetDataWidth(SPIx, LL_SPI_DATAWIDTH_16BIT);
+	spi_setWidth(SPIx, LL_SPI_DATAWIDTH_16BIT);
 
 	while (pSize--)
 	{
@@ -348,135 +496,331 @@ void spi_readMultiple16(SPI_TypeDef *SPIx, uint16_t *pRData, uint8_t pSize)
 
 /** 
  ===============================================================================
-              ##### SPI Slave Functions #####
+              ##### Write Only #####
  ===============================================================================
  */
 
-/*#define SSPI_BUFFER_SIZE 64 // Slave SPI Buffer length
-static unsigned char _rx_buffer_sspi[SSPI_BUFFER_SIZE];
-volatile static uint8_t _rx_buffer_tail_sspi = 0;
-volatile static uint8_t _rx_buffer_head_sspi = 0;
+/* End of a write-only stream: wait until the last frame is out, then drop RX data and OVR once */
+static void spi_streamEnd(SPI_TypeDef *SPIx)
+{
+	uint16_t dummy;
+
+	while (LL_SPI_IsActiveFlag_TXE(SPIx) == RESET)
+		;
+	while (LL_SPI_IsActiveFlag_BSY(SPIx))
+		;
+	dummy = (uint16_t)SPIx->DR;
+	dummy = (uint16_t)SPIx->SR;
+	UNUSED(dummy);
+}
 
-__STATIC_INLINE void sspi_rx_buffer_insert(uint8_t element)
+void spi_stream8(SPI_TypeDef *SPIx, const uint8_t *pTData, uint32_t pSize)
 {
-	uint8_t i = (uint8_t)(_rx_buffer_head_sspi + 1) % SSPI_BUFFER_SIZE;
-	if (i != _rx_buffer_tail_sspi)
+	spi_setWidth(SPIx, LL_SPI_DATAWIDTH_8BIT);
+
+	// Only TXE is waited, so DR is loaded while the previous byte shifts out
+	while (pSize--)
 	{
-		_rx_buffer_sspi[_rx_buffer_head_sspi] = element;
-		_rx_buffer_head_sspi = i;
+		while (LL_SPI_IsActiveFlag_TXE(SPIx) == RESET)
+			;
+		*(__IO uint8_t *)&SPIx->DR = *pTData++;
 	}
+	spi_streamEnd(SPIx);
 }
 
-void SPISlave_init(SPI_TypeDef *SPIx, pin_t sck, pin_t miso, pin_t mosi, pin_t ssel, uint32_t datamode)
+void spi_stream16(SPI_TypeDef *SPIx, const uint16_t *pTData, uint32_t pSize)
 {
-	LL_SPI_InitTypeDef sspi_init;
-	IRQn_Type irq;
+	spi_setWidth(SPIx, LL_SPI_DATAWIDTH_16BIT);
 
-	if (SPIx == SPI1)
+	while (pSize--)
 	{
-		SET_BIT(RCC->APB2ENR, RCC_APB2ENR_SPI1EN);
-		irq = SPI1_IRQn;
+		while (LL_SPI_IsActiveFlag_TXE(SPIx) == RESET)
+			;
+		SPIx->DR = *pTData++;
 	}
+	spi_streamEnd(SPIx);
+}
+
+/** 
+ ===============================================================================
+              ##### DMA #####
+ ===============================================================================
+ */
+
+uint8_t spi_transferAsync(SPI_TypeDef *SPIx, const uint8_t *tx, uint8_t *rx, uint16_t len, spiCallback_t cb, void *ctx)
+{
+	SPIAsync_t *as = spi_getAsync(SPIx);
+	uint8_t dummy;
+
+	if (as == NULL || as->busy || len == 0)
+		return 0;
+	if (!spi_attachDMA(as, spi_dmaEvent))
+		return 0;
+
+	as->busy = 1;
+	as->cb = cb;
+	as->ctx = ctx;
+
+	/* SPI - 8 bits data, drop a stale byte and the overrun flag */
+	spi_setWidth(SPIx, LL_SPI_DATAWIDTH_8BIT);
+	while (LL_SPI_IsActiveFlag_RXNE(SPIx))
+		dummy = (uint8_t)SPIx->DR;
+	dummy = (uint8_t)SPIx->SR;
+	UNUSED(dummy);
+
+	// RX above TX, so the received byte is always read before the next one arrives
+	LL_DMA_ConfigTransfer(DMA1, as->rx_ch,
+												LL_DMA_DIRECTION_PERIPH_TO_MEMORY | LL_DMA_PRIORITY_HIGH | LL_DMA_MODE_NORMAL |
+														LL_DMA_PERIPH_NOINCREMENT | (rx != NULL ? LL_DMA_MEMORY_INCREMENT : LL_DMA_MEMORY_NOINCREMENT) |
+														LL_DMA_PDATAALIGN_BYTE | LL_DMA_MDATAALIGN_BYTE);
+	LL_DMA_SetPeriphAddress(DMA1, as->rx_ch, LL_SPI_DMA_GetRegAddr(SPIx));
+	LL_DMA_SetMemoryAddress(DMA1, as->rx_ch, (uint32_t)(rx != NULL ? rx : &spi_discard));
+	LL_DMA_SetDataLength(DMA1, as->rx_ch, len);
+	LL_DMA_EnableIT_TC(DMA1, as->rx_ch);
+	LL_DMA_EnableIT_TE(DMA1, as->rx_ch);
+
+	LL_DMA_ConfigTransfer(DMA1, as->tx_ch,
+												LL_DMA_DIRECTION_MEMORY_TO_PERIPH | LL_DMA_PRIORITY_MEDIUM | LL_DMA_MODE_NORMAL |
+														LL_DMA_PERIPH_NOINCREMENT | (tx != NULL ? LL_DMA_MEMORY_INCREMENT : LL_DMA_MEMORY_NOINCREMENT) |
+														LL_DMA_PDATAALIGN_BYTE | LL_DMA_MDATAALIGN_BYTE);
+	LL_DMA_SetPeriphAddress(DMA1, as->tx_ch, LL_SPI_DMA_GetRegAddr(SPIx));
+	LL_DMA_SetMemoryAddress(DMA1, as->tx_ch, (uint32_t)(tx != NULL ? tx : &spi_filler));
+	LL_DMA_SetDataLength(DMA1, as->tx_ch, len);
+
+	// RM0377: RX request first, then the channels, TX request last
+	LL_SPI_EnableDMAReq_RX(SPIx);
+	LL_DMA_EnableChannel(DMA1, as->rx_ch);
+	LL_DMA_EnableChannel(DMA1, as->tx_ch);
+	LL_SPI_EnableDMAReq_TX(SPIx);
+	return 1;
+}
+
+uint8_t spi_transferBusy(SPI_TypeDef *SPIx)
+{
+	SPIAsync_t *as = spi_getAsync(SPIx);
+
+	return (as != NULL) ? as->busy : 0;
+}
+
+/** 
+ ===============================================================================
+              ##### SPI Slave Functions #####
+ ===============================================================================
+ */
+
+static SPIAsync_t *sspi_dma; // Channels of the slave SPI, marked busy for spi_transferAsync()
+static uint32_t sspi_cr1;
+static pin_t sspi_nss = NOPIN;
+static spiSlaveCallback_t sspi_callback;
+
+// RX: the DMA fills one buffer while the other holds the last transaction
+static uint8_t sspi_rx[2][SPI_SLAVE_BUFFER_SIZE];
+static uint8_t sspi_rxActive;
+static volatile uint16_t sspi_rxLen;
+static volatile uint16_t sspi_rxTail;
+
+// TX: the DMA sends one buffer while the next response is written in the other
+static uint8_t sspi_tx[2][SPI_SLAVE_BUFFER_SIZE];
+static uint8_t sspi_txActive;
+static volatile uint8_t sspi_txPending;
+static uint16_t sspi_txFill;
+
+/* Reset the SPI (the only way to drop the byte already in DR) and rearm both channels */
+static void sspi_arm(void)
+{
+	SPI_TypeDef *SPIx = sspi_dma->SPIx;
+
+	LL_DMA_DisableChannel(DMA1, sspi_dma->rx_ch);
+	LL_DMA_DisableChannel(DMA1, sspi_dma->tx_ch);
+
 #if defined(SPI2)
 	if (SPIx == SPI2)
 	{
-		SET_BIT(RCC->APB1ENR, RCC_APB1ENR_SPI2EN);
-		irq = SPI2_IRQn;
+		SET_BIT(RCC->APB1RSTR, RCC_APB1RSTR_SPI2RST);
+		CLEAR_BIT(RCC->APB1RSTR, RCC_APB1RSTR_SPI2RST);
 	}
+	else
 #endif
+	{
+		SET_BIT(RCC->APB2RSTR, RCC_APB2RSTR_SPI1RST);
+		CLEAR_BIT(RCC->APB2RSTR, RCC_APB2RSTR_SPI1RST);
+	}
+	SPIx->CR1 = sspi_cr1;
+
+	LL_DMA_SetMemoryAddress(DMA1, sspi_dma->rx_ch, (uint32_t)sspi_rx[sspi_rxActive]);
+	LL_DMA_SetDataLength(DMA1, sspi_dma->rx_ch, SPI_SLAVE_BUFFER_SIZE);
+	LL_DMA_SetMemoryAddress(DMA1, sspi_dma->tx_ch, (uint32_t)sspi_tx[sspi_txActive]);
+	LL_DMA_SetDataLength(DMA1, sspi_dma->tx_ch, SPI_SLAVE_BUFFER_SIZE);
+
+	// The first TX request loads DR before the host lowers NSS
+	LL_SPI_EnableDMAReq_RX(SPIx);
+	LL_DMA_EnableChannel(DMA1, sspi_dma->rx_ch);
+	LL_DMA_EnableChannel(DMA1, sspi_dma->tx_ch);
+	LL_SPI_EnableDMAReq_TX(SPIx);
+	LL_SPI_Enable(SPIx);
+}
 
-	GPIO_SetAFSpeed(SPEED_LOW);
-	GPIO_ModeAF(ssel, AF_PP, AF_0);
-	GPIO_ModeAF(sck, AF_PP, AF_0);
-	GPIO_ModeAF(miso, AF_PP, AF_0);
-	GPIO_ModeAF(mosi, AF_PP, AF_0);
+static void sspi_configDMA(uint32_t channel, uint32_t direction)
+{
+	LL_DMA_ConfigTransfer(DMA1, channel,
+												direction | LL_DMA_MODE_NORMAL | LL_DMA_PERIPH_NOINCREMENT | LL_DMA_MEMORY_INCREMENT |
+														LL_DMA_PDATAALIGN_BYTE | LL_DMA_MDATAALIGN_BYTE);
+	LL_DMA_SetPeriphAddress(DMA1, channel, LL_SPI_DMA_GetRegAddr(sspi_dma->SPIx));
+}
 
-	LL_SPI_Disable(SPIx);
+/* Start a new response in the TX buffer that is not being sent */
+static uint8_t *sspi_txNext(void)
+{
+	uint8_t *buf = sspi_tx[sspi_txActive ^ 1];
+	uint16_t i;
+
+	// Not pending while it is written, so the NSS interrupt never swaps a half buffer
+	sspi_txPending = 0;
+	if (sspi_txFill == 0)
+	{
+		for (i = 0; i < SPI_SLAVE_BUFFER_SIZE; i++)
+			buf[i] = SPI_FILLER_BYTE;
+	}
+	return buf;
+}
 
-	sspi_init.Mode = LL_SPI_MODE_SLAVE;
-	sspi_init.TransferDirection = LL_SPI_FULL_DUPLEX;
-	sspi_init.BaudRate = LL_SPI_BAUDRATEPRESCALER_DIV2;
-	sspi_init.ClockPhase = (datamode & SPI_PHASE_MSK);
-	sspi_init.ClockPolarity = (datamode & SPI_POL_MSK);
-	sspi_init.BitOrder = LL_SPI_MSB_FIRST;
-	sspi_init.DataWidth = LL_SPI_DATAWIDTH_8BIT;
-	sspi_init.NSS = LL_SPI_NSS_HARD_OUTPUT;
-	sspi_init.CRCCalculation = LL_SPI_CRCCALCULATION_DISABLE;
-	sspi_init.CRCPoly = 7;
+uint8_t spiSlave_init(SPI_TypeDef *SPIx, pin_t sck, pin_t miso, pin_t mosi, pin_t ssel, uint32_t datamode)
+{
+	SPIAsync_t *as = spi_getAsync(SPIx);
+	uint16_t i;
 
-	LL_SPI_Init(SPIx, &sspi_init);
+	if (as == NULL || as->busy || sspi_dma != NULL)
+		return 0;
+	if (!spi_attachDMA(as, NULL))
+		return 0;
+	sspi_dma = as;
+	sspi_dma->busy = 1;
 
-	LL_SPI_Enable(SPIx);
+#if defined(SPI2)
+	if (SPIx == SPI2)
+		SET_BIT(RCC->APB1ENR, RCC_APB1ENR_SPI2EN);
+	else
+#endif
+		SET_BIT(RCC->APB2ENR, RCC_APB2ENR_SPI1EN);
 
-	NVIC_SetPriority(irq, 0);
-	NVIC_EnableIRQ(irq);
-	LL_SPI_EnableIT_RXNE(SPIx);
+	// EXTI on the NSS rising edge first, it leaves the pin as input
+	sspi_nss = ssel;
+	exti_attach(ssel, PULLUP, MODE_RISING);
+	gpio_modeSPI(sck);
+	gpio_modeSPI(miso);
+	gpio_modeSPI(mosi);
+	gpio_modeSPI(ssel);
+
+	// Slave, hardware NSS, 8 bits, MSB first
+	sspi_cr1 = (datamode & (SPI_POL_MSK | SPI_PHASE_MSK));
+
+	sspi_rxActive = 0;
+	sspi_rxLen = 0;
+	sspi_rxTail = 0;
+	sspi_txActive = 0;
+	sspi_txPending = 0;
+	sspi_txFill = 0;
+	for (i = 0; i < SPI_SLAVE_BUFFER_SIZE; i++)
+		sspi_tx[0][i] = SPI_FILLER_BYTE;
+
+	// RX above TX so a received byte is always taken before the next one
+	sspi_configDMA(sspi_dma->rx_ch, LL_DMA_DIRECTION_PERIPH_TO_MEMORY | LL_DMA_PRIORITY_VERYHIGH);
+	sspi_configDMA(sspi_dma->tx_ch, LL_DMA_DIRECTION_MEMORY_TO_PERIPH | LL_DMA_PRIORITY_HIGH);
+	sspi_arm();
+	return 1;
 }
 
-void SPI1_IRQHandler(void)
+void spiSlave_end(SPI_TypeDef *SPIx)
 {
-	uint8_t b = 0;
+	if (sspi_dma == NULL || sspi_dma->SPIx != SPIx)
+		return;
+	exti_detach(sspi_nss);
+	LL_SPI_Disable(SPIx);
+	CLEAR_BIT(SPIx->CR2, SPI_CR2_TXDMAEN | SPI_CR2_RXDMAEN);
+	dma_detach(sspi_dma->rx_ch);
+	dma_detach(sspi_dma->tx_ch);
+	sspi_dma->busy = 0;
+	sspi_dma = NULL;
+	sspi_nss = NOPIN;
+}
 
-if (LL_SPI_IsActiveFlag_RXNE(SPI1) != RESET)
+void spiSlave_attachComplete(spiSlaveCallback_t cb)
 {
-	b = (uint8_t)SPI1->DR;
-	sspi_rx_buffer_insert(b);
-}
+	sspi_callback = cb;
 }
 
-#if defined(SPI2)
-void SPI2_IRQHandler(void)
+void spiSlave_nssIrq(void)
 {
-	uint8_t b = 0;
+	uint16_t len;
+	uint8_t done;
 
-if (LL_SPI_IsActiveFlag_RXNE(SPI2) != RESET)
-{
-	b = (uint8_t)SPI2->DR;
-	sspi_rx_buffer_insert(b);
-}
+	if (sspi_dma == NULL)
+		return;
+
+	// Swap the buffers and rearm first, the host may start the next transaction right away
+	len = (uint16_t)(SPI_SLAVE_BUFFER_SIZE - LL_DMA_GetDataLength(DMA1, sspi_dma->rx_ch));
+	done = sspi_rxActive;
+	sspi_rxActive ^= 1;
+	if (sspi_txPending)
+	{
+		sspi_txActive ^= 1;
+		sspi_txPending = 0;
+		sspi_txFill = 0;
+	}
+	sspi_arm();
+
+	sspi_rxLen = len;
+	sspi_rxTail = 0;
+	if (sspi_callback != NULL)
+		sspi_callback(sspi_rx[done], len);
 }
-#endif
 
-uint8_t SPISlave_available(SPI_TypeDef *SPIx)
+void spiSlave_setResponse(const uint8_t *data, uint16_t len)
 {
-	//if(LL_SPI_IsActiveFlag_RXNE(SPIx) != RESET) return 1;
-	//else return 0;
-	return ((uint8_t)(SSPI_BUFFER_SIZE + _rx_buffer_head_sspi - _rx_buffer_tail_sspi)) % SSPI_BUFFER_SIZE;
+	uint8_t *buf;
+
+	if (len > SPI_SLAVE_BUFFER_SIZE)
+		len = SPI_SLAVE_BUFFER_SIZE;
+	sspi_txFill = 0;
+	buf = sspi_txNext();
+	for (sspi_txFill = 0; sspi_txFill < len; sspi_txFill++)
+		buf[sspi_txFill] = data[sspi_txFill];
+	sspi_txPending = 1;
 }
 
-uint8_t SPISlave_read8(SPI_TypeDef *SPIx)
-{
-	//while(LL_SPI_IsActiveFlag_RXNE(SPIx) == RESET);
-	//return (uint8_t)SPIx->DR;
-if (_rx_buffer_head_sspi == _rx_buffer_tail_sspi)
+uint16_t spiSlave_available(SPI_TypeDef *SPIx)
 {
-	return 255; // TODO
+	UNUSED(SPIx);
+	return (uint16_t)(sspi_rxLen - sspi_rxTail);
 }
-else
+
+uint8_t spiSlave_read8(SPI_TypeDef *SPIx)
 {
-	uint8_t c = _rx_buffer_sspi[_rx_buffer_tail_sspi];
-	_rx_buffer_tail_sspi = (uint8_t)(_rx_buffer_tail_sspi + 1) % SSPI_BUFFER_SIZE;
-	return c;
-}
+	UNUSED(SPIx);
+	if (sspi_rxTail >= sspi_rxLen)
+		return SPI_FILLER_BYTE;
+	return sspi_rx[sspi_rxActive ^ 1][sspi_rxTail++];
 }
 
-uint16_t SPISlave_read16(SPI_TypeDef *SPIx)
+uint16_t spiSlave_read16(SPI_TypeDef *SPIx)
 {
-	while (LL_SPI_IsActiveFlag_RXNE(SPIx) == RESET)
-		;
-	return (uint16_t)SPIx->DR;
+	uint16_t val = (uint16_t)spiSlave_read8(SPIx) << 8;
+	return val | spiSlave_read8(SPIx);
 }
 
-void SPISlave_write8(SPI_TypeDef *SPIx, uint8_t val)
+void spiSlave_write8(SPI_TypeDef *SPIx, uint8_t val)
 {
-	while (LL_SPI_IsActiveFlag_TXE(SPIx) == RESET)
-		;
-	SPIx->DR = (uint8_t)val;
+	uint8_t *buf;
+
+	UNUSED(SPIx);
+	buf = sspi_txNext();
+	if (sspi_txFill < SPI_SLAVE_BUFFER_SIZE)
+		buf[sspi_txFill++] = val;
+	sspi_txPending = 1;
 }
 
-void SPISlave_write16(SPI_TypeDef *SPIx, uint16_t val)
+void spiSlave_write16(SPI_TypeDef *SPIx, uint16_t val)
 {
-	while (LL_SPI_IsActiveFlag_TXE(SPIx) == RESET)
-		;
-	SPIx->DR = (uint16_t)val;
-}*/
+	spiSlave_write8(SPIx, (uint8_t)(val >> 8));
+	spiSlave_write8(SPIx, (uint8_t)val);
+}
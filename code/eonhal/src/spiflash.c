@@ -0,0 +1,344 @@
+/**
+  ******************************************************************************
+  * @file    spiflash.c
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   SPI NOR Flash Functions
+  ******************************************************************************
+*/
+
+#include <stddef.h>
+#include "spiflash.h"
+#include "System.h"
+
+/**
+ ===============================================================================
+              ##### Definitions #####
+ ===============================================================================
+ */
+
+#define SPIFLASH_CMD_WRITE_ENABLE 0x06
+#define SPIFLASH_CMD_READ_STATUS 0x05
+#define SPIFLASH_CMD_PAGE_PROGRAM 0x02
+#define SPIFLASH_CMD_FAST_READ 0x0B
+#define SPIFLASH_CMD_JEDEC_ID 0x9F
+#define SPIFLASH_CMD_RELEASE_PD 0xAB
+
+#define SPIFLASH_STATUS_WIP 0x01
+#define SPIFLASH_NO_PAGE 0xFFFFFFFFUL
+#define SPIFLASH_PAGE_TIMEOUT 10 // ms, tPP is 3 ms at most
+
+/**
+ ===============================================================================
+              ##### Private Functions #####
+ ===============================================================================
+ */
+
+static void spiflash_command(SPIFlash_t *fl, uint8_t cmd)
+{
+	spi_begin(&fl->dev);
+	spi_write8(fl->dev.SPIx, cmd);
+	spi_end(&fl->dev);
+}
+
+/* Command followed by a 24-bit address, CS stays low */
+static void spiflash_commandAddr(SPIFlash_t *fl, uint8_t cmd, uint32_t addr, uint8_t len)
+{
+	fl->cmd[0] = cmd;
+	fl->cmd[1] = (uint8_t)(addr >> 16);
+	fl->cmd[2] = (uint8_t)(addr >> 8);
+	fl->cmd[3] = (uint8_t)addr;
+	fl->cmd[4] = 0xFF; // Dummy byte of the fast read
+	spi_begin(&fl->dev);
+	spi_stream8(fl->dev.SPIx, fl->cmd, len);
+}
+
+static void spiflash_readDone(void *ctx)
+{
+	SPIFlash_t *fl = (SPIFlash_t *)ctx;
+
+	spi_end(&fl->dev);
+	fl->reading = 0;
+	if (fl->cb != NULL)
+		fl->cb(fl->ctx);
+}
+
+static int8_t spiflash_ready(SPIFlash_t *fl, uint32_t addr, uint32_t len)
+{
+	if (fl->size == 0 || addr >= fl->size || len > fl->size - addr)
+		return SPIFLASH_ERROR;
+	if (fl->reading || spiflash_busy(fl))
+		return SPIFLASH_BUSY;
+	return SPIFLASH_OK;
+}
+
+static int8_t spiflash_startRead(SPIFlash_t *fl, uint32_t addr, uint8_t *dst, uint16_t len, spiCallback_t cb, void *ctx)
+{
+	fl->reading = 1;
+	fl->cb = cb;
+	fl->ctx = ctx;
+	spiflash_commandAddr(fl, SPIFLASH_CMD_FAST_READ, addr, 5);
+	if (!spi_transferAsync(fl->dev.SPIx, NULL, dst, len, spiflash_readDone, fl))
+	{
+		// Another transfer, the SPI slave or a UART holds the DMA channels
+		spi_end(&fl->dev);
+		fl->reading = 0;
+		return SPIFLASH_BUSY;
+	}
+	return SPIFLASH_OK;
+}
+
+/* Blocking DMA read, sleeps until the callback */
+static int8_t spiflash_fastRead(SPIFlash_t *fl, uint32_t addr, uint8_t *dst, uint16_t len)
+{
+	int8_t res = spiflash_startRead(fl, addr, dst, len, NULL, NULL);
+
+	if (res != SPIFLASH_OK)
+		return res;
+	while (fl->reading)
+		__WFI();
+	return SPIFLASH_OK;
+}
+
+/* Page from the cache, read on a miss. NULL if it could not be read. */
+static const uint8_t *spiflash_cachePage(SPIFlash_t *fl, uint32_t page)
+{
+	uint8_t i;
+
+	for (i = 0; i < SPIFLASH_CACHE_PAGES; i++)
+	{
+		if (fl->cacheAddr[i] == page)
+			return fl->cache[i];
+	}
+
+	// Round robin replacement
+	i = fl->cacheNext;
+	fl->cacheNext = (uint8_t)((i + 1) % SPIFLASH_CACHE_PAGES);
+	fl->cacheAddr[i] = SPIFLASH_NO_PAGE;
+	if (spiflash_fastRead(fl, page, fl->cache[i], SPIFLASH_PAGE_SIZE) != SPIFLASH_OK)
+		return NULL;
+	fl->cacheAddr[i] = page;
+	return fl->cache[i];
+}
+
+static void spiflash_cacheDrop(SPIFlash_t *fl, uint32_t addr, uint32_t len)
+{
+	uint8_t i;
+
+	for (i = 0; i < SPIFLASH_CACHE_PAGES; i++)
+	{
+		if (fl->cacheAddr[i] != SPIFLASH_NO_PAGE && fl->cacheAddr[i] + SPIFLASH_PAGE_SIZE > addr && fl->cacheAddr[i] < addr + len)
+			fl->cacheAddr[i] = SPIFLASH_NO_PAGE;
+	}
+}
+
+/**
+ ===============================================================================
+              ##### Public Functions #####
+ ===============================================================================
+ */
+
+int8_t spiflash_init(SPIFlash_t *fl, SPI_TypeDef *SPIx, uint32_t freq_hz, pin_t cs)
+{
+	uint8_t id[3];
+	uint8_t capacity;
+
+	spi_initDevice(&fl->dev, SPIx, freq_hz, SPI_DATAMODE0, LL_SPI_DATAWIDTH_8BIT, LL_SPI_MSB_FIRST, cs);
+	fl->writing = 0;
+	fl->reading = 0;
+	fl->cacheNext = 0;
+	fl->size = 0;
+	spiflash_invalidate(fl);
+
+	spiflash_command(fl, SPIFLASH_CMD_RELEASE_PD);
+	delay_ms(1); // tRES1
+
+	spi_begin(&fl->dev);
+	spi_write8(SPIx, SPIFLASH_CMD_JEDEC_ID);
+	spi_readMultiple8(SPIx, id, 3);
+	spi_end(&fl->dev);
+
+	fl->jedec = ((uint32_t)id[0] << 16) | ((uint32_t)id[1] << 8) | id[2];
+	capacity = id[2];
+	if (fl->jedec == 0 || fl->jedec == 0xFFFFFF)
+		return SPIFLASH_ERROR;
+
+	// Capacity byte is log2 of the size, 3-byte addresses reach 16 MB
+	if (capacity >= 0x10 && capacity <= 0x18)
+		fl->size = 1UL << capacity;
+	else
+		return SPIFLASH_ERROR;
+	return SPIFLASH_OK;
+}
+
+uint8_t spiflash_busy(SPIFlash_t *fl)
+{
+	uint8_t status;
+
+	if (!fl->writing)
+		return 0;
+	spi_begin(&fl->dev);
+	spi_write8(fl->dev.SPIx, SPIFLASH_CMD_READ_STATUS);
+	status = spi_read8(fl->dev.SPIx);
+	spi_end(&fl->dev);
+	if ((status & SPIFLASH_STATUS_WIP) == 0)
+		fl->writing = 0;
+	return fl->writing;
+}
+
+int8_t spiflash_wait(SPIFlash_t *fl, uint32_t timeout)
+{
+	uint32_t start = millis();
+
+	while (spiflash_busy(fl))
+	{
+		if (millis() - start >= timeout)
+			return SPIFLASH_BUSY;
+		__WFI();
+	}
+	return SPIFLASH_OK;
+}
+
+int8_t spiflash_read(SPIFlash_t *fl, uint32_t addr, uint8_t *dst, uint32_t len)
+{
+	int8_t res = spiflash_ready(fl, addr, len);
+	const uint8_t *page;
+	uint32_t offset, n, i;
+
+	if (res != SPIFLASH_OK)
+		return res;
+
+	while (len > 0)
+	{
+		offset = addr & (SPIFLASH_PAGE_SIZE - 1);
+		if (offset == 0 && len >= SPIFLASH_PAGE_SIZE)
+		{
+			// Whole pages in one DMA burst, the largest multiple of a page that fits in 16 bits
+			n = len & ~(SPIFLASH_PAGE_SIZE - 1);
+			if (n > 0xFF00)
+				n = 0xFF00;
+			res = spiflash_fastRead(fl, addr, dst, (uint16_t)n);
+			if (res != SPIFLASH_OK)
+				return res;
+		}
+		else
+		{
+			n = SPIFLASH_PAGE_SIZE - offset;
+			if (n > len)
+				n = len;
+			page = spiflash_cachePage(fl, addr - offset);
+			if (page == NULL)
+				return SPIFLASH_BUSY;
+			for (i = 0; i < n; i++)
+				dst[i] = page[offset + i];
+		}
+		addr += n;
+		dst += n;
+		len -= n;
+	}
+	return SPIFLASH_OK;
+}
+
+int8_t spiflash_readAsync(SPIFlash_t *fl, uint32_t addr, uint8_t *dst, uint16_t len, spiCallback_t cb, void *ctx)
+{
+	int8_t res = spiflash_ready(fl, addr, len);
+
+	if (res != SPIFLASH_OK)
+		return res;
+	if (len == 0)
+		return SPIFLASH_ERROR;
+	return spiflash_startRead(fl, addr, dst, len, cb, ctx);
+}
+
+int8_t spiflash_program(SPIFlash_t *fl, uint32_t addr, const uint8_t *src, uint16_t len)
+{
+	int8_t res = spiflash_ready(fl, addr, len);
+
+	if (res != SPIFLASH_OK)
+		return res;
+	if (len == 0 || (addr & (SPIFLASH_PAGE_SIZE - 1)) + len > SPIFLASH_PAGE_SIZE)
+		return SPIFLASH_ERROR;
+
+	spiflash_cacheDrop(fl, addr, len);
+	spiflash_command(fl, SPIFLASH_CMD_WRITE_ENABLE);
+	spiflash_commandAddr(fl, SPIFLASH_CMD_PAGE_PROGRAM, addr, 4);
+	spi_stream8(fl->dev.SPIx, src, len);
+	spi_end(&fl->dev);
+	fl->writing = 1;
+	return SPIFLASH_OK;
+}
+
+int8_t spiflash_write(SPIFlash_t *fl, uint32_t addr, const uint8_t *src, uint32_t len)
+{
+	int8_t res = spiflash_ready(fl, addr, len);
+	uint32_t n;
+
+	if (res != SPIFLASH_OK)
+		return res;
+
+	while (len > 0)
+	{
+		n = SPIFLASH_PAGE_SIZE - (addr & (SPIFLASH_PAGE_SIZE - 1));
+		if (n > len)
+			n = len;
+		res = spiflash_program(fl, addr, src, (uint16_t)n);
+		if (res == SPIFLASH_OK)
+			res = spiflash_wait(fl, SPIFLASH_PAGE_TIMEOUT);
+		if (res != SPIFLASH_OK)
+			return res;
+		addr += n;
+		src += n;
+		len -= n;
+	}
+	return SPIFLASH_OK;
+}
+
+int8_t spiflash_erase(SPIFlash_t *fl, uint32_t addr, uint8_t type)
+{
+	uint32_t size;
+	int8_t res;
+
+	switch (type)
+	{
+	case SPIFLASH_ERASE_4K:
+		size = 4096UL;
+		break;
+	case SPIFLASH_ERASE_32K:
+		size = 32768UL;
+		break;
+	case SPIFLASH_ERASE_64K:
+		size = 65536UL;
+		break;
+	case SPIFLASH_ERASE_CHIP:
+		size = fl->size;
+		addr = 0;
+		break;
+	default:
+		return SPIFLASH_ERROR;
+	}
+	addr &= ~(size - 1);
+	res = spiflash_ready(fl, addr, size);
+	if (res != SPIFLASH_OK)
+		return res;
+
+	spiflash_cacheDrop(fl, addr, size);
+	spiflash_command(fl, SPIFLASH_CMD_WRITE_ENABLE);
+	if (type == SPIFLASH_ERASE_CHIP)
+		spiflash_command(fl, type);
+	else
+	{
+		spiflash_commandAddr(fl, type, addr, 4);
+		spi_end(&fl->dev);
+	}
+	fl->writing = 1;
+	return SPIFLASH_OK;
+}
+
+void spiflash_invalidate(SPIFlash_t *fl)
+{
+	uint8_t i;
+
+	for (i = 0; i < SPIFLASH_CACHE_PAGES; i++)
+		fl->cacheAddr[i] = SPIFLASH_NO_PAGE;
+}
@@ -0,0 +1,591 @@
+/**
+  ******************************************************************************
+  * @file    uart.c
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   UART Driver Functions (USART1, USART2 and LPUART1)
+  ******************************************************************************
+*/
+
+#include "uart.h"
+#include "System.h"
+#include "eon_format.h"
+#include "pinmap_impl.h"
+#include "stm32l0xx_ll_lpuart.h"
+#include "stm32l0xx_ll_rcc.h"
+
+/**
+ ===============================================================================
+              ##### Definitions #####
+ ===============================================================================
+ */
+
+// RTS/DE and CTS of USART1, USART2 and LPUART1 are AF4 on the L0 packages supported (PA0, PA1, PA6, PA11, PA12, PB1)
+#define UART_CTRL_AF LL_GPIO_AF_4
+
+// RXNE polls left to the RX DMA at the end of a frame, it takes RDR within a few bus cycles
+#define UART_FRAME_DMA_SPIN 32
+
+/**
+ ===============================================================================
+              ##### Private Functions #####
+ ===============================================================================
+ */
+
+/**
+ * @brief Alternate function of a TX/RX pin. The pin map uartAF column holds the USART one,
+ * LPUART1 is AF4 on PB10/PB11 and AF6 on its other pins (PA2, PA3, PA13, PA14, PB6, PB7).
+ */
+static uint8_t uart_pinAF(UARTPort_t *port, pin_t pin)
+{
+	if (pin == NOPIN)
+		return 0;
+	STM32_Pin_Info *pin_map = HAL_Pin_Map();
+
+	if (!port->lpuart)
+		return pin_map[pin].uartAF;
+	if (pin_map[pin].GPIOx == GPIOB && (pin_map[pin].pin == LL_GPIO_PIN_10 || pin_map[pin].pin == LL_GPIO_PIN_11))
+		return LL_GPIO_AF_4;
+	return LL_GPIO_AF_6;
+}
+
+/* Record the current RX head as the end of a frame (from interrupt) */
+static void uart_frameEnd(UARTPort_t *port)
+{
+	UARTFrame_t *f = &port->frame;
+	uint8_t spin = UART_FRAME_DMA_SPIN;
+
+	// In DMA mode the matched character may still be in RDR, let the DMA move it first. The wait
+	// is bounded: if the channel is stalled the byte ends up in the next frame instead.
+	if (port->rx.dma_ch != 0)
+	{
+		while (LL_USART_IsActiveFlag_RXNE(port->USARTx) && spin > 0)
+			spin--;
+	}
+	uart_rb_sync(&port->rx);
+
+	if (port->rx.head == f->last)
+		return; // CM followed by RTO, or a gap with nothing new
+	if ((uint8_t)(f->head - f->tail) >= UART_FRAME_QUEUE)
+		return; // Queue full, this frame is merged with the next one
+	f->end[f->head & (UART_FRAME_QUEUE - 1)] = port->rx.head;
+	f->last = port->rx.head;
+	f->head++;
+	if (f->rxFrame != 0)
+		f->rxFrame();
+}
+
+/**
+ ===============================================================================
+              ##### Interrupt #####
+ ===============================================================================
+ */
+
+void uart_irq(UARTPort_t *port)
+{
+	USART_TypeDef *USARTx = port->USARTx;
+	uint8_t idle = LL_USART_IsEnabledIT_IDLE(USARTx) && LL_USART_IsActiveFlag_IDLE(USARTx);
+
+	if (LL_USART_IsEnabledIT_RXNE(USARTx) && UART_GET_IT(USARTx, UART_IT_RXNE) != 0)
+	{
+		uart_rb_insert(&port->rx, (uint8_t)LL_USART_ReceiveData8(USARTx));
+	}
+	// With RXNEIE set an overrun keeps the line asserted until ORE is cleared
+	if (LL_USART_IsActiveFlag_ORE(USARTx))
+	{
+		LL_USART_ClearFlag_ORE(USARTx);
+		port->rx.overflow++;
+	}
+	// Woken up from Stop: HSION was cleared on entry, keep HSI16 on for the UART in Run mode
+	if (LL_USART_IsEnabledIT_WKUP(USARTx) && LL_USART_IsActiveFlag_WKUP(USARTx))
+	{
+		LL_USART_ClearFlag_WKUP(USARTx);
+		LL_RCC_HSI_Enable();
+	}
+	uart_rx_idleIrq(&port->rx, USARTx);
+	if (LL_USART_IsEnabledIT_CM(USARTx) && LL_USART_IsActiveFlag_CM(USARTx))
+	{
+		LL_USART_ClearFlag_CM(USARTx);
+		uart_frameEnd(port);
+	}
+	if (port->frame.gap && (port->lpuart ? idle : (LL_USART_IsEnabledIT_RTO(USARTx) && LL_USART_IsActiveFlag_RTO(USARTx))))
+	{
+		LL_USART_ClearFlag_RTO(USARTx);
+		uart_frameEnd(port);
+	}
+	uart_txq_irq(&port->tx);
+}
+
+/**
+ ===============================================================================
+              ##### Initialization Functions #####
+ ===============================================================================
+ */
+
+uint8_t uart_init(UARTPort_t *port, uint32_t baudrate, pin_t tx, pin_t rx)
+{
+	USART_TypeDef *USARTx = port->USARTx;
+
+	port->baudrate = baudrate;
+	SET_BIT(*port->clk_reg, port->clk_bit);
+	(void)READ_BIT(*port->clk_reg, port->clk_bit); // Delay after an RCC peripheral clock enabling
+
+	gpio_modeAF(tx, AF_PP, NOPULL, uart_pinAF(port, tx));
+	gpio_modeAF(rx, AF_PP, NOPULL, uart_pinAF(port, rx));
+
+	NVIC_SetPriority(port->irqn, 0);
+	NVIC_EnableIRQ(port->irqn);
+
+	if (port->lpuart)
+	{
+		LL_LPUART_InitTypeDef LPUART_InitStruct;
+		LPUART_InitStruct.BaudRate = baudrate;
+		LPUART_InitStruct.DataWidth = LL_LPUART_DATAWIDTH_8B;
+		LPUART_InitStruct.StopBits = LL_LPUART_STOPBITS_1;
+		LPUART_InitStruct.Parity = LL_LPUART_PARITY_NONE;
+		LPUART_InitStruct.TransferDirection = LL_LPUART_DIRECTION_TX_RX;
+		LPUART_InitStruct.HardwareFlowControl = LL_LPUART_HWCONTROL_NONE;
+		LL_LPUART_Init(USARTx, &LPUART_InitStruct);
+	}
+	else
+	{
+		LL_USART_InitTypeDef USART_InitStruct;
+		USART_InitStruct.BaudRate = baudrate;
+		USART_InitStruct.DataWidth = LL_USART_DATAWIDTH_8B;
+		USART_InitStruct.StopBits = LL_USART_STOPBITS_1;
+		USART_InitStruct.Parity = LL_USART_PARITY_NONE;
+		USART_InitStruct.TransferDirection = LL_USART_DIRECTION_TX_RX;
+		USART_InitStruct.HardwareFlowControl = LL_USART_HWCONTROL_NONE;
+		USART_InitStruct.OverSampling = LL_USART_OVERSAMPLING_8;
+		LL_USART_Init(USARTx, &USART_InitStruct);
+
+		LL_USART_ConfigAsyncMode(USARTx);
+	}
+
+	LL_USART_Enable(USARTx);
+
+	LL_USART_EnableIT_RXNE(USARTx);
+
+	return uart_txq_init(&port->tx, USARTx, port->tx_dma_ch, port->dma_req);
+}
+
+uint8_t uart_initRS485(UARTPort_t *port, uint32_t baudrate, pin_t tx, pin_t rx, pin_t de, uint8_t assertTime, uint8_t deassertTime)
+{
+	USART_TypeDef *USARTx = port->USARTx;
+
+	uint8_t dma = uart_init(port, baudrate, tx, rx);
+	gpio_modeAF(de, AF_PP, NOPULL, UART_CTRL_AF);
+
+	// DEM, DEAT and DEDT can only be written with UE = 0
+	LL_USART_Disable(USARTx);
+	LL_USART_SetDESignalPolarity(USARTx, LL_USART_DE_POLARITY_HIGH);
+	LL_USART_SetDEAssertionTime(USARTx, assertTime & 0x1F);
+	LL_USART_SetDEDeassertionTime(USARTx, deassertTime & 0x1F);
+	LL_USART_EnableDEMode(USARTx);
+	LL_USART_Enable(USARTx);
+	return dma;
+}
+
+uint8_t uart_initFlowControl(UARTPort_t *port, uint32_t baudrate, pin_t tx, pin_t rx, pin_t rts, pin_t cts)
+{
+	USART_TypeDef *USARTx = port->USARTx;
+	uint32_t flow = LL_USART_HWCONTROL_NONE;
+
+	uint8_t dma = uart_init(port, baudrate, tx, rx);
+	if (rts != NOPIN)
+	{
+		gpio_modeAF(rts, AF_PP, NOPULL, UART_CTRL_AF);
+		flow |= LL_USART_HWCONTROL_RTS;
+	}
+	if (cts != NOPIN)
+	{
+		gpio_modeAF(cts, AF_PP, PULLDOWN, UART_CTRL_AF);
+		flow |= LL_USART_HWCONTROL_CTS;
+	}
+
+	LL_USART_Disable(USARTx);
+	LL_USART_SetHWFlowCtrl(USARTx, flow);
+	LL_USART_Enable(USARTx);
+	return dma;
+}
+
+uint8_t uart_initHalfDuplex(UARTPort_t *port, uint32_t baudrate, pin_t txrx)
+{
+	USART_TypeDef *USARTx = port->USARTx;
+
+	uint8_t dma = uart_init(port, baudrate, txrx, NOPIN);
+	// Single wire bus: the pin is released between transmissions
+	gpio_modeAF(txrx, AF_OD, PULLUP, uart_pinAF(port, txrx));
+
+	LL_USART_Disable(USARTx);
+	LL_USART_EnableHalfDuplex(USARTx);
+	LL_USART_Enable(USARTx);
+	return dma;
+}
+
+void uart_off(UARTPort_t *port)
+{
+	uart_txq_flush(&port->tx);
+	if (port->tx.dma_ch != 0)
+		dma_detach(port->tx.dma_ch);
+	uart_rx_dmaStop(&port->rx, port->USARTx);
+	LL_USART_DisableIT_RXNE(port->USARTx);
+	uart_disableStopMode(port);
+	LL_USART_Disable(port->USARTx);
+	NVIC_DisableIRQ(port->irqn);
+	CLEAR_BIT(*port->clk_reg, port->clk_bit);
+}
+
+/**
+ ===============================================================================
+              ##### Stop Mode Functions #####
+ ===============================================================================
+ */
+
+void uart_enableStopMode(UARTPort_t *port, uint32_t wakeup, uint8_t address)
+{
+	USART_TypeDef *USARTx = port->USARTx;
+	uint32_t hsi = port->clk_sel & (port->clk_sel << 1); // 0b10 in the xSEL field selects HSI16
+
+	uart_flush(port);
+
+	LL_RCC_HSI_Enable();
+	while (LL_RCC_HSI_IsReady() != 1)
+	{
+	}
+
+	// BRR, ADD and WUS can only be written with UE = 0
+	LL_USART_Disable(USARTx);
+	if (!LL_USART_IsEnabledInStopMode(USARTx))
+		port->brr = USARTx->BRR;
+	MODIFY_REG(RCC->CCIPR, port->clk_sel, hsi);
+	if (port->lpuart)
+		LL_LPUART_SetBaudRate(USARTx, HSI_VALUE, port->baudrate);
+	else
+		LL_USART_SetBaudRate(USARTx, HSI_VALUE, LL_USART_OVERSAMPLING_8, port->baudrate);
+	if (wakeup == UART_WAKEUP_ADDRESS)
+		LL_USART_ConfigNodeAddress(USARTx, LL_USART_ADDRESS_DETECT_7B, address);
+	LL_USART_SetWKUPType(USARTx, wakeup);
+	LL_USART_EnableInStopMode(USARTx);
+#if defined(USART_CR3_UCESM)
+	// HSI16 stays on during Stop, else the bytes after the wake-up one are lost above a few kbaud
+	SET_BIT(USARTx->CR3, USART_CR3_UCESM);
+#endif
+	LL_USART_ClearFlag_WKUP(USARTx);
+	LL_USART_EnableIT_WKUP(USARTx);
+	LL_USART_Enable(USARTx);
+
+	// Stop must not be entered before the receiver is ready
+	while (!LL_USART_IsActiveFlag_REACK(USARTx))
+	{
+	}
+}
+
+void uart_disableStopMode(UARTPort_t *port)
+{
+	USART_TypeDef *USARTx = port->USARTx;
+
+	if (!LL_USART_IsEnabledInStopMode(USARTx))
+		return;
+
+	LL_USART_Disable(USARTx);
+	LL_USART_DisableIT_WKUP(USARTx);
+	LL_USART_DisableInStopMode(USARTx);
+#if defined(USART_CR3_UCESM)
+	CLEAR_BIT(USARTx->CR3, USART_CR3_UCESM);
+#endif
+	MODIFY_REG(RCC->CCIPR, port->clk_sel, 0);
+	USARTx->BRR = port->brr;
+	LL_USART_Enable(USARTx);
+}
+
+/**
+ ===============================================================================
+              ##### Write Functions #####
+ ===============================================================================
+ */
+
+void uart_write(UARTPort_t *port, unsigned char c)
+{
+	uart_txq_pushAll(&port->tx, &c, 1);
+}
+
+uint16_t uart_writeAsync(UARTPort_t *port, const uint8_t *buf, uint16_t len)
+{
+	return uart_txq_push(&port->tx, buf, len);
+}
+
+void uart_flush(UARTPort_t *port)
+{
+	uart_txq_flush(&port->tx);
+}
+
+void uart_attachTxComplete(UARTPort_t *port, void (*cb)(void))
+{
+	port->tx.txDone = cb;
+}
+
+/**
+ ===============================================================================
+              ##### RX DMA Functions #####
+ ===============================================================================
+ */
+
+uint8_t uart_enableRxDMA(UARTPort_t *port)
+{
+	return uart_rx_dmaStart(&port->rx, port->USARTx, port->rx_dma_ch, port->dma_req);
+}
+
+void uart_disableRxDMA(UARTPort_t *port)
+{
+	uart_rx_dmaStop(&port->rx, port->USARTx);
+	if (port->lpuart && port->frame.gap)
+		LL_USART_EnableIT_IDLE(port->USARTx); // LPUART1 frames on IDLE, keep it
+}
+
+void uart_attachRxIdle(UARTPort_t *port, void (*cb)(void))
+{
+	port->rx.rxIdle = cb;
+}
+
+/**
+ ===============================================================================
+              ##### Print Functions #####
+ ===============================================================================
+ */
+
+void uart_print(UARTPort_t *port, const char *s)
+{
+	uart_txq_pushAll(&port->tx, (const uint8_t *)s, strlen(s));
+}
+
+void uart_println(UARTPort_t *port, const char *s)
+{
+	uart_txq_pushAll(&port->tx, (const uint8_t *)s, strlen(s));
+	uart_txq_pushAll(&port->tx, (const uint8_t *)"\r\n", 2);
+}
+
+/* Queue a formatted number, with the line ending if asked, as one write */
+static void uart_printFormatted(UARTPort_t *port, char *buf, uint8_t len, uint8_t newline)
+{
+	if (newline)
+	{
+		buf[len++] = '\r';
+		buf[len++] = '\n';
+	}
+	uart_txq_pushAll(&port->tx, (const uint8_t *)buf, len);
+}
+
+void uart_printIntBase(UARTPort_t *port, int64_t n, uint8_t base)
+{
+	char buf[FMT_BUFFER_SIZE + 2];
+	uart_printFormatted(port, buf, fmt_int(buf, n, base, 0), 0);
+}
+
+void uart_printlnIntBase(UARTPort_t *port, int64_t n, uint8_t base)
+{
+	char buf[FMT_BUFFER_SIZE + 2];
+	uart_printFormatted(port, buf, fmt_int(buf, n, base, 0), 1);
+}
+
+void uart_printFloat(UARTPort_t *port, float n, uint8_t decimals)
+{
+	char buf[FMT_BUFFER_SIZE + 2];
+	uart_printFormatted(port, buf, fmt_float(buf, n, decimals), 0);
+}
+
+void uart_printlnFloat(UARTPort_t *port, float n, uint8_t decimals)
+{
+	char buf[FMT_BUFFER_SIZE + 2];
+	uart_printFormatted(port, buf, fmt_float(buf, n, decimals), 1);
+}
+
+void uart_printNum(UARTPort_t *port, int64_t n, uint8_t isfloat)
+{
+	char buf[FMT_BUFFER_SIZE + 2];
+	uart_printFormatted(port, buf, isfloat ? fmt_fixed(buf, n, 2) : fmt_int(buf, n, 10, 0), 0);
+}
+
+void uart_printlnNum(UARTPort_t *port, int64_t n, uint8_t isfloat)
+{
+	char buf[FMT_BUFFER_SIZE + 2];
+	uart_printFormatted(port, buf, isfloat ? fmt_fixed(buf, n, 2) : fmt_int(buf, n, 10, 0), 1);
+}
+
+/**
+ ===============================================================================
+              ##### Read Functions #####
+ ===============================================================================
+ */
+
+uint16_t uart_available(UARTPort_t *port)
+{
+	return uart_rb_available(&port->rx);
+}
+
+int uart_read(UARTPort_t *port)
+{
+	return uart_rb_read(&port->rx);
+}
+
+int uart_peek(UARTPort_t *port)
+{
+	return uart_rb_peek(&port->rx);
+}
+
+uint16_t uart_readBytes(UARTPort_t *port, uint8_t *dst, uint16_t n)
+{
+	return uart_rb_readBytes(&port->rx, dst, n);
+}
+
+uint16_t uart_peekSpan(UARTPort_t *port, const uint8_t **span)
+{
+	return uart_rb_peekSpan(&port->rx, span);
+}
+
+void uart_skip(UARTPort_t *port, uint16_t n)
+{
+	uart_rb_skip(&port->rx, n);
+}
+
+uint32_t uart_overflowCount(UARTPort_t *port)
+{
+	uart_rb_sync(&port->rx);
+	return port->rx.overflow;
+}
+
+uint16_t uart_readUntilTimeout(UARTPort_t *port, char buffer[], uint16_t len, uint8_t terminator, uint32_t timeout)
+{
+	uint32_t start = millis();
+	uint16_t i = 0;
+	int c;
+
+	if (len == 0)
+		return 0;
+
+	while (i < len - 1)
+	{
+		c = uart_read(port);
+		if (c < 0)
+		{
+			if (millis() - start >= timeout)
+				break;
+			__WFI(); // Next byte, DMA event or tick
+			continue;
+		}
+		if (c == terminator)
+			break;
+		buffer[i++] = (char)c;
+	}
+	buffer[i] = '\0';
+	return i;
+}
+
+void uart_readUntil(UARTPort_t *port, char buffer[], uint8_t terminator)
+{
+	if (uart_available(port) == 0)
+		return;
+	uart_readUntilTimeout(port, buffer, 256, terminator, 0xFFFFFFFFUL); // Almost 50 days
+}
+
+/**
+ ===============================================================================
+              ##### Framed Read Functions #####
+ ===============================================================================
+ */
+
+void uart_enableFraming(UARTPort_t *port, int16_t terminator, uint32_t gap)
+{
+	USART_TypeDef *USARTx = port->USARTx;
+
+	uart_disableFraming(port);
+
+	// ADD and RTOEN can only be written with UE = 0
+	LL_USART_Disable(USARTx);
+	if (terminator != UART_NO_TERMINATOR)
+		LL_USART_ConfigNodeAddress(USARTx, LL_USART_ADDRESS_DETECT_7B, (uint8_t)terminator);
+	if (gap != 0 && !port->lpuart)
+	{
+		LL_USART_SetRxTimeout(USARTx, gap);
+		LL_USART_EnableRxTimeout(USARTx);
+	}
+	LL_USART_Enable(USARTx);
+
+	uart_rb_sync(&port->rx);
+	port->frame.last = port->rx.head;
+	port->frame.gap = (gap != 0);
+
+	if (terminator != UART_NO_TERMINATOR)
+	{
+		LL_USART_ClearFlag_CM(USARTx);
+		LL_USART_EnableIT_CM(USARTx);
+	}
+	if (gap != 0)
+	{
+		if (port->lpuart)
+		{
+			LL_USART_ClearFlag_IDLE(USARTx);
+			LL_USART_EnableIT_IDLE(USARTx);
+		}
+		else
+		{
+			LL_USART_ClearFlag_RTO(USARTx);
+			LL_USART_EnableIT_RTO(USARTx);
+		}
+	}
+}
+
+void uart_disableFraming(UARTPort_t *port)
+{
+	USART_TypeDef *USARTx = port->USARTx;
+
+	LL_USART_DisableIT_CM(USARTx);
+	if (!port->lpuart)
+	{
+		LL_USART_DisableIT_RTO(USARTx);
+		LL_USART_Disable(USARTx);
+		LL_USART_DisableRxTimeout(USARTx);
+		LL_USART_Enable(USARTx);
+	}
+	else if (port->rx.dma_ch == 0)
+	{
+		LL_USART_DisableIT_IDLE(USARTx);
+	}
+	port->frame.gap = 0;
+	port->frame.tail = port->frame.head;
+}
+
+void uart_attachRxFrame(UARTPort_t *port, void (*cb)(void))
+{
+	port->frame.rxFrame = cb;
+}
+
+uint8_t uart_framesAvailable(UARTPort_t *port)
+{
+	return (uint8_t)(port->frame.head - port->frame.tail);
+}
+
+uint16_t uart_readFrame(UARTPort_t *port, uint8_t *dst, uint16_t len, uint32_t timeout)
+{
+	UARTFrame_t *f = &port->frame;
+	uint32_t start = millis();
+	uint16_t size, avail, n;
+
+	while (f->head == f->tail)
+	{
+		if (millis() - start >= timeout)
+			return 0;
+		__WFI();
+	}
+
+	size = (uint16_t)(f->end[f->tail & (UART_FRAME_QUEUE - 1)] - port->rx.tail);
+	f->tail++;
+	avail = uart_rb_available(&port->rx);
+	if (size > avail)
+		size = avail; // The end was overwritten by an RX buffer overflow
+
+	n = uart_rb_readBytes(&port->rx, dst, size < len ? size : len);
+	uart_rb_skip(&port->rx, size - n);
+	return n;
+}
@@ -0,0 +1,338 @@
+/**
+  ******************************************************************************
+  * @file    flash_model.c
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   SPI NOR flash model: programming only clears bits, erase sets them, both are
+  *          busy for a number of status reads and can be torn by a simulated power cut
+  ******************************************************************************
+*/
+
+#include <stddef.h>
+#include <string.h>
+#include "flash_model.h"
+
+/**
+ ===============================================================================
+              ##### Definitions #####
+ ===============================================================================
+ */
+
+#define FLASH_PAGE 256U
+#define FLASH_JEDEC_CAPACITY 0x12 // log2(FLASH_SIZE)
+
+FlashModel_t flash;
+SPI_TypeDef host_spi1;
+
+static uint8_t flash_cmd[4 + FLASH_PAGE]; // Bytes of the current transaction, data of a program included
+static uint32_t flash_pos;
+static uint8_t flash_wel;
+static uint32_t flash_rng = 1;
+static uint32_t host_ms;
+
+// DMA read waiting for __WFI()
+static uint8_t *dma_rx;
+static const uint8_t *dma_tx;
+static uint16_t dma_len;
+static spiCallback_t dma_cb;
+static void *dma_ctx;
+
+/**
+ ===============================================================================
+              ##### Private Functions #####
+ ===============================================================================
+ */
+
+static uint32_t flash_addr(void)
+{
+	return (((uint32_t)flash_cmd[1] << 16) | ((uint32_t)flash_cmd[2] << 8) | flash_cmd[3]) % FLASH_SIZE;
+}
+
+/* Power cut in the middle of this operation? Returns the byte where it stops, or len */
+static uint32_t flash_tearAt(uint32_t len)
+{
+	if (flash.cutCountdown == 0 || --flash.cutCountdown != 0)
+		return len;
+	return flash_random() % len;
+}
+
+static void flash_powerOff(void)
+{
+	jmp_buf *jump = flash.cutJump;
+
+	flash.cs = 0;
+	flash.busy = 0;
+	flash.cutJump = NULL;
+	flash_wel = 0;
+	flash_pos = 0;
+	dma_len = 0;
+	longjmp(*jump, 1);
+}
+
+static void flash_program(void)
+{
+	uint32_t addr = flash_addr();
+	uint32_t page = addr & ~(FLASH_PAGE - 1U);
+	uint32_t len = flash_pos - 4;
+	uint32_t i, stop;
+
+	if (len == 0)
+		return;
+	if ((addr & (FLASH_PAGE - 1U)) + len > FLASH_PAGE)
+		flash.violations++; // The chip wraps inside the page
+	stop = flash_tearAt(len);
+	for (i = 0; i < len && i < stop; i++)
+		flash.mem[page + ((addr + i) & (FLASH_PAGE - 1U))] &= flash_cmd[4 + i];
+	flash.programs++;
+	if (stop < len)
+	{
+		// Only some of the bits of the last byte made it
+		flash.cutAddr = page + ((addr + stop) & (FLASH_PAGE - 1U));
+		flash.cutErase = 0;
+		flash.mem[flash.cutAddr] &= (uint8_t)(flash_cmd[4 + stop] | flash_random());
+		flash_powerOff();
+	}
+	flash.busy = FLASH_PROGRAM_POLLS;
+}
+
+static void flash_erase(uint32_t size)
+{
+	uint32_t addr = flash_addr() & ~(size - 1U);
+	uint32_t stop = flash_tearAt(size);
+
+	memset(&flash.mem[addr], 0xFF, stop);
+	flash.erases++;
+	if (stop < size)
+	{
+		flash.cutAddr = addr + stop;
+		flash.cutErase = 1;
+		flash.mem[addr + stop] |= (uint8_t)flash_random();
+		flash_powerOff();
+	}
+	flash.busy = FLASH_ERASE_POLLS * (size / 4096U);
+}
+
+/* Command ends with CS going high */
+static void flash_execute(void)
+{
+	uint8_t cmd = flash_cmd[0];
+
+	if (flash_pos == 0 || flash.busy != 0)
+		return;
+	switch (cmd)
+	{
+	case 0x06:
+		flash_wel = 1;
+		return;
+	case 0x02:
+	case 0x20:
+	case 0x52:
+	case 0xD8:
+	case 0xC7:
+		if (!flash_wel || (cmd != 0xC7 && flash_pos < 4))
+		{
+			flash.violations++;
+			return;
+		}
+		flash_wel = 0;
+		if (cmd == 0x02)
+			flash_program();
+		else
+			flash_erase(cmd == 0x20 ? 4096U : cmd == 0x52 ? 32768U : cmd == 0xD8 ? 65536U : FLASH_SIZE);
+		return;
+	default:
+		return;
+	}
+}
+
+/* One byte on the bus while selected */
+static uint8_t flash_xfer(uint8_t mosi)
+{
+	uint8_t cmd;
+	uint8_t miso = 0xFF;
+
+	if (!flash.cs || flash.absent)
+		return 0xFF;
+	if (flash_pos < sizeof(flash_cmd))
+		flash_cmd[flash_pos] = mosi;
+	cmd = flash_cmd[0];
+
+	// Only the status can be read while a program or erase runs
+	if (flash_pos == 0 && flash.busy != 0 && mosi != 0x05)
+		flash.violations++;
+
+	if (flash_pos > 0)
+	{
+		switch (cmd)
+		{
+		case 0x9F:
+			miso = (flash_pos == 1) ? 0xEF : (flash_pos == 2) ? 0x40 : FLASH_JEDEC_CAPACITY;
+			break;
+		case 0x05:
+			miso = (uint8_t)((flash.busy != 0 ? 0x01 : 0x00) | (flash_wel ? 0x02 : 0x00));
+			if (flash.busy != 0)
+				flash.busy--;
+			break;
+		case 0x0B:
+			if (flash_pos == 4 && flash.busy == 0)
+				flash.fastReads++;
+			if (flash_pos >= 5 && flash.busy == 0)
+				miso = flash.mem[(flash_addr() + flash_pos - 5) % FLASH_SIZE];
+			break;
+		default:
+			break;
+		}
+	}
+	if (cmd == 0x02 && flash_pos >= 4 + FLASH_PAGE)
+		flash.violations++; // Longer than a page
+	else
+		flash_pos++;
+	return miso;
+}
+
+/**
+ ===============================================================================
+              ##### Model Control #####
+ ===============================================================================
+ */
+
+void flash_reset(void)
+{
+	memset(&flash, 0, sizeof(flash));
+	memset(flash.mem, 0xFF, sizeof(flash.mem));
+	flash_wel = 0;
+	flash_pos = 0;
+	dma_len = 0;
+}
+
+void flash_dmaComplete(void)
+{
+	uint16_t i;
+	uint8_t b;
+
+	if (dma_len == 0)
+		return;
+	for (i = 0; i < dma_len; i++)
+	{
+		b = flash_xfer(dma_tx != NULL ? dma_tx[i] : 0xFF);
+		if (dma_rx != NULL)
+			dma_rx[i] = b;
+	}
+	dma_len = 0;
+	if (dma_cb != NULL)
+		dma_cb(dma_ctx);
+}
+
+void flash_armCut(uint32_t operations, jmp_buf *jump)
+{
+	flash.cutCountdown = operations;
+	flash.cutJump = jump;
+}
+
+uint32_t flash_random(void)
+{
+	// xorshift32
+	flash_rng ^= flash_rng << 13;
+	flash_rng ^= flash_rng >> 17;
+	flash_rng ^= flash_rng << 5;
+	return flash_rng;
+}
+
+void flash_seed(uint32_t seed)
+{
+	flash_rng = seed ? seed : 1;
+}
+
+/**
+ ===============================================================================
+              ##### SPI and System Stand-ins #####
+ ===============================================================================
+ */
+
+void spi_initDevice(SPIDevice_t *dev, SPI_TypeDef *SPIx, uint32_t freq_hz, uint32_t datamode, uint32_t width, uint32_t bitorder, pin_t cs)
+{
+	(void)freq_hz;
+	(void)datamode;
+	(void)width;
+	(void)bitorder;
+	dev->SPIx = SPIx;
+	dev->cs = cs;
+}
+
+void spi_begin(SPIDevice_t *dev)
+{
+	(void)dev;
+	if (flash.cs)
+		flash.violations++; // Selected twice, the previous command never ended
+	flash.cs = 1;
+	flash_pos = 0;
+}
+
+void spi_end(SPIDevice_t *dev)
+{
+	(void)dev;
+	if (!flash.cs)
+		return;
+	flash_execute();
+	flash.cs = 0;
+	flash_pos = 0;
+}
+
+uint8_t spi_write8(SPI_TypeDef *SPIx, uint8_t data)
+{
+	(void)SPIx;
+	return flash_xfer(data);
+}
+
+uint8_t spi_read8(SPI_TypeDef *SPIx)
+{
+	(void)SPIx;
+	return flash_xfer(0xFF);
+}
+
+void spi_readMultiple8(SPI_TypeDef *SPIx, uint8_t *pRData, uint8_t pSize)
+{
+	(void)SPIx;
+	while (pSize--)
+		*pRData++ = flash_xfer(0xFF);
+}
+
+void spi_stream8(SPI_TypeDef *SPIx, const uint8_t *pTData, uint32_t pSize)
+{
+	(void)SPIx;
+	while (pSize--)
+		flash_xfer(*pTData++);
+}
+
+uint8_t spi_transferAsync(SPI_TypeDef *SPIx, const uint8_t *tx, uint8_t *rx, uint16_t len, spiCallback_t cb, void *ctx)
+{
+	(void)SPIx;
+	if (flash.dmaRefuse || dma_len != 0 || len == 0)
+		return 0;
+	dma_tx = tx;
+	dma_rx = rx;
+	dma_len = len;
+	dma_cb = cb;
+	dma_ctx = ctx;
+	return 1;
+}
+
+uint32_t millis(void)
+{
+	return host_ms;
+}
+
+void delay_ms(uint32_t ms)
+{
+	host_ms += ms;
+}
+
+/* Sleep: the pending DMA finishes, or a tick goes by */
+void host_wfi(void)
+{
+	if (dma_len != 0)
+		flash_dmaComplete();
+	else
+		host_ms++;
+}
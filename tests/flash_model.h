@@ -0,0 +1,53 @@
+/**
+  ******************************************************************************
+  * @file    flash_model.h
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   SPI NOR flash model behind the SPI stand-ins (W25Q command set, 256 KB)
+  ******************************************************************************
+*/
+
+#ifndef __FLASH_MODEL_H
+#define __FLASH_MODEL_H
+
+#include <stdint.h>
+#include <setjmp.h>
+
+#define FLASH_SIZE (256UL * 1024UL)
+#define FLASH_PROGRAM_POLLS 3 // Status reads a page program stays busy
+#define FLASH_ERASE_POLLS 50	// Status reads a 4 KB erase stays busy
+
+typedef struct
+{
+	uint8_t mem[FLASH_SIZE];
+	uint8_t absent;				/*!< No chip on the bus, MISO reads 0xFF */
+	uint8_t dmaRefuse;		/*!< spi_transferAsync() refuses, as with its channels taken */
+	uint8_t cs;						/*!< 1 while selected */
+	uint32_t busy;				/*!< Status reads left with WIP set */
+	uint32_t violations;	/*!< Commands the chip would ignore or misapply, a driver bug */
+	uint32_t fastReads;		/*!< 0x0B commands */
+	uint32_t programs;		/*!< Page programs executed */
+	uint32_t erases;			/*!< Sector, block or chip erases executed */
+	uint32_t cutCountdown; /*!< Program/erase operations before the power cut, 0 when not armed */
+	jmp_buf *cutJump;			/*!< Where the power cut lands */
+	uint32_t cutAddr;			/*!< Byte the last power cut tore */
+	uint8_t cutErase;			/*!< 1 if it tore an erase, 0 a program */
+} FlashModel_t;
+
+extern FlashModel_t flash;
+
+/* Erased chip, counters cleared */
+void flash_reset(void);
+
+/* Run the pending DMA read now, what __WFI() does */
+void flash_dmaComplete(void);
+
+/* Tear the n-th program or erase from now at a random byte and longjmp to jump */
+void flash_armCut(uint32_t operations, jmp_buf *jump);
+
+/* Deterministic random numbers for the tests */
+uint32_t flash_random(void);
+void flash_seed(uint32_t seed);
+
+#endif
@@ -0,0 +1,40 @@
+/**
+  ******************************************************************************
+  * @file    lprint_host.h
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   Host stand-ins of System.h and the CMSIS interrupt mask for lprint.c (forced include)
+  ******************************************************************************
+*/
+
+#ifndef __LPRINT_HOST_H
+#define __LPRINT_HOST_H
+
+// The real header is skipped, it needs the MCU
+#define __SYSTEM_H
+
+#include <stdint.h>
+
+extern uint32_t host_ms;
+
+static inline uint32_t millis(void)
+{
+	return host_ms;
+}
+
+static inline uint32_t __get_PRIMASK(void)
+{
+	return 0;
+}
+
+static inline void __set_PRIMASK(uint32_t primask)
+{
+	(void)primask;
+}
+
+static inline void __disable_irq(void)
+{
+}
+
+#endif
@@ -0,0 +1,48 @@
+/**
+  ******************************************************************************
+  * @file    modbus_host.h
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   Host stand-ins of uart.h and System.h for modbus.c (forced include)
+  ******************************************************************************
+*/
+
+#ifndef __MODBUS_HOST_H
+#define __MODBUS_HOST_H
+
+// The real headers are skipped, they need the MCU
+#define __UART_H
+#define __SYSTEM_H
+
+#include <stdint.h>
+
+#define UART_NO_TERMINATOR (-1)
+
+typedef struct
+{
+	uint8_t *buffer;
+	uint16_t mask;
+	volatile uint16_t head;
+	volatile uint16_t tail;
+} UARTTxQueue_t;
+
+typedef struct UARTPort_t
+{
+	UARTTxQueue_t tx;
+	uint32_t baudrate;
+} UARTPort_t;
+
+uint16_t uart_writeAsync(UARTPort_t *port, const uint8_t *buf, uint16_t len);
+uint8_t uart_enableRxDMA(UARTPort_t *port);
+void uart_enableFraming(UARTPort_t *port, int16_t terminator, uint32_t gap);
+void uart_disableFraming(UARTPort_t *port);
+void uart_attachRxFrame(UARTPort_t *port, void (*cb)(void));
+uint8_t uart_framesAvailable(UARTPort_t *port);
+uint16_t uart_readFrame(UARTPort_t *port, uint8_t *dst, uint16_t len, uint32_t timeout);
+uint32_t millis(void);
+void host_wfi(void);
+
+#define __WFI() host_wfi()
+
+#endif
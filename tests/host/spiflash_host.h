@@ -0,0 +1,56 @@
+/**
+  ******************************************************************************
+  * @file    spiflash_host.h
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   Host stand-ins of spi.h and System.h for spiflash.c and logstore.c (forced include)
+  ******************************************************************************
+*/
+
+#ifndef __SPIFLASH_HOST_H
+#define __SPIFLASH_HOST_H
+
+// The real headers are skipped, they need the MCU
+#define __SPI_H
+#define __SYSTEM_H
+
+#include <stdint.h>
+
+typedef uint8_t pin_t;
+typedef struct
+{
+	uint32_t unused;
+} SPI_TypeDef;
+
+extern SPI_TypeDef host_spi1;
+#define SPI1 (&host_spi1)
+
+#define SPI_DATAMODE0 0U
+#define LL_SPI_DATAWIDTH_8BIT 0U
+#define LL_SPI_MSB_FIRST 0U
+
+typedef void (*spiCallback_t)(void *ctx);
+
+typedef struct SPIDevice_t
+{
+	SPI_TypeDef *SPIx;
+	pin_t cs;
+} SPIDevice_t;
+
+void spi_initDevice(SPIDevice_t *dev, SPI_TypeDef *SPIx, uint32_t freq_hz, uint32_t datamode, uint32_t width, uint32_t bitorder, pin_t cs);
+void spi_begin(SPIDevice_t *dev);
+void spi_end(SPIDevice_t *dev);
+uint8_t spi_write8(SPI_TypeDef *SPIx, uint8_t data);
+uint8_t spi_read8(SPI_TypeDef *SPIx);
+void spi_readMultiple8(SPI_TypeDef *SPIx, uint8_t *pRData, uint8_t pSize);
+void spi_stream8(SPI_TypeDef *SPIx, const uint8_t *pTData, uint32_t pSize);
+uint8_t spi_transferAsync(SPI_TypeDef *SPIx, const uint8_t *tx, uint8_t *rx, uint16_t len, spiCallback_t cb, void *ctx);
+
+uint32_t millis(void);
+void delay_ms(uint32_t ms);
+void host_wfi(void);
+
+#define __WFI() host_wfi()
+
+#endif
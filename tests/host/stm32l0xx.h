@@ -0,0 +1,25 @@
+/**
+  ******************************************************************************
+  * @file    stm32l0xx.h
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   Host stand-in of the CMSIS device header, the few definitions the register-free
+  *          helpers use (found first with -Ihost)
+  ******************************************************************************
+*/
+
+#ifndef __STM32L0xx_H
+#define __STM32L0xx_H
+
+#include <stdint.h>
+
+#define __STATIC_INLINE static inline
+
+#define I2C_TIMINGR_SCLL_Pos (0U)
+#define I2C_TIMINGR_SCLH_Pos (8U)
+#define I2C_TIMINGR_SDADEL_Pos (16U)
+#define I2C_TIMINGR_SCLDEL_Pos (20U)
+#define I2C_TIMINGR_PRESC_Pos (28U)
+
+#endif
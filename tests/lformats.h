@@ -0,0 +1,6 @@
+// Catalog of test_lprint.c, also read by tools/lprint_decode.py
+LFMT(BOOT, "boot v{d}")
+LFMT(TEMP, "temp {f} C, raw {x}")
+LFMT(CLOCK, "{D}:{D}:{D}")
+LFMT(MANY, "{d} {d} {d} {d} {d} {d} {d} {d}")
+LFMT(EMPTY, "no arguments")
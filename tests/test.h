@@ -0,0 +1,38 @@
+/**
+  ******************************************************************************
+  * @file    test.h
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   Minimal checks for the host tests
+  ******************************************************************************
+*/
+
+#ifndef __TEST_H
+#define __TEST_H
+
+#include <stdio.h>
+#include <string.h>
+
+static int test_failures;
+
+#define CHECK(__C__)                                                   \
+	do                                                                   \
+	{                                                                    \
+		if (!(__C__))                                                      \
+		{                                                                  \
+			test_failures++;                                                 \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #__C__); \
+		}                                                                  \
+	} while (0)
+
+#define CHECK_MEM(__A__, __B__, __LEN__) CHECK(memcmp((__A__), (__B__), (__LEN__)) == 0)
+
+/* Print the result, returns the exit code of main() */
+static int test_end(const char *name)
+{
+	printf("%s: %s\n", name, test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
+
+#endif
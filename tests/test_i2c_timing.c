@@ -0,0 +1,159 @@
+/**
+  ******************************************************************************
+  * @file    test_i2c_timing.c
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   I2C TIMINGR solver against the I2C specification and the RM0377 timing tables
+  ******************************************************************************
+*/
+
+#include "test.h"
+#include "i2c_timing.h"
+
+/* Rise times i2c_setSpeed() uses, fall time 100 ns */
+#define RISE(__SPEED__) (((__SPEED__) <= 100000) ? 400U : ((__SPEED__) <= 400000) ? 250U : 60U)
+#define FALL 100U
+
+typedef struct
+{
+	uint32_t presc, scldel, sdadel, sclh, scll;
+} Timing_t;
+
+/* RM0377 "Examples of timings settings", analog filter on */
+static const struct
+{
+	uint32_t clk;
+	uint32_t speed;
+	uint32_t timingr;
+} rm0377[] = {
+		{8000000, 10000, 0x1042C3C7},
+		{8000000, 100000, 0x10420F13},
+		{8000000, 400000, 0x00310309},
+		{16000000, 10000, 0x3042C3C7},
+		{16000000, 100000, 0x30420F13},
+		{16000000, 400000, 0x10320309},
+		{16000000, 1000000, 0x00200204},
+};
+
+static Timing_t decode(uint32_t timingr)
+{
+	Timing_t t;
+
+	t.presc = (timingr >> I2C_TIMINGR_PRESC_Pos) & 0xF;
+	t.scldel = (timingr >> I2C_TIMINGR_SCLDEL_Pos) & 0xF;
+	t.sdadel = (timingr >> I2C_TIMINGR_SDADEL_Pos) & 0xF;
+	t.sclh = (timingr >> I2C_TIMINGR_SCLH_Pos) & 0xFF;
+	t.scll = (timingr >> I2C_TIMINGR_SCLL_Pos) & 0xFF;
+	return t;
+}
+
+/* SCL period (ns) with a synchronization delay of tAF plus sync_clk kernel clocks on each edge */
+static double period_ns(uint32_t timingr, uint32_t clk, double af, double sync_clk, uint32_t speed)
+{
+	Timing_t t = decode(timingr);
+	double tclk = 1e9 / clk, tpresc = (t.presc + 1) * tclk;
+
+	return 2 * (af + sync_clk * tclk) + (t.scll + 1 + t.sclh + 1) * tpresc + RISE(speed) + FALL;
+}
+
+/* RM0377 I2C timings: setup, hold, SCL low and high of the mode, SCL not above the requested speed */
+static int meets_spec(uint32_t timingr, uint32_t clk, uint32_t speed)
+{
+	const I2CMode_t *mode = &i2c_modes[(speed <= 100000) ? 0 : (speed <= 400000) ? 1 : 2];
+	Timing_t t = decode(timingr);
+	double tclk = 1e9 / clk, tpresc = (t.presc + 1) * tclk;
+	double tsync = I2C_AF_MIN + 2 * tclk;
+
+	if ((t.scldel + 1) * tpresc < RISE(speed) + mode->sudatMin)
+		return 0;
+	if (t.sdadel * tpresc < (double)FALL + mode->hddatMin - I2C_AF_MIN - 3 * tclk)
+		return 0;
+	if (t.sdadel * tpresc > (double)mode->vddatMax - RISE(speed) - I2C_AF_MAX - 4 * tclk)
+		return 0;
+	if ((t.scll + 1) * tpresc + tsync < mode->lsclMin || (t.sclh + 1) * tpresc + tsync < mode->hsclMin)
+		return 0;
+	if (period_ns(timingr, clk, I2C_AF_MIN, 2, speed) < 1e9 / speed)
+		return 0;
+	return 1;
+}
+
+/* Same SCL speed as the reference values, within 10 % */
+static void test_referenceTables(void)
+{
+	uint32_t i, timingr;
+	double ours, ref;
+
+	for (i = 0; i < sizeof(rm0377) / sizeof(rm0377[0]); i++)
+	{
+		timingr = i2c_solveTiming(rm0377[i].clk, rm0377[i].speed, RISE(rm0377[i].speed), FALL);
+		CHECK(timingr != 0);
+		CHECK(meets_spec(timingr, rm0377[i].clk, rm0377[i].speed));
+		ours = period_ns(timingr, rm0377[i].clk, (I2C_AF_MIN + I2C_AF_MAX) / 2.0, 2.5, rm0377[i].speed);
+		ref = period_ns(rm0377[i].timingr, rm0377[i].clk, (I2C_AF_MIN + I2C_AF_MAX) / 2.0, 2.5, rm0377[i].speed);
+		if (ours > ref * 1.1 || ours < ref * 0.9)
+			printf("%lu Hz at %lu Hz: 0x%08lX, %.0f ns against %.0f ns\n", (unsigned long)rm0377[i].speed,
+						 (unsigned long)rm0377[i].clk, (unsigned long)timingr, ours, ref);
+		CHECK(ours <= ref * 1.1 && ours >= ref * 0.9);
+	}
+}
+
+/* Every kernel clock of the L0 (MSI ranges, HSI16, PLL) and bus speed */
+static void test_sweep(void)
+{
+	static const uint32_t clocks[] = {65536, 131072, 262144, 524288, 1048576, 2097152, 4194304,
+																		2000000, 4000000, 8000000, 12000000, 16000000, 24000000, 32000000};
+	static const uint32_t speeds[] = {10000, 50000, 100000, 200000, 400000, 500000, 1000000};
+	uint32_t i, j, timingr;
+
+	for (i = 0; i < sizeof(clocks) / sizeof(clocks[0]); i++)
+		for (j = 0; j < sizeof(speeds) / sizeof(speeds[0]); j++)
+		{
+			timingr = i2c_solveTiming(clocks[i], speeds[j], RISE(speeds[j]), FALL);
+			if (timingr != 0 && !meets_spec(timingr, clocks[i], speeds[j]))
+			{
+				printf("%lu Hz at %lu Hz: 0x%08lX out of spec\n", (unsigned long)speeds[j], (unsigned long)clocks[i],
+							 (unsigned long)timingr);
+				CHECK(0);
+			}
+		}
+
+	// 2 MHz is too slow for the 0.5 us SCL low of fast mode plus
+	CHECK(i2c_solveTiming(16000000, 100000, 400, FALL) != 0);
+	CHECK(i2c_solveTiming(16000000, 1000000, 60, FALL) != 0);
+	CHECK(i2c_solveTiming(2000000, 1000000, 60, FALL) == 0);
+
+	// Arguments out of range
+	CHECK(i2c_solveTiming(0, 100000, 400, FALL) == 0);
+	CHECK(i2c_solveTiming(16000000, 0, 400, FALL) == 0);
+	CHECK(i2c_solveTiming(16000000, 1000001, 60, FALL) == 0);
+	CHECK(i2c_solveTiming(16000000, 10000, 1000, FALL) != 0);
+	CHECK(i2c_solveTiming(16000000, 9999, 1000, FALL) == 0);
+	CHECK(i2c_solveTiming(16000000, 100, 1000, FALL) == 0);
+
+	// Values of the fixed table kept by the solver
+	CHECK(i2c_solveTiming(16000000, 1000000, 60, FALL) == 0x00100205);
+}
+
+/* The data hold minimum is negative without a fall time: SDADEL 0, not a wrapped huge value */
+static void test_holdClamp(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < 3; i++)
+	{
+		CHECK(decode(i2c_solveTiming(16000000, i == 0 ? 100000 : i == 1 ? 400000 : 1000000, 0, 0)).sdadel == 0);
+		CHECK(decode(i2c_solveTiming(32000000, i == 0 ? 100000 : i == 1 ? 400000 : 1000000, 0, 0)).sdadel == 0);
+	}
+
+	// A long fall time moves the data later
+	CHECK(decode(i2c_solveTiming(16000000, 100000, 400, 300)).sdadel > decode(i2c_solveTiming(16000000, 100000, 400, 0)).sdadel);
+}
+
+int main(void)
+{
+	test_referenceTables();
+	test_sweep();
+	test_holdClamp();
+	return test_end("i2c_timing");
+}
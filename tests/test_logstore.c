@@ -0,0 +1,213 @@
+/**
+  ******************************************************************************
+  * @file    test_logstore.c
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   Log store against the flash model, with the power cut at random bytes of the
+  *          erases, sector headers, record headers and record data
+  ******************************************************************************
+*/
+
+#include "test.h"
+#include "flash_model.h"
+#include "logstore.h"
+
+#define LOG_START 0x8000UL
+#define LOG_SECTORS 6
+#define RECORD_MAX 300
+#define POWER_CUTS 3000
+#define COUNTERS 0x40000UL
+
+// Records always fitting in the sectors behind the head, a torn sector is the next to be erased
+#define RECORDS_KEPT ((LOG_SECTORS - 2) * ((SPIFLASH_SECTOR_SIZE - LOGSTORE_SECTOR_HEADER) / (LOGSTORE_RECORD_HEADER + RECORD_MAX)))
+
+static SPIFlash_t fl;
+static LogStore_t ls;
+static jmp_buf powerCut;
+static uint8_t record[RECORD_MAX];
+static uint8_t buf[LOGSTORE_MAX_RECORD];
+
+// Every record carries its counter, the counters of appends cut by the power are marked
+static uint8_t cutMark[COUNTERS];
+static uint32_t counter = 1;
+static uint32_t acked;
+
+static uint32_t cutsErase, cutsSectorHeader, cutsRecordHeader, cutsData;
+
+/* Record number n: its counter, then bytes that only depend on n */
+static uint16_t record_make(uint32_t n, uint8_t *data)
+{
+	uint16_t len = (uint16_t)(4U + ((n * 2654435761UL) >> 16) % (RECORD_MAX - 3U));
+	uint16_t i;
+
+	memcpy(data, &n, 4);
+	for (i = 4; i < len; i++)
+		data[i] = (uint8_t)(n * 31U + i * 7U);
+	return len;
+}
+
+static void mount(void)
+{
+	CHECK(spiflash_init(&fl, SPI1, 8000000, 0) == SPIFLASH_OK);
+	CHECK(logstore_init(&ls, &fl, LOG_START, LOG_SECTORS) == SPIFLASH_OK);
+}
+
+static void append(void)
+{
+	uint16_t len = record_make(counter, record);
+
+	CHECK(logstore_append(&ls, record, len) == SPIFLASH_OK);
+	acked = counter++;
+}
+
+/* Read from the cursor to the end, returns the records read. Records come in order with their
+ * data intact, only cut appends may be missing and nothing after the last append */
+static uint32_t log_check(uint32_t *first, uint32_t *last)
+{
+	uint32_t n, k, seq, prevSeq = 0, count = 0;
+	int32_t len;
+	uint8_t ordered = 1, intact = 1;
+
+	*first = 0;
+	*last = 0;
+	while ((len = logstore_read(&ls, buf, sizeof(buf), &seq)) > 0)
+	{
+		memcpy(&n, buf, 4);
+		if (n == 0 || n >= counter || len != record_make(n, record) || memcmp(buf, record, (size_t)len) != 0)
+		{
+			intact = 0;
+			break;
+		}
+		if (count == 0)
+			*first = n;
+		else
+		{
+			if (n <= *last || seq <= prevSeq)
+				ordered = 0;
+			for (k = *last + 1; k < n && ordered; k++)
+				if (!cutMark[k])
+					ordered = 0;
+		}
+		*last = n;
+		prevSeq = seq;
+		count++;
+	}
+	CHECK(intact);
+	CHECK(ordered);
+	CHECK(len == LOGSTORE_END);
+	return count;
+}
+
+/* A fresh or formatted log reads what is appended, without a rewind */
+static void test_empty(void)
+{
+	uint32_t first, last;
+
+	flash_reset();
+	mount();
+	CHECK(logstore_read(&ls, buf, sizeof(buf), NULL) == LOGSTORE_END);
+	append();
+	append();
+	append();
+	CHECK(log_check(&first, &last) == 3);
+	CHECK(first == 1 && last == 3);
+	append();
+	CHECK(log_check(&first, &last) == 1);
+	CHECK(first == 4);
+
+	CHECK(logstore_format(&ls) == SPIFLASH_OK);
+	CHECK(log_check(&first, &last) == 0);
+	append();
+	append();
+	CHECK(log_check(&first, &last) == 2);
+	CHECK(first == 5 && last == 6);
+
+	// Mounted again: the same records
+	mount();
+	CHECK(log_check(&first, &last) == 2);
+	CHECK(first == 5 && last == 6);
+
+	// Region off the chip: not mounted, nothing is written
+	CHECK(logstore_init(&ls, &fl, FLASH_SIZE - SPIFLASH_SECTOR_SIZE, 2) == SPIFLASH_ERROR);
+	CHECK(logstore_append(&ls, record, 4) == SPIFLASH_ERROR);
+	CHECK(logstore_format(&ls) == SPIFLASH_ERROR);
+}
+
+/* Append until the power fails, mount again and check what survived, many times */
+static void test_powerCuts(void)
+{
+	static uint32_t cuts;
+	static uint16_t len;
+	uint32_t base, count, first, last;
+
+	flash_reset();
+	flash_seed(0x1F2E3D4CUL);
+	mount();
+	counter = 1;
+	acked = 0;
+	memset(cutMark, 0, sizeof(cutMark));
+
+	for (cuts = 0; cuts < POWER_CUTS && counter < COUNTERS - 100; cuts++)
+	{
+		flash_armCut(1 + flash_random() % 60, &powerCut);
+		if (setjmp(powerCut) == 0)
+		{
+			for (;;)
+			{
+				len = record_make(counter, record);
+				if (logstore_append(&ls, record, len) != SPIFLASH_OK)
+					break;
+				acked = counter++;
+			}
+			CHECK(0); // Only the power cut ends the appends
+			break;
+		}
+		cutMark[counter++] = 1;
+
+		// Where it tore, the append left the record position in the log descriptor
+		base = (flash.cutAddr - LOG_START) % SPIFLASH_SECTOR_SIZE;
+		if (flash.cutErase)
+			cutsErase++;
+		else if (base < LOGSTORE_SECTOR_HEADER)
+			cutsSectorHeader++;
+		else if (base < (uint32_t)ls.offset - len)
+			cutsRecordHeader++;
+		else
+			cutsData++;
+
+		mount();
+		count = log_check(&first, &last);
+		CHECK(last >= acked);
+		CHECK(count == 0 || last - first + 1 >= (acked < RECORDS_KEPT ? acked : RECORDS_KEPT));
+
+		// Appends go on after the recovery
+		if (cuts % 8 == 0)
+		{
+			append();
+			count = log_check(&first, &last);
+			CHECK(count == 1 && last == acked);
+		}
+		if (test_failures)
+		{
+			printf("power cut %u at 0x%05X (%s)\n", (unsigned)cuts, (unsigned)flash.cutAddr, flash.cutErase ? "erase" : "program");
+			break;
+		}
+	}
+
+	CHECK(cutsErase > 0);
+	CHECK(cutsSectorHeader > 0);
+	CHECK(cutsRecordHeader > 0);
+	CHECK(cutsData > 0);
+	printf("logstore: %u power cuts: %u erases, %u sector headers, %u record headers, %u data, %u records\n",
+				 (unsigned)cuts, (unsigned)cutsErase, (unsigned)cutsSectorHeader, (unsigned)cutsRecordHeader,
+				 (unsigned)cutsData, (unsigned)(counter - 1));
+}
+
+int main(void)
+{
+	test_empty();
+	test_powerCuts();
+	CHECK(flash.violations == 0);
+	return test_end("logstore");
+}
@@ -0,0 +1,234 @@
+/**
+  ******************************************************************************
+  * @file    test_lprint.c
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   Binary log encoder (varints, zigzag, COBS) and its round trip through
+  *          tools/lprint_decode.py, which must print what lprint() prints
+  ******************************************************************************
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "test.h"
+#include "lprint.h"
+
+#define LFMT(__name__, __fmt__) LOG_##__name__,
+enum
+{
+#include "lformats.h"
+};
+#undef LFMT
+
+#define LFMT(__name__, __fmt__) __fmt__,
+static const char *formats[] = {
+#include "lformats.h"
+};
+#undef LFMT
+
+#define CAPTURE "build/lprint.bin"
+#define DECODER "python3 ../tools/lprint_decode.py lformats.h " CAPTURE
+
+uint32_t host_ms;
+
+static char out[4096];
+static uint16_t outLen;
+
+void LPUTC(char c)
+{
+	if (outLen < sizeof(out))
+		out[outLen++] = c;
+}
+
+void LPUTS(const char *s, uint16_t len)
+{
+	while (len--)
+		LPUTC(*s++);
+}
+
+/* Undo COBS, returns the payload length or -1 */
+static int cobs_decode(const uint8_t *src, int len, uint8_t *dst)
+{
+	int i = 0, n = 0, k;
+	uint8_t code;
+
+	while (i < len)
+	{
+		code = src[i++];
+		if (code == 0 || i + code - 1 > len)
+			return -1;
+		for (k = 1; k < code; k++)
+			dst[n++] = src[i++];
+		if (code < 0xFF && i < len)
+			dst[n++] = 0;
+	}
+	return n;
+}
+
+/* Varints of the payload, returns how many */
+static int varints(const uint8_t *src, int len, uint32_t *values)
+{
+	int i, count = 0, shift = 0;
+	uint32_t v = 0;
+
+	for (i = 0; i < len; i++)
+	{
+		v |= (uint32_t)(src[i] & 0x7F) << shift;
+		shift += 7;
+		if (!(src[i] & 0x80))
+		{
+			values[count++] = v;
+			v = 0;
+			shift = 0;
+		}
+	}
+	return shift ? -1 : count;
+}
+
+/* Encoding of one record, byte by byte */
+static void test_encoding(void)
+{
+	uint8_t payload[64];
+	uint32_t values[16];
+	int n, i;
+
+	outLen = 0;
+	host_ms = 1000;
+	LLOG(LOG_TEMP, 0, 1);
+	lprint_flush();
+	outLen = 0;
+
+	// TEMP 300 ms (0xAC 0x02) 0 (zigzag 0, a zero byte for COBS) -1 (1), then BOOT 0 ms 64 (128: 0x80 0x01)
+	host_ms += 300;
+	LLOG(LOG_TEMP, 0, -1);
+	LLOG(LOG_BOOT, 64);
+	lprint_flush();
+	{
+		static const uint8_t expected[] = {0x04, 0x01, 0xAC, 0x02, 0x02, 0x01, 0x00,
+																			 0x01, 0x01, 0x03, 0x80, 0x01, 0x00};
+		CHECK(outLen == sizeof(expected));
+		CHECK_MEM(out, expected, sizeof(expected));
+	}
+
+	n = cobs_decode((const uint8_t *)out, 6, payload);
+	CHECK(n == 5);
+	CHECK(varints(payload, n, values) == 4);
+	CHECK(values[0] == LOG_TEMP && values[1] == 300 && values[2] == 0 && values[3] == 1);
+
+	n = cobs_decode((const uint8_t *)&out[7], outLen - 8, payload);
+	CHECK(n == 4);
+	CHECK(varints(payload, n, values) == 3);
+	CHECK(values[0] == LOG_BOOT && values[1] == 0 && values[2] == 128);
+
+	// Extremes of the zigzag, eight arguments
+	outLen = 0;
+	LLOG(LOG_MANY, INT32_MIN, INT32_MAX, -64, 63, -65, 64, 0, -2);
+	lprint_flush();
+	n = cobs_decode((const uint8_t *)out, outLen - 1, payload);
+	CHECK(varints(payload, n, values) == 10);
+	CHECK(values[2] == 0xFFFFFFFFUL && values[3] == 0xFFFFFFFEUL);
+	CHECK(values[4] == 127 && values[5] == 126 && values[6] == 129 && values[7] == 128);
+	CHECK(values[8] == 0 && values[9] == 3);
+	for (i = 0; i < outLen - 1; i++)
+		CHECK(out[i] != 0);
+}
+
+/* A full buffer drops whole records */
+static void test_dropped(void)
+{
+	uint32_t dropped = lprint_dropped();
+	int i;
+
+	outLen = 0;
+	for (i = 0; i < 100; i++)
+		LLOG(LOG_MANY, INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN);
+	CHECK(lprint_dropped() > dropped);
+	lprint_flush();
+	CHECK(outLen % 44 == 0); // id, time 0, 8 * 5 and COBS 2
+	CHECK(outLen / 44 + (lprint_dropped() - dropped) == 100);
+}
+
+/* The decoder prints what lprint() prints for the same values */
+static void test_decoder(void)
+{
+	static const int32_t args[][8] = {
+			{7},
+			{2345, 0xBEEF},
+			{-2150, -5},
+			{-5, 0, 59},
+			{3, -3, 100, -100, 0},
+			{INT32_MIN, INT32_MAX, -1, 1, -128, 127, 99, -99},
+	};
+	static const uint16_t ids[] = {LOG_BOOT, LOG_TEMP, LOG_TEMP, LOG_CLOCK, LOG_CLOCK, LOG_MANY};
+	static const uint8_t argc[] = {1, 2, 2, 3, 3, 8};
+	char expected[2048], line[256], *text;
+	uint16_t expLen = 0;
+	FILE *f;
+	int i, lines = 0;
+	size_t len;
+
+	// The LLOG() arguments through lprint(), one line each
+	for (i = 0; i < 6; i++)
+	{
+		outLen = 0;
+		lprint(formats[ids[i]], args[i][0], args[i][1], args[i][2], args[i][3], args[i][4], args[i][5], args[i][6], args[i][7]);
+		memcpy(&expected[expLen], out, outLen);
+		expLen += outLen;
+		expected[expLen++] = '\n';
+	}
+	memcpy(&expected[expLen], "no arguments\n", 13);
+	expLen += 13;
+	expected[expLen] = 0;
+
+	lprint_flush();
+	outLen = 0;
+	host_ms = 5000;
+	for (i = 0; i < 6; i++)
+	{
+		host_ms += 250;
+		lprint_log(argc[i], ids[i], args[i][0], args[i][1], args[i][2], args[i][3], args[i][4], args[i][5], args[i][6], args[i][7]);
+		lprint_flush();
+	}
+	LLOG(LOG_EMPTY);
+	lprint_flush();
+
+	f = fopen(CAPTURE, "wb");
+	CHECK(f != NULL);
+	if (f == NULL)
+		return;
+	fwrite(out, 1, outLen, f);
+	fclose(f);
+
+	f = popen(DECODER, "r");
+	CHECK(f != NULL);
+	if (f == NULL)
+		return;
+	expLen = 0;
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		// "[    t.ttt] text": the time is left out, lprint() has none
+		text = strchr(line, ']');
+		CHECK(text != NULL && text[1] == ' ');
+		if (text == NULL)
+			break;
+		text += 2;
+		len = strlen(text);
+		if (strncmp(&expected[expLen], text, len) != 0)
+			printf("decoded: %sexpected: %.*s\n", text, (int)(strchr(&expected[expLen], '\n') - &expected[expLen] + 1), &expected[expLen]);
+		CHECK(strncmp(&expected[expLen], text, len) == 0);
+		expLen += (uint16_t)len;
+		lines++;
+	}
+	CHECK(pclose(f) == 0);
+	CHECK(lines == 7);
+	CHECK(expected[expLen] == 0);
+}
+
+int main(void)
+{
+	test_encoding();
+	test_dropped();
+	test_decoder();
+	return test_end("lprint");
+}
@@ -0,0 +1,229 @@
+/**
+  ******************************************************************************
+  * @file    test_modbus.c
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   Modbus RTU engine on the host, fed with known-good ADUs
+  ******************************************************************************
+*/
+
+#include "test.h"
+#include "modbus.h"
+#include "eon_crc16.h"
+
+/**
+ ===============================================================================
+              ##### UART Stand-in #####
+ ===============================================================================
+ */
+
+static uint8_t host_txBuffer[256];
+static UARTPort_t host_port = {{host_txBuffer, 255, 0, 0}, 9600};
+
+static void (*host_frameCb)(void);
+static uint8_t host_rx[256];
+static uint16_t host_rxLen;
+static uint8_t host_rxPending;
+static uint8_t host_tx[256];
+static uint16_t host_txLen;
+static uint32_t host_ms;
+
+uint16_t uart_writeAsync(UARTPort_t *port, const uint8_t *buf, uint16_t len)
+{
+	(void)port;
+	memcpy(&host_tx[host_txLen], buf, len);
+	host_txLen = (uint16_t)(host_txLen + len);
+	return len;
+}
+
+uint8_t uart_enableRxDMA(UARTPort_t *port)
+{
+	(void)port;
+	return 1;
+}
+
+void uart_enableFraming(UARTPort_t *port, int16_t terminator, uint32_t gap)
+{
+	(void)port;
+	(void)terminator;
+	(void)gap;
+}
+
+void uart_disableFraming(UARTPort_t *port)
+{
+	(void)port;
+}
+
+void uart_attachRxFrame(UARTPort_t *port, void (*cb)(void))
+{
+	(void)port;
+	host_frameCb = cb;
+}
+
+uint8_t uart_framesAvailable(UARTPort_t *port)
+{
+	(void)port;
+	return host_rxPending;
+}
+
+uint16_t uart_readFrame(UARTPort_t *port, uint8_t *dst, uint16_t len, uint32_t timeout)
+{
+	(void)port;
+	(void)timeout;
+	if (len > host_rxLen)
+		len = host_rxLen;
+	memcpy(dst, host_rx, len);
+	host_rxPending = 0;
+	return len;
+}
+
+uint32_t millis(void)
+{
+	return host_ms;
+}
+
+/* The master sleeps here while it waits: the queued response arrives */
+void host_wfi(void)
+{
+	host_ms++;
+	if (host_rxPending && host_frameCb != NULL)
+		host_frameCb();
+}
+
+/* Queue an ADU as one received frame */
+static void host_receive(const uint8_t *adu, uint16_t len)
+{
+	memcpy(host_rx, adu, len);
+	host_rxLen = len;
+	host_rxPending = 1;
+	host_txLen = 0;
+}
+
+/**
+ ===============================================================================
+              ##### Tests #####
+ ===============================================================================
+ */
+
+static void test_crcTable(void)
+{
+	uint16_t value, ref;
+	uint8_t bit;
+
+	for (value = 0; value < 256; value++)
+	{
+		ref = value;
+		for (bit = 0; bit < 8; bit++)
+			ref = (ref & 1) ? (uint16_t)((ref >> 1) ^ 0xA001) : (uint16_t)(ref >> 1);
+		CHECK(crc16_update(0, (uint8_t)value) == ref);
+	}
+}
+
+static void test_slave(void)
+{
+	static const uint16_t input[2] = {0x1234, 0x5678};
+	static uint16_t holding[4];
+	static ModbusMap_t map = {holding, 4, input, 2, NULL};
+
+	static const uint8_t readHolding[] = {0x01, 0x03, 0x00, 0x00, 0x00, 0x01, 0x84, 0x0A};
+	static const uint8_t readHoldingResp[] = {0x01, 0x03, 0x02, 0x00, 0x2A, 0x39, 0x9B};
+	static const uint8_t readInput[] = {0x01, 0x04, 0x00, 0x00, 0x00, 0x01, 0x31, 0xCA};
+	static const uint8_t readInputResp[] = {0x01, 0x04, 0x02, 0x12, 0x34, 0xB4, 0x47};
+	static const uint8_t writeSingle[] = {0x01, 0x06, 0x00, 0x01, 0x00, 0x03, 0x98, 0x0B};
+	static const uint8_t writeMultiple[] = {0x01, 0x10, 0x00, 0x01, 0x00, 0x02, 0x04, 0x00, 0x0A, 0x01, 0x02, 0x92, 0x30};
+	static const uint8_t writeMultipleResp[] = {0x01, 0x10, 0x00, 0x01, 0x00, 0x02, 0x10, 0x08};
+	static const uint8_t readBeyond[] = {0x01, 0x03, 0x00, 0x04, 0x00, 0x01, 0xC5, 0xCB};
+	static const uint8_t readBeyondResp[] = {0x01, 0x83, 0x02, 0xC0, 0xF1};
+	static const uint8_t otherSlave[] = {0x02, 0x03, 0x00, 0x00, 0x00, 0x01, 0x84, 0x39};
+	uint8_t corrupt[sizeof(readHolding)];
+	uint32_t errors;
+
+	modbus_initSlave(&host_port, 1, &map);
+	holding[0] = 0x002A;
+
+	host_receive(readHolding, sizeof(readHolding));
+	host_frameCb();
+	CHECK(host_txLen == sizeof(readHoldingResp));
+	CHECK_MEM(host_tx, readHoldingResp, sizeof(readHoldingResp));
+
+	host_receive(readInput, sizeof(readInput));
+	host_frameCb();
+	CHECK(host_txLen == sizeof(readInputResp));
+	CHECK_MEM(host_tx, readInputResp, sizeof(readInputResp));
+
+	// Responses to writes echo the request (0x06) or its first 6 bytes (0x10)
+	host_receive(writeSingle, sizeof(writeSingle));
+	host_frameCb();
+	CHECK(holding[1] == 0x0003);
+	CHECK(host_txLen == sizeof(writeSingle));
+	CHECK_MEM(host_tx, writeSingle, sizeof(writeSingle));
+
+	host_receive(writeMultiple, sizeof(writeMultiple));
+	host_frameCb();
+	CHECK(holding[1] == 0x000A);
+	CHECK(holding[2] == 0x0102);
+	CHECK(host_txLen == sizeof(writeMultipleResp));
+	CHECK_MEM(host_tx, writeMultipleResp, sizeof(writeMultipleResp));
+
+	host_receive(readBeyond, sizeof(readBeyond));
+	host_frameCb();
+	CHECK(host_txLen == sizeof(readBeyondResp));
+	CHECK_MEM(host_tx, readBeyondResp, sizeof(readBeyondResp));
+
+	host_receive(otherSlave, sizeof(otherSlave));
+	host_frameCb();
+	CHECK(host_txLen == 0);
+
+	// A wrong CRC is counted and not answered
+	errors = modbus_errorCount();
+	memcpy(corrupt, readHolding, sizeof(corrupt));
+	corrupt[5] ^= 0x01;
+	host_receive(corrupt, sizeof(corrupt));
+	host_frameCb();
+	CHECK(host_txLen == 0);
+	CHECK(modbus_errorCount() == errors + 1);
+
+	modbus_end();
+}
+
+static void test_master(void)
+{
+	static const uint8_t request[] = {0x01, 0x03, 0x00, 0x00, 0x00, 0x01, 0x84, 0x0A};
+	static const uint8_t response[] = {0x01, 0x03, 0x02, 0x00, 0x2A, 0x39, 0x9B};
+	static const uint8_t writeSingle[] = {0x01, 0x06, 0x00, 0x01, 0x00, 0x03, 0x98, 0x0B};
+	static const uint8_t exception[] = {0x01, 0x83, 0x02, 0xC0, 0xF1};
+	uint16_t value = 0;
+
+	modbus_initMaster(&host_port);
+
+	host_receive(response, sizeof(response));
+	CHECK(modbus_readRegisters(1, MODBUS_READ_HOLDING, 0, 1, &value, 100) == MODBUS_OK);
+	CHECK(value == 0x002A);
+	CHECK(host_txLen == sizeof(request));
+	CHECK_MEM(host_tx, request, sizeof(request));
+
+	value = 0x0003;
+	host_receive(writeSingle, sizeof(writeSingle));
+	CHECK(modbus_writeRegisters(1, 1, 1, &value, 100) == MODBUS_OK);
+	CHECK(host_txLen == sizeof(writeSingle));
+	CHECK_MEM(host_tx, writeSingle, sizeof(writeSingle));
+
+	host_receive(exception, sizeof(exception));
+	CHECK(modbus_readRegisters(1, MODBUS_READ_HOLDING, 4, 1, &value, 100) == MODBUS_EX_ILLEGAL_ADDRESS);
+
+	// Nothing comes back
+	host_receive(response, sizeof(response));
+	host_rxPending = 0;
+	CHECK(modbus_readRegisters(1, MODBUS_READ_HOLDING, 0, 1, &value, 100) == MODBUS_TIMEOUT);
+
+	modbus_end();
+}
+
+int main(void)
+{
+	test_crcTable();
+	test_slave();
+	test_master();
+	return test_end("modbus");
+}
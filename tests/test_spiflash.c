@@ -0,0 +1,198 @@
+/**
+  ******************************************************************************
+  * @file    test_spiflash.c
+  * @author  Pablo Fuentes
+	* @version V1.0.0
+  * @date    2019
+  * @brief   SPI NOR flash driver against the flash model: cache, page split writes and busy paths
+  ******************************************************************************
+*/
+
+#include "test.h"
+#include "flash_model.h"
+#include "spiflash.h"
+
+static SPIFlash_t fl;
+static uint8_t buf[4096];
+static uint8_t pattern[4096];
+
+static volatile uint8_t asyncDone;
+
+static void onRead(void *ctx)
+{
+	(void)ctx;
+	asyncDone = 1;
+}
+
+static void test_init(void)
+{
+	flash_reset();
+	flash.absent = 1;
+	CHECK(spiflash_init(&fl, SPI1, 8000000, 0) == SPIFLASH_ERROR);
+	CHECK(fl.size == 0);
+	CHECK(spiflash_read(&fl, 0, buf, 1) == SPIFLASH_ERROR);
+
+	flash_reset();
+	CHECK(spiflash_init(&fl, SPI1, 8000000, 0) == SPIFLASH_OK);
+	CHECK(fl.jedec == 0xEF4012);
+	CHECK(fl.size == FLASH_SIZE);
+}
+
+/* Writes are split at page boundaries, each page waits for the previous one */
+static void test_write(void)
+{
+	uint32_t i, programs;
+
+	for (i = 0; i < sizeof(pattern); i++)
+		pattern[i] = (uint8_t)(i * 7 + 3);
+
+	programs = flash.programs;
+	CHECK(spiflash_write(&fl, 0x1F0, pattern, 700) == SPIFLASH_OK);
+	CHECK(flash.programs - programs == 4); // 0x1F0-0x1FF, 0x200-0x2FF, 0x300-0x3FF, 0x400-0x4AB
+	CHECK_MEM(&flash.mem[0x1F0], pattern, 700);
+	CHECK(flash.mem[0x1EF] == 0xFF);
+	CHECK(flash.mem[0x1F0 + 700] == 0xFF);
+
+	// Program only clears bits
+	CHECK(spiflash_program(&fl, 0x2000, pattern, 1) == SPIFLASH_OK);
+	CHECK(spiflash_wait(&fl, 10) == SPIFLASH_OK);
+	buf[0] = (uint8_t)~pattern[0];
+	CHECK(spiflash_write(&fl, 0x2000, buf, 1) == SPIFLASH_OK);
+	CHECK(flash.mem[0x2000] == 0x00);
+
+	// A single program can not cross a page
+	CHECK(spiflash_program(&fl, 0x20F0, pattern, 0x20) == SPIFLASH_ERROR);
+	CHECK(spiflash_program(&fl, 0x2100, pattern, 0) == SPIFLASH_ERROR);
+	CHECK(spiflash_write(&fl, FLASH_SIZE - 4, pattern, 8) == SPIFLASH_ERROR);
+}
+
+static void test_read(void)
+{
+	uint32_t reads;
+
+	// Short pieces come from the page cache, one fast read per page
+	reads = flash.fastReads;
+	CHECK(spiflash_read(&fl, 0x1F8, buf, 16) == SPIFLASH_OK); // Spans 0x100 and 0x200
+	CHECK_MEM(buf, &pattern[8], 16);
+	CHECK(flash.fastReads - reads == 2);
+	CHECK(spiflash_read(&fl, 0x204, buf, 4) == SPIFLASH_OK);
+	CHECK_MEM(buf, &pattern[0x14], 4);
+	CHECK(flash.fastReads - reads == 2);
+
+	// Round robin: a third page evicts the oldest one
+	CHECK(spiflash_read(&fl, 0x300, buf, 4) == SPIFLASH_OK);
+	CHECK(flash.fastReads - reads == 3);
+	CHECK(spiflash_read(&fl, 0x100, buf, 4) == SPIFLASH_OK);
+	CHECK(flash.fastReads - reads == 4);
+
+	// Whole pages in one burst straight to the destination
+	reads = flash.fastReads;
+	CHECK(spiflash_read(&fl, 0x200, buf, 0x300) == SPIFLASH_OK);
+	CHECK_MEM(buf, &pattern[0x10], 0x2AC);
+	CHECK(flash.fastReads - reads == 1);
+
+	// Aligned start with a tail: the burst, then the tail through the cache
+	reads = flash.fastReads;
+	CHECK(spiflash_read(&fl, 0x1000, buf, 0x180) == SPIFLASH_OK);
+	CHECK(flash.fastReads - reads == 2);
+
+	// A program drops the cached copy of its page
+	CHECK(spiflash_read(&fl, 0x3000, buf, 4) == SPIFLASH_OK);
+	CHECK(buf[0] == 0xFF);
+	CHECK(spiflash_write(&fl, 0x3000, pattern, 4) == SPIFLASH_OK);
+	CHECK(spiflash_read(&fl, 0x3000, buf, 4) == SPIFLASH_OK);
+	CHECK_MEM(buf, pattern, 4);
+
+	// An erase too
+	CHECK(spiflash_erase(&fl, 0x3010, SPIFLASH_ERASE_4K) == SPIFLASH_OK);
+	CHECK(spiflash_wait(&fl, 500) == SPIFLASH_OK);
+	CHECK(spiflash_read(&fl, 0x3000, buf, 4) == SPIFLASH_OK);
+	CHECK(buf[0] == 0xFF && buf[3] == 0xFF);
+
+	// Another master wrote the chip
+	CHECK(spiflash_read(&fl, 0x3100, buf, 1) == SPIFLASH_OK);
+	flash.mem[0x3100] = 0x5A;
+	CHECK(spiflash_read(&fl, 0x3100, buf, 1) == SPIFLASH_OK);
+	CHECK(buf[0] == 0xFF);
+	spiflash_invalidate(&fl);
+	CHECK(spiflash_read(&fl, 0x3100, buf, 1) == SPIFLASH_OK);
+	CHECK(buf[0] == 0x5A);
+}
+
+static void test_busy(void)
+{
+	uint32_t i;
+
+	// Nothing but the status while an erase runs
+	CHECK(spiflash_erase(&fl, 0x1234, SPIFLASH_ERASE_4K) == SPIFLASH_OK);
+	CHECK(spiflash_busy(&fl) == 1);
+	CHECK(spiflash_read(&fl, 0, buf, 4) == SPIFLASH_BUSY);
+	CHECK(spiflash_readAsync(&fl, 0, buf, 4, onRead, NULL) == SPIFLASH_BUSY);
+	CHECK(spiflash_program(&fl, 0x8000, pattern, 4) == SPIFLASH_BUSY);
+	CHECK(spiflash_erase(&fl, 0x8000, SPIFLASH_ERASE_4K) == SPIFLASH_BUSY);
+	CHECK(spiflash_write(&fl, 0x8000, pattern, 4) == SPIFLASH_BUSY);
+	for (i = 0; i < FLASH_ERASE_POLLS && spiflash_busy(&fl); i++)
+		;
+	CHECK(spiflash_busy(&fl) == 0);
+
+	// The erase covers the aligned sector only
+	CHECK_MEM(&flash.mem[0x1F0], pattern, 700);
+	CHECK(flash.mem[0x2000] == 0x00);
+	CHECK(flash.mem[0x1000] == 0xFF && flash.mem[0x1FFF] == 0xFF);
+
+	// Timeout
+	CHECK(spiflash_erase(&fl, 0, SPIFLASH_ERASE_CHIP) == SPIFLASH_OK);
+	CHECK(spiflash_wait(&fl, 10) == SPIFLASH_BUSY);
+	CHECK(spiflash_wait(&fl, 100000) == SPIFLASH_OK);
+	CHECK(flash.mem[0x1F0] == 0xFF);
+	CHECK(spiflash_erase(&fl, 0, 0x99) == SPIFLASH_ERROR);
+}
+
+/* The SPI DMA channels taken by someone else: the read fails instead of waiting forever */
+static void test_dmaRefused(void)
+{
+	CHECK(spiflash_write(&fl, 0x400, pattern, 0x200) == SPIFLASH_OK);
+	spiflash_invalidate(&fl);
+
+	flash.dmaRefuse = 1;
+	CHECK(spiflash_read(&fl, 0x400, buf, 0x200) == SPIFLASH_BUSY);
+	CHECK(flash.cs == 0);
+	CHECK(fl.reading == 0);
+	CHECK(spiflash_read(&fl, 0x410, buf, 4) == SPIFLASH_BUSY);
+	CHECK(flash.cs == 0);
+	CHECK(spiflash_readAsync(&fl, 0x400, buf, 4, onRead, NULL) == SPIFLASH_BUSY);
+	CHECK(flash.cs == 0);
+
+	// The failed page was not cached
+	flash.dmaRefuse = 0;
+	CHECK(spiflash_read(&fl, 0x410, buf, 4) == SPIFLASH_OK);
+	CHECK_MEM(buf, &pattern[0x10], 4);
+}
+
+static void test_async(void)
+{
+	asyncDone = 0;
+	memset(buf, 0, 0x100);
+	CHECK(spiflash_readAsync(&fl, 0x400, buf, 0x100, onRead, NULL) == SPIFLASH_OK);
+	CHECK(flash.cs == 1);
+	CHECK(spiflash_read(&fl, 0x400, buf, 4) == SPIFLASH_BUSY);
+	CHECK(spiflash_readAsync(&fl, 0x400, buf, 4, onRead, NULL) == SPIFLASH_BUSY);
+	flash_dmaComplete();
+	CHECK(asyncDone == 1);
+	CHECK(flash.cs == 0);
+	CHECK_MEM(buf, pattern, 0x100);
+	CHECK(spiflash_readAsync(&fl, 0x400, buf, 0, onRead, NULL) == SPIFLASH_ERROR);
+	CHECK(spiflash_readAsync(&fl, FLASH_SIZE, buf, 1, onRead, NULL) == SPIFLASH_ERROR);
+}
+
+int main(void)
+{
+	test_init();
+	test_write();
+	test_read();
+	test_busy();
+	test_dmaRefused();
+	test_async();
+	CHECK(flash.violations == 0);
+	return test_end("spiflash");
+}
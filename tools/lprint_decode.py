@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""
+Decoder for the lprint binary log (LLOG / lprint_flush).
+
+Records are COBS encoded and separated by 0x00. Each record holds varints:
+format ID, milliseconds since the previous record, then the arguments (zigzag).
+The format strings come from the same catalog header the firmware uses:
+
+    LFMT(BOOT, "boot v{d}")
+    LFMT(TEMP, "temp {f} C, raw {x}")
+
+Usage:
+    lprint_decode.py lformats.h capture.bin
+    lprint_decode.py lformats.h /dev/ttyUSB0 --baud 115200   (needs pyserial)
+    cat capture.bin | lprint_decode.py lformats.h -
+"""
+
+import argparse
+import re
+import sys
+
+LFMT_RE = re.compile(r'^\s*LFMT\s*\(\s*(\w+)\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)', re.M)
+ARG_RE = re.compile(r'\{([dDxf])\}')
+
+
+def load_catalog(path):
+    with open(path, encoding='utf-8') as f:
+        text = re.sub(r'/\*.*?\*/|//[^\n]*', '', f.read(), flags=re.S)
+    return [(name, bytes(fmt, 'utf-8').decode('unicode_escape')) for name, fmt in LFMT_RE.findall(text)]
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data) + 1:
+            raise ValueError('bad COBS block')
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def varints(data):
+    values, value, shift = [], 0, 0
+    for b in data:
+        value |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            values.append(value)
+            value, shift = 0, 0
+    if shift:
+        raise ValueError('truncated varint')
+    return values
+
+
+def render(fmt, args):
+    """Same output as lprint(): {d}, {D} (2 digits), {x} (0x, upper case), {f} (value / 100)."""
+    it = iter(args)
+
+    def one(m):
+        try:
+            v = next(it)
+        except StopIteration:
+            return '<?>'
+        kind = m.group(1)
+        if kind == 'd':
+            return str(v)
+        if kind == 'D':
+            return '%02d' % v if v >= 0 else '-%02d' % -v  # fmt_int(): sign, then 2 digits
+        if kind == 'x':
+            return '0x%X' % v if v >= 0 else '0x-%X' % -v
+        sign = '-' if v < 0 else ''
+        return '%s%d.%02d' % (sign, abs(v) // 100, abs(v) % 100)
+
+    return ARG_RE.sub(one, fmt)
+
+
+def decode_stream(chunks, catalog, out):
+    pending = bytearray()
+    clock = 0
+    for chunk in chunks:
+        pending += chunk
+        while True:
+            end = pending.find(0)
+            if end < 0:
+                break
+            frame, pending = bytes(pending[:end]), pending[end + 1:]
+            if not frame:
+                continue
+            try:
+                fields = varints(cobs_decode(frame))
+            except ValueError as e:
+                out.write('[corrupt record: %s]\n' % e)
+                continue
+            if len(fields) < 2:
+                out.write('[short record]\n')
+                continue
+            fid, delta = fields[0], fields[1]
+            args = [(v >> 1) ^ -(v & 1) for v in fields[2:]]
+            clock += delta
+            if fid < len(catalog):
+                name, fmt = catalog[fid]
+                text = render(fmt, args)
+            else:
+                text = '<unknown id %d> %s' % (fid, args)
+            out.write('[%10.3f] %s\n' % (clock / 1000.0, text))
+            out.flush()
+
+
+def read_chunks(source, baud):
+    if source == '-':
+        stream = sys.stdin.buffer
+    elif source.startswith('/dev/') or source.upper().startswith('COM'):
+        import serial  # pyserial
+        stream = serial.Serial(source, baud, timeout=0.1)
+    else:
+        stream = open(source, 'rb')
+    while True:
+        data = stream.read(256)
+        if not data:
+            if source.startswith('/dev/') or source.upper().startswith('COM'):
+                continue
+            return
+        yield data
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode the lprint binary log')
+    parser.add_argument('catalog', help='header with the LFMT(name, "format") lines')
+    parser.add_argument('source', help='capture file, serial port or - for stdin')
+    parser.add_argument('--baud', type=int, default=115200, help='serial baudrate')
+    args = parser.parse_args()
+
+    catalog = load_catalog(args.catalog)
+    if not catalog:
+        sys.exit('no LFMT() entries in %s' % args.catalog)
+    try:
+        decode_stream(read_chunks(args.source, args.baud), catalog, sys.stdout)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()